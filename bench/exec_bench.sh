@@ -0,0 +1,36 @@
+#!/bin/sh
+# Tail-call exec benchmark: "myshell -c 'prog args'" execs prog in place of
+# the shell, while "myshell -c 'prog args; :'" has to fork it and wait.
+# Reports the processes each leaves running and runs per second.
+#
+# Usage: sh bench/exec_bench.sh [runs]
+
+SHELL_BIN=${SHELL_BIN:-./bin/myshell}
+RUNS=${1:-500}
+
+# Processes in the tree started by a command running "sleep 1"
+processes() {
+    "$SHELL_BIN" -c "$1" &
+    pid=$!
+    sleep 0.2
+    children=$(awk -v pid="$pid" '$4 == pid' /proc/[0-9]*/stat 2>/dev/null | wc -l)
+    wait $pid
+    echo $((children + 1))
+}
+
+# Time RUNS runs of a command; prints runs/sec
+run() {
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        "$SHELL_BIN" -c "$1" || exit 1
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    elapsed_ns=$((end - start))
+    [ "$elapsed_ns" -gt 0 ] || elapsed_ns=1
+    echo "$((RUNS * 1000000000 / elapsed_ns))"
+}
+
+echo "exec in place: $(processes 'sleep 1') process(es), $(run /bin/true) runs/sec"
+echo "fork and wait: $(processes 'sleep 1; :') process(es), $(run '/bin/true; :') runs/sec"
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Lexer benchmark: MB/s to read, tokenize and parse a generated script of
+# long quoted strings, paths and comments that is never run, with each
+# scan_until() version (scalar, SSE2, AVX2).
+#
+# Usage: sh bench/lex_bench.sh [megabytes]
+
+SHELL_BIN=${SHELL_BIN:-./bin/myshell}
+MB=${1:-8}
+SCRIPT=/tmp/myshell-lex-bench.$$.sh
+trap 'rm -f "$SCRIPT"' EXIT
+
+text="the quick brown fox jumps over the lazy dog while the shell keeps lexing"
+text="$text $text $text"
+path=/usr/share/doc/some-long-package-name/with/many/components
+{
+    echo "exit 0"
+    i=0
+    while [ $i -lt 64 ]; do
+        echo "msg_$i=\"$text \$HOME $text\"; echo \"$text\" $path/file_$i.txt"
+        echo "# $text"
+        i=$((i + 1))
+    done
+} > "$SCRIPT.block"
+size=$(wc -c < "$SCRIPT.block")
+count=$((MB * 1048576 / size + 1))
+i=0
+while [ $i -lt "$count" ]; do
+    cat "$SCRIPT.block"
+    i=$((i + 1))
+done > "$SCRIPT"
+rm -f "$SCRIPT.block"
+bytes=$(wc -c < "$SCRIPT")
+
+for scan in scalar sse2 avx2; do
+    start=$(date +%s%N)
+    MYSHELL_SCAN=$scan MYSHELL_MSHC=0 "$SHELL_BIN" --norc "$SCRIPT" || exit 1
+    end=$(date +%s%N)
+    elapsed_ns=$((end - start))
+    [ "$elapsed_ns" -gt 0 ] || elapsed_ns=1
+    echo "$scan: $((bytes / 1048576)) MB in $((elapsed_ns / 1000000)) ms" \
+         "($((bytes * 1000 / elapsed_ns)) MB/s)"
+done
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Loop benchmark: iterations per second for a loop body that only runs builtins.
+# The loop is parsed once; every iteration just expands and executes the body.
+#
+# Usage: sh bench/loop_bench.sh [outer] [inner]
+
+SHELL_BIN=${SHELL_BIN:-./bin/myshell}
+OUTER=${1:-100}
+INNER=${2:-1000}
+
+outer_words=$(seq -s ' ' 1 "$OUTER")
+inner_words=$(seq -s ' ' 1 "$INNER")
+script="for a in $outer_words; do for b in $inner_words; do x=\$b; true; : \$x; done; done"
+
+start=$(date +%s%N)
+"$SHELL_BIN" -c "$script" || exit 1
+end=$(date +%s%N)
+
+iterations=$((OUTER * INNER))
+elapsed_ns=$((end - start))
+[ "$elapsed_ns" -gt 0 ] || elapsed_ns=1
+
+echo "loop: $iterations iterations in $((elapsed_ns / 1000000)) ms" \
+     "($((iterations * 1000000000 / elapsed_ns)) iterations/sec)"
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Pipeline stage benchmark: pipelines per second for an all-builtin and a
+# mixed builtin/external pipeline, with builtin stages on threads of the
+# shell and with every stage forked (MYSHELL_THREADS=0).
+#
+# Usage: sh bench/pipe_bench.sh [pipelines]
+
+SHELL_BIN=${SHELL_BIN:-./bin/myshell}
+COUNT=${1:-2000}
+
+# Run COUNT copies of a pipeline in one shell; prints pipelines/sec
+run() {
+    start=$(date +%s%N)
+    MYSHELL_THREADS=$1 "$SHELL_BIN" --norc -c "i=0; while (( i < $COUNT )); do $2; let i=i+1; done" > /dev/null || exit 1
+    end=$(date +%s%N)
+    elapsed_ns=$((end - start))
+    [ "$elapsed_ns" -gt 0 ] || elapsed_ns=1
+    echo "$((COUNT * 1000000000 / elapsed_ns))"
+}
+
+for pipeline in 'echo $i | cat | cat' 'echo $i | tr 0-9 a-j | cat'; do
+    echo "$pipeline: threads $(run 1 "$pipeline")/sec, forked $(run 0 "$pipeline")/sec"
+done
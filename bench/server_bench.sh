@@ -0,0 +1,46 @@
+#!/bin/sh
+# Server benchmark: requests per second for a small script that needs a
+# function library, run by a cold "myshell -c" (which has to load the
+# library every time) versus "myshell --client" against a --server that
+# loaded it once.
+#
+# Usage: sh bench/server_bench.sh [requests] [library functions]
+
+SHELL_BIN=${SHELL_BIN:-./bin/myshell}
+REQUESTS=${1:-300}
+FUNCTIONS=${2:-200}
+SOCKET=${SOCKET:-/tmp/myshell-bench.$$.sock}
+LIBRARY=/tmp/myshell-bench.$$.lib
+SCRIPT='x=$(f1 2); echo $((x + 1)) > /dev/null'
+
+i=1
+while [ $i -le "$FUNCTIONS" ]; do
+    echo "f$i() { local n=\$1; echo \$((n * $i)); }"
+    i=$((i + 1))
+done > "$LIBRARY"
+library=$(cat "$LIBRARY")
+
+"$SHELL_BIN" --server "$SOCKET" "$LIBRARY" &
+server=$!
+trap 'kill $server 2>/dev/null; rm -f "$SOCKET" "$LIBRARY"' EXIT
+while [ ! -S "$SOCKET" ]; do sleep 0.01; done
+
+# Time REQUESTS runs of a command; prints requests/sec
+run() {
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$REQUESTS" ]; do
+        "$@" || exit 1
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    elapsed_ns=$((end - start))
+    [ "$elapsed_ns" -gt 0 ] || elapsed_ns=1
+    echo "$((REQUESTS * 1000000000 / elapsed_ns))"
+}
+
+cold=$(run "$SHELL_BIN" -c "$library
+$SCRIPT")
+warm=$(run "$SHELL_BIN" --client "$SOCKET" -c "$SCRIPT")
+echo "cold start: $cold requests/sec ($FUNCTIONS functions loaded per request)"
+echo "server:     $warm requests/sec"
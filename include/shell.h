@@ -10,6 +10,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdint.h>
+#include <setjmp.h>
 
 // Check if readline is available by testing its existence
 #if __has_include(<readline/readline.h>) && __has_include(<readline/history.h>)
@@ -61,27 +63,10 @@ rl_completion_func_t* rl_attempted_completion_function = NULL;
 #define HISTORY_SIZE 20
 #define MAX_PIPES 10
 #define MAX_JOBS 100
-#define MAX_IF_BLOCKS 10
-#define MAX_BLOCK_LINES 20
-#define MAX_VARIABLES 100  // NEW: Maximum number of variables
 #define VAR_NAME_LEN 50    // NEW: Maximum variable name length
-#define VAR_VALUE_LEN 256  // NEW: Maximum variable value length
 
-// NEW: Structure for shell variables
-typedef struct {
-    char name[VAR_NAME_LEN];
-    char value[VAR_VALUE_LEN];
-} variable_t;
-
-// Structure for if-then-else block
-typedef struct {
-    char* condition;                    // Condition command
-    char* then_commands[MAX_BLOCK_LINES]; // Commands in then block
-    char* else_commands[MAX_BLOCK_LINES]; // Commands in else block
-    int then_count;                     // Number of commands in then block
-    int else_count;                     // Number of commands in else block
-    int has_else;                       // Whether else block exists
-} if_block_t;
+// Indexed or associative array (array.c)
+typedef struct array array_t;
 
 // Job status enumeration
 typedef enum {
@@ -98,25 +83,328 @@ typedef struct {
     int job_id;          // Job ID number
 } job_t;
 
-// Structure to hold command information with redirection
+// Results returned by the lexer and parser
+#define PARSE_OK 0
+#define PARSE_ERROR -1
+#define PARSE_INCOMPLETE 1  // Input ended inside a quote or unfinished construct
+
+// Token types produced by the lexer
+typedef enum {
+    TOK_WORD,
+    TOK_NEWLINE,
+    TOK_SEMI,     // ;
+    TOK_DSEMI,    // ;;
+    TOK_AMP,      // &
+    TOK_PIPE,     // |
+    TOK_AND_IF,   // &&
+    TOK_OR_IF,    // ||
+    TOK_LESS,     // <
+    TOK_GREAT,    // > or >|
+    TOK_DGREAT,   // >>
+    TOK_LESSAND,  // <&
+    TOK_GREATAND, // >&
+    TOK_LESSGREAT,// <>
+    TOK_ANDGREAT, // &>
+    TOK_ANDDGREAT,// &>>
+    TOK_DLESS,    // <<
+    TOK_DLESSDASH,// <<-
+    TOK_TLESS,    // <<<
+    TOK_IO_NUMBER,// Digits directly before a redirection operator
+    TOK_LPAREN,   // (
+    TOK_RPAREN,   // )
+    TOK_ARITH,    // (( expression )); text holds the expression
+    TOK_EOF
+} token_type_t;
+
+// A single token; words keep their raw text (quotes included)
+typedef struct {
+    token_type_t type;
+    char* text;   // Raw word text, NULL for operators
+    int start;    // Offset of the token in the source
+    int end;      // Offset just past the token
+    char* body;   // Here-document body, on the delimiter word after << / <<-
+} token_t;
+
+// Growable array of tokens
+typedef struct {
+    token_t* tokens;
+    int count;
+    int capacity;
+    char* strings;  // Texts of all tokens, one allocation
+    size_t used;
+} token_list_t;
+
+// Word flags computed once at parse time
+#define WORD_NEEDS_EXPANSION 0x01  // Contains $, quotes, backslashes or <( >(
+#define WORD_ASSIGNMENT 0x02       // NAME=value argument of local and friends (not split)
+#define WORD_HAS_GLOB 0x04         // Contains * ? or [ (pathname expansion candidate)
+
+// An unexpanded word; expansion is deferred until execution
+typedef struct {
+    char* text;   // Raw text as written in the source
+    int flags;    // WORD_* flags
+} word_t;
+
+typedef struct node node_t;
+
+// Here-document (<<) or here-string (<<<) feeding a command's stdin
+typedef struct {
+    word_t body;             // Body text; expanded at run time if flagged
+    int here_string;         // <<< word: body is an ordinary word plus a newline
+} here_doc_t;
+
+// Arithmetic expression compiled to bytecode (see arith.c)
+typedef struct arith_expr arith_expr_t;
+
+// Directory listings shared by the globs of one command (see pathname.c)
+typedef struct dir_cache dir_cache_t;
+
+// Saved copy of the shell variables (see variables.c)
+typedef struct variable_snapshot variable_snapshot_t;
+
+// Saved function definitions (see functions.c)
+typedef struct function_snapshot function_snapshot_t;
+
+// Redirection operations, applied in source order
+typedef enum {
+    REDIR_INPUT,             // [n]<file
+    REDIR_OUTPUT,            // [n]>file
+    REDIR_APPEND,            // [n]>>file
+    REDIR_RDWR,              // [n]<>file
+    REDIR_DUP,               // [n]>&m, [n]<&m, [n]>&-
+    REDIR_HERE_DOC           // [n]<<word, [n]<<<word
+} redir_type_t;
+
+typedef struct {
+    redir_type_t type;
+    int fd;                  // Descriptor being redirected
+    word_t target;           // File name, or descriptor number / '-' for REDIR_DUP
+    here_doc_t* here_doc;    // REDIR_HERE_DOC
+} redirection_t;
+
+// Simple command: assignments, arguments and redirections, all unexpanded
 typedef struct {
-    char* args[MAXARGS];     // Command arguments
-    char* input_file;        // File for input redirection (<)
-    char* output_file;       // File for output redirection (>)
-    int background;          // Run in background (&)
+    word_t* words;           // Command name and arguments
+    int num_words;
+    word_t* assigns;         // Leading NAME=value words
+    int num_assigns;
+    redirection_t* redirs;   // Redirections in source order
+    int num_redirs;
+    int exec_tail;           // Last command of the script: exec it in place
 } command_t;
 
-// Structure to hold pipeline information
+// Original descriptors saved by apply_redirections()
 typedef struct {
-    command_t commands[MAX_PIPES];  // Commands in the pipeline
-    int num_commands;               // Number of commands in pipeline
+    int fd;                  // Descriptor that was redirected
+    int backup;              // Copy of the original, -1 if it was not open
+} saved_fd_t;
+
+typedef struct {
+    saved_fd_t* items;
+    int count;
+} redir_undo_t;
+
+// Pipeline of commands connected by pipes
+typedef struct {
+    node_t** commands;       // Stages of the pipeline
+    int num_commands;        // Number of stages
+    int negate;              // Leading '!' inverts the exit status
 } pipeline_t;
 
+// if / elif / else block; an elif is stored as a nested if in else_part
+typedef struct {
+    node_t* condition;       // Condition list
+    node_t* then_part;       // Commands run when the condition succeeds
+    node_t* else_part;       // Commands run otherwise (NULL if absent)
+} if_block_t;
+
+// while / until loop
+typedef struct {
+    node_t* condition;       // Condition list, run before every iteration
+    node_t* body;            // Loop body
+    int until;               // Loop until the condition succeeds
+} loop_t;
+
+// for NAME in WORDS; do BODY; done
+typedef struct {
+    char* var;               // Loop variable name
+    word_t* words;           // Unexpanded word list
+    int num_words;
+    node_t* body;            // Loop body
+} for_loop_t;
+
+// Shell function; the parsed body is shared by the definition node and the
+// function table, so it is reference counted
+typedef struct function {
+    char* name;              // Function name
+    node_t* body;            // Parsed body (a compound command)
+    int refs;                // Owners: definition node, table, running calls
+    struct function* next;   // Next function in the same hash bucket
+} function_t;
+
+// Compiled glob pattern element
+typedef enum {
+    GLOB_CHAR,   // Literal character
+    GLOB_ANY,    // ?
+    GLOB_CLASS,  // [...]
+    GLOB_STAR    // *
+} glob_op_t;
+
+typedef struct {
+    glob_op_t op;
+    unsigned char ch;        // GLOB_CHAR
+    unsigned char set[32];   // GLOB_CLASS bitmap of accepted bytes
+} glob_elem_t;
+
+// Pattern compiled once and matched without backtracking
+typedef struct {
+    glob_elem_t* elems;
+    int count;
+    int has_wildcards;       // 0 if the pattern is a plain string
+    char* literal;           // Unescaped text (the whole pattern if no wildcards)
+} glob_pattern_t;
+
+// Literal case pattern in the dispatch hash table
+typedef struct case_literal {
+    char* text;
+    int arm;                 // Lowest arm index with this literal
+    struct case_literal* next;
+} case_literal_t;
+
+// Non-literal case pattern, checked in source order
+typedef struct {
+    glob_pattern_t* glob;    // Pre-compiled matcher, NULL if dynamic
+    word_t* word;            // Pattern containing $, expanded at run time
+    int arm;
+} case_pattern_t;
+
+// One 'pattern | pattern ) list ;;' arm
+typedef struct {
+    word_t* patterns;        // Unexpanded patterns
+    int num_patterns;
+    node_t* body;            // Commands for this arm
+} case_arm_t;
+
+// case WORD in ... esac, with patterns compiled at parse time
+typedef struct {
+    word_t word;             // Subject word
+    case_arm_t* arms;
+    int num_arms;
+    case_literal_t** buckets;// Hash table of literal patterns
+    int num_buckets;
+    case_pattern_t* patterns;// Glob and dynamic patterns
+    int num_patterns;
+} case_block_t;
+
+// AST node types
+typedef enum {
+    NODE_COMMAND,   // Simple command
+    NODE_PIPELINE,  // cmd | cmd ...
+    NODE_AND,       // left && right
+    NODE_OR,        // left || right
+    NODE_LIST,      // Commands separated by ; & or newline
+    NODE_IF,        // if-then-elif-else-fi
+    NODE_WHILE,     // while / until loop
+    NODE_FOR,       // for loop
+    NODE_FUNCDEF,   // name() compound-command
+    NODE_CASE,      // case WORD in ... esac
+    NODE_GROUP,     // { list; }
+    NODE_SUBSHELL,  // ( list )
+    NODE_ARITH      // (( expression ))
+} node_type_t;
+
+// AST node; built once by the parser and walked by execute_node()
+struct node {
+    node_type_t type;
+    int background;          // Run asynchronously (&)
+    char* source;            // Source text, kept for background job display
+    command_t* redirect;     // Redirections after a compound command, or NULL
+    union {
+        command_t command;
+        pipeline_t pipeline;
+        struct {
+            node_t* left;
+            node_t* right;
+        } binary;            // NODE_AND / NODE_OR
+        struct {
+            node_t** items;
+            int count;
+        } list;              // NODE_LIST
+        if_block_t if_block; // NODE_IF
+        loop_t loop;         // NODE_WHILE
+        for_loop_t for_loop; // NODE_FOR
+        function_t* function;// NODE_FUNCDEF
+        case_block_t case_block; // NODE_CASE
+        node_t* body;        // NODE_GROUP / NODE_SUBSHELL
+        struct {
+            char* text;          // Expression source
+            arith_expr_t* expr;  // Compiled at parse time unless it contains $
+        } arith;             // NODE_ARITH
+    };
+};
+
+// Parser state shared by parser.c and control_structures.c
+typedef struct {
+    const char* input;       // Source being parsed
+    token_list_t tokens;     // Tokens of the whole input
+    int pos;                 // Index of the next token
+    int incomplete;          // Ran out of input inside a construct
+    int error;               // A syntax error was reported
+} parser_t;
+
+// Growable string buffer used by the expander
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} strbuf_t;
+
+// Exit status of the last command ($?)
+extern int last_status;
+
+// Non-zero when reading commands from the terminal prompt
+extern int interactive;
+
+// Pending break / continue levels set by the builtins
+extern int loop_depth;
+extern int break_levels;
+extern int continue_levels;
+
+// Pending return from a shell function
+extern int function_depth;
+extern int return_pending;
+
+// Set while a command substitution runs in-process; 'exit' jumps here
+extern jmp_buf* substitution_exit;
+
+// Exit status of the most recent command substitution
+extern int substitution_status;
+
+// Prefix assignments (NAME=value) of the builtin being run, or NULL;
+// builtins that run commands pass them on to their environment
+extern char** command_assigns;
+
+// Set when an expansion failed (an arithmetic error such as $((1/0)) or a
+// bad ${...}); the command that was being expanded must not run
+extern int expansion_error;
+
+// Sample pipe fill levels of pipelines (set -o pipestats)
+extern int pipe_stats;
+
+// Positional parameters ($0, $1..$N)
+extern char* shell_name;
+extern char** positional_args;
+extern int positional_count;
+
 // Function prototypes
 char* read_cmd(char* prompt, FILE* fp);
+char* read_file(const char* path, struct stat* st);
 char** tokenize(char* cmdline);
-int execute(char** arglist);
+int execute(char** arglist, char** assigns);
 int handle_builtin(char** arglist);
+int is_builtin(const char* name);
+typedef int (*builtin_func_t)(char** arglist);
+builtin_func_t stream_builtin(const char* name);
 
 // History function prototypes
 void add_to_history(const char* cmd);
@@ -129,12 +417,79 @@ char* expand_history_command(const char* cmdline);
 char* read_cmd_readline(const char* prompt);
 void initialize_readline();
 
+// Lexer function prototypes
+int lex_input(const char* input, token_list_t* list);
+void free_tokens(token_list_t* list);
+const char* skip_balanced(const char* p, char open, char close);
+
+// Byte classes for scan_until() (see scan.c)
+#define SCAN_WORD 0      // Bytes that end an unquoted word or start a quote or $
+#define SCAN_DQUOTE 1    // " \ and $ inside double quotes
+#define SCAN_EXPAND 2    // Bytes word expansion handles: quotes, \, $, <( >( and globs
+#define SCAN_HEREDOC 3   // \ and $ in a here-document body
+const char* scan_until(const char* p, int class);
+
+// Parser function prototypes
+int parse_program(const char* input, node_t** tree);
+node_t* new_node(node_type_t type);
+void free_node(node_t* node);
+void append_word(word_t** words, int* count, const char* text);
+token_t* peek_token(parser_t* p);
+int is_keyword(token_t* tok, const char* word);
+int accept_keyword(parser_t* p, const char* word);
+int expect_keyword(parser_t* p, const char* word);
+void syntax_error(parser_t* p, token_t* tok, const char* expected);
+void skip_newlines(parser_t* p);
+node_t* parse_list(parser_t* p);
+node_t* parse_compound_list(parser_t* p);
+node_t* parse_command(parser_t* p);
+
+// Script and server entry points
+int run_script(const char* source);
+int run_server(const char* path, const char* init);
+extern int server_session;
+int run_client(const char* path, const char* source, char** args, int num_args);
+
+// Compiled scripts (.mshc)
+int save_compiled(const char* file, node_t* tree, const char* source_path,
+                  const struct stat* st);
+int load_compiled(const char* file, node_t** tree, char** source_path);
+node_t* load_cached_script(const char* path);
+void cache_script(const char* path, const struct stat* st, node_t* tree);
+int compile_script(const char* path);
+uint32_t encode_tree(strbuf_t* blob, const node_t* tree);
+int decode_tree(const char* data, size_t size, size_t start, uint32_t offset, node_t** tree);
+
+// Startup snapshot of the rc file's variables and functions
+const char* image_string(const char** p, const char* end);
+char* snapshot_file(const char* path);
+int save_snapshot(const char* file, const struct stat* rc, char** names, int count);
+int load_snapshot(const char* file, const struct stat* rc);
+void dump_variables(char** names, int count, strbuf_t* out);
+int load_variables(const char** p, const char* end);
+void dump_functions(strbuf_t* blob, strbuf_t* table);
+int load_functions(const char** p, const char* end, const char* data, size_t size, size_t start);
+
+// Execution function prototypes
+int decode_status(int status);
+int execute_node(node_t* node);
+int execute_command(command_t* cmd, int in_child);
+int expansion_failed();
+int execute_batched(char** argv, int fixed, int jobs, char** assigns);
+void exec_in_child(char** argv, char** assigns);
+void mark_tail_commands(node_t* node);
+
 // Redirection and pipe function prototypes
-int parse_redirection_pipes(char* cmdline, pipeline_t* pipeline);
-void free_pipeline(pipeline_t* pipeline);
-int execute_redirection(command_t* cmd);
+int apply_redirections(command_t* cmd, redir_undo_t* undo);
+void restore_redirections(redir_undo_t* undo);
+long parse_size(const char* text);
 int execute_pipeline(pipeline_t* pipeline);
-int execute_single_command(command_t* cmd);
+
+// Standard input and output of the running builtin: a pipeline stage on a
+// thread has its own pipe ends, everything else uses fds 0 and 1
+extern __thread int stage_in;
+extern __thread int stage_out;
+FILE* stage_stream();
 
 // Job control function prototypes
 void init_jobs();
@@ -143,20 +498,181 @@ void remove_job(pid_t pid);
 void update_jobs();
 void print_jobs();
 void cleanup_zombies();
-int execute_background(command_t* cmd);
+int execute_background(node_t* node);
+int has_jobs();
 
 // if-then-else function prototypes
-int parse_if_block(char** lines, int num_lines, if_block_t* if_block);
+node_t* parse_if_block(parser_t* p);
 int execute_if_block(if_block_t* if_block);
 int is_control_keyword(const char* word);
-char* read_multiline_command(const char* initial_prompt);
 void free_if_block(if_block_t* if_block);
 
+// Loop function prototypes
+node_t* parse_while_loop(parser_t* p);
+node_t* parse_for_loop(parser_t* p);
+int execute_while_loop(loop_t* loop);
+int execute_for_loop(for_loop_t* for_loop);
+int is_unwinding();
+
+// case function prototypes
+node_t* parse_case_block(parser_t* p);
+int execute_case_block(case_block_t* case_block);
+void free_case_block(case_block_t* case_block);
+void compile_case_patterns(case_block_t* case_block);
+
+// Glob pattern function prototypes
+int is_glob_char(char c);
+glob_pattern_t* compile_glob(const char* pattern);
+void free_glob(glob_pattern_t* g);
+int glob_match(const glob_pattern_t* g, const char* str);
+int glob_match_prefix(const glob_pattern_t* g, const char* str, int longest);
+glob_pattern_t* cached_glob(const char* pattern);
+
+// Pathname expansion function prototypes
+dir_cache_t* dir_cache_new();
+void dir_cache_free(dir_cache_t* cache);
+int expand_pathname(const char* pattern, dir_cache_t* cache, char*** matches);
+void free_word_array(word_t* words, int count);
+void init_word(word_t* word, const char* text);
+
+// Arithmetic function prototypes
+arith_expr_t* compile_arith(const char* text);
+int eval_arith(arith_expr_t* expr, long long* result);
+void free_arith(arith_expr_t* expr);
+int arith_evaluate(const char* text, long long* result);
+
+// Shell function prototypes
+node_t* parse_function_def(parser_t* p);
+function_t* new_function(const char* name, node_t* body);
+void define_function(function_t* func);
+function_t* find_function(const char* name);
+void release_function(function_t* func);
+function_snapshot_t* save_functions();
+void restore_functions(function_snapshot_t* snap);
+int call_function(function_t* func, char** argv, char** assigns);
+
+// Expansion function prototypes
+char** expand_words(word_t* words, int count);
+char* expand_word_string(word_t* word);
+char* expand_word_pattern(word_t* word);
+char* expand_here_doc(here_doc_t* here_doc);
+void free_argv(char** argv);
+const char* expand_dollar(const char* p, strbuf_t* out);
+void expand_braced(const char* inner, strbuf_t* out);
+
+// Command substitution function prototypes
+int command_substitution(const char* command, strbuf_t* out);
+int process_substitution_mark();
+void process_substitution(const char* command, int writing, strbuf_t* out);
+void finish_process_substitutions(int mark, int wait);
+
+// Zero-copy file builtins
+int builtin_cat(char** arglist);
+int builtin_cp(char** arglist);
+int builtin_tee(char** arglist);
+int copy_stream(int in, int out);
+
+// parallel and cached builtins
+int builtin_parallel(char** arglist);
+int builtin_cached(char** arglist);
+const char* cache_directory(const char* name, const char* dir);
+
+// read and mapfile builtins
+int builtin_read(char** arglist);
+int builtin_mapfile(char** arglist);
+
+// Per-phase latency histograms and counters (stats builtin)
+typedef enum {
+    STAT_READ,      // Waiting for a line at the prompt
+    STAT_HISTORY,   // ! history expansion
+    STAT_PARSE,     // Lexing and parsing
+    STAT_EXPAND,    // Expanding the words of a command
+    STAT_FORK,      // fork() in the parent
+    STAT_RUN,       // External command, fork to reaped
+    STAT_WAIT,      // Blocked in waitpid()
+    STAT_COMMAND,   // Running a parsed command line or script
+    STAT_PHASES
+} stat_phase_t;
+
+typedef enum {
+    STAT_FORKS,
+    STAT_EXECS,
+    STAT_BUILTINS,
+    STAT_ALLOCS,
+    STAT_COUNTERS
+} stat_counter_t;
+
+extern int stats_enabled;
+uint64_t stats_now();
+void stats_add_time(stat_phase_t phase, uint64_t start);
+void stats_add_count(stat_counter_t counter);
+
+// Start timing a phase: the monotonic time in nanoseconds, or 0 while
+// stats are off. Inlined even without optimization, so the hooks cost a
+// single test of stats_enabled when off.
+static inline __attribute__((always_inline)) uint64_t stats_clock() {
+    return stats_enabled ? stats_now() : 0;
+}
+
+// Add the time since start to a phase
+static inline __attribute__((always_inline)) void stats_record(stat_phase_t phase, uint64_t start) {
+    if (start != 0) stats_add_time(phase, start);
+}
+
+static inline __attribute__((always_inline)) void stats_count(stat_counter_t counter) {
+    if (stats_enabled) stats_add_count(counter);
+}
+pid_t stats_fork();
+pid_t stats_waitpid(pid_t pid, int* status, int options);
+int builtin_stats(char** arglist);
+
+// String buffer helpers
+void sb_init(strbuf_t* sb);
+void sb_reserve(strbuf_t* sb, size_t extra);
+void sb_putc(strbuf_t* sb, char c);
+void sb_append(strbuf_t* sb, const char* str);
+void sb_appendn(strbuf_t* sb, const char* str, size_t n);
+char* sb_release(strbuf_t* sb);
+void sb_free(strbuf_t* sb);
+unsigned int hash_string(const char* str);
+unsigned long long hash_bytes(const void* data, size_t len);
+
 // NEW: Variable function prototypes
 void init_variables();
 void set_variable(const char* name, const char* value);
 char* get_variable(const char* name);
+int is_valid_name(const char* name);
 int is_variable_assignment(const char* cmdline);
-int handle_variable_assignment(const char* cmdline);
 char* expand_variables(const char* str);
 void print_variables();
+void unset_variable(const char* name);
+void push_scope();
+void pop_scope();
+void make_local(const char* name);
+void append_parameter(const char* name, strbuf_t* out);
+int parameter_is_set(const char* name);
+variable_snapshot_t* save_variables();
+void restore_variables(variable_snapshot_t* snap);
+char** keep_variables(variable_snapshot_t* snap, int* count);
+void set_array(const char* name, char** items, int count);
+array_t* get_array(const char* name);
+array_t* make_array(const char* name, int assoc);
+int is_compound_assignment(const char* text);
+int assign_word(const char* text, int raw);
+int print_declarations(char** names, int as_declare);
+
+// Array function prototypes
+array_t* array_new(int assoc);
+void array_free(array_t* a);
+array_t* array_copy(const array_t* a);
+int array_is_assoc(const array_t* a);
+long long array_count(const array_t* a);
+long long array_end(const array_t* a);
+const char* array_get_index(const array_t* a, long long index);
+int array_set_index(array_t* a, long long index, const char* value);
+void array_unset_index(array_t* a, long long index);
+const char* array_get_key(const array_t* a, const char* key);
+void array_set_key(array_t* a, const char* key, const char* value);
+void array_unset_key(array_t* a, const char* key);
+int array_next(const array_t* a, long long* pos, long long* index, const char** key,
+               const char** value);
@@ -0,0 +1,493 @@
+#include "shell.h"
+
+#define ARITH_CACHE_SIZE 256   // Hash buckets for compiled expressions
+#define ARITH_CACHE_MAX 1024   // Entries kept before the cache is flushed
+
+// Bytecode operations for the arithmetic stack machine
+typedef enum {
+    OP_PUSH,       // Push value
+    OP_LOAD,       // Push variable
+    OP_STORE,      // Store top of stack in variable (value stays on stack)
+    OP_POP,        // Drop top of stack
+    OP_NEG, OP_NOT, OP_BNOT,
+    OP_MUL, OP_DIV, OP_MOD, OP_POW,
+    OP_ADD, OP_SUB, OP_SHL, OP_SHR,
+    OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+    OP_BAND, OP_BXOR, OP_BOR,
+    OP_BOOL,       // Normalize top of stack to 0 / 1
+    OP_JZ,         // Pop, jump if zero
+    OP_JMP,        // Jump
+    OP_AND_JUMP,   // If top is zero jump (keeping 0), else pop
+    OP_OR_JUMP,    // If top is non-zero jump (keeping 1), else pop
+    OP_INC,        // Add value to variable; push new value (pre) or old (post)
+} arith_opcode_t;
+
+typedef struct {
+    arith_opcode_t op;
+    long long value;   // Constant, jump target or increment
+    int post;          // OP_INC: push the old value
+    char* name;        // Variable for OP_LOAD / OP_STORE / OP_INC
+} arith_insn_t;
+
+// Expression compiled once into postfix bytecode
+struct arith_expr {
+    arith_insn_t* code;
+    int count;
+    char* text;                // Source text, used as the cache key
+    struct arith_expr* next;   // Next entry in the cache bucket
+};
+
+// Compiler state
+typedef struct {
+    const char* p;             // Current position in the expression
+    arith_expr_t* expr;
+    const char* error;         // First error seen
+} arith_parser_t;
+
+static arith_expr_t* arith_cache[ARITH_CACHE_SIZE];
+static int arith_cache_count = 0;
+
+static void parse_comma(arith_parser_t* ap);
+static void parse_assign(arith_parser_t* ap);
+
+// Append an instruction and return its index
+static int emit(arith_parser_t* ap, arith_opcode_t op, long long value, const char* name) {
+    arith_expr_t* expr = ap->expr;
+    expr->code = realloc(expr->code, (expr->count + 1) * sizeof(arith_insn_t));
+    if (expr->code == NULL) {
+        perror("realloc failed");
+        exit(1);
+    }
+    arith_insn_t* insn = &expr->code[expr->count];
+    insn->op = op;
+    insn->value = value;
+    insn->post = 0;
+    insn->name = name ? strdup(name) : NULL;
+    return expr->count++;
+}
+
+// Skip whitespace in the expression
+static void skip_space(arith_parser_t* ap) {
+    while (*ap->p == ' ' || *ap->p == '\t' || *ap->p == '\n') ap->p++;
+}
+
+// Consume an operator if it is next (and is not the start of a longer one)
+static int accept_op(arith_parser_t* ap, const char* op, const char* not_followed_by) {
+    skip_space(ap);
+    size_t len = strlen(op);
+    if (strncmp(ap->p, op, len) != 0) return 0;
+    if (not_followed_by != NULL && ap->p[len] != '\0' && strchr(not_followed_by, ap->p[len])) return 0;
+    ap->p += len;
+    return 1;
+}
+
+// Read a variable name at the current position into buf
+static int read_name(arith_parser_t* ap, char* buf, size_t size) {
+    skip_space(ap);
+    const char* start = ap->p;
+    if (!((*start >= 'a' && *start <= 'z') || (*start >= 'A' && *start <= 'Z') || *start == '_')) {
+        return 0;
+    }
+    const char* end = start;
+    while ((*end >= 'a' && *end <= 'z') || (*end >= 'A' && *end <= 'Z') ||
+           (*end >= '0' && *end <= '9') || *end == '_') {
+        end++;
+    }
+    size_t len = end - start;
+    if (len >= size) len = size - 1;
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    ap->p = end;
+    return 1;
+}
+
+// primary: number | name [++|--] | ( comma )
+static void parse_primary(arith_parser_t* ap) {
+    char name[VAR_NAME_LEN];
+    skip_space(ap);
+
+    if (*ap->p >= '0' && *ap->p <= '9') {
+        char* end;
+        long long value = strtoll(ap->p, &end, 0);
+        ap->p = end;
+        emit(ap, OP_PUSH, value, NULL);
+    } else if (read_name(ap, name, sizeof(name))) {
+        if (accept_op(ap, "++", NULL) || accept_op(ap, "--", NULL)) {
+            int i = emit(ap, OP_INC, ap->p[-1] == '+' ? 1 : -1, name);
+            ap->expr->code[i].post = 1;
+        } else {
+            emit(ap, OP_LOAD, 0, name);
+        }
+    } else if (accept_op(ap, "(", NULL)) {
+        parse_comma(ap);
+        if (!accept_op(ap, ")", NULL) && ap->error == NULL) {
+            ap->error = "missing ')'";
+        }
+    } else if (ap->error == NULL) {
+        ap->error = *ap->p ? "syntax error: operand expected" : "unexpected end of expression";
+    }
+}
+
+// unary: (+ | - | ! | ~) unary | (++ | --) name | primary
+static void parse_unary(arith_parser_t* ap) {
+    char name[VAR_NAME_LEN];
+
+    if (accept_op(ap, "++", NULL) || accept_op(ap, "--", NULL)) {
+        long long delta = ap->p[-1] == '+' ? 1 : -1;
+        if (!read_name(ap, name, sizeof(name))) {
+            if (ap->error == NULL) ap->error = "variable expected after ++/--";
+            return;
+        }
+        emit(ap, OP_INC, delta, name);
+    } else if (accept_op(ap, "-", NULL)) {
+        parse_unary(ap);
+        emit(ap, OP_NEG, 0, NULL);
+    } else if (accept_op(ap, "+", NULL)) {
+        parse_unary(ap);
+    } else if (accept_op(ap, "!", "=")) {
+        parse_unary(ap);
+        emit(ap, OP_NOT, 0, NULL);
+    } else if (accept_op(ap, "~", NULL)) {
+        parse_unary(ap);
+        emit(ap, OP_BNOT, 0, NULL);
+    } else {
+        parse_primary(ap);
+    }
+}
+
+// power: unary [** power]  (right associative)
+static void parse_power(arith_parser_t* ap) {
+    parse_unary(ap);
+    if (accept_op(ap, "**", NULL)) {
+        parse_power(ap);
+        emit(ap, OP_POW, 0, NULL);
+    }
+}
+
+// Binary operator table, one row per precedence level (tightest first)
+typedef struct {
+    const char* op;
+    const char* not_followed_by;
+    arith_opcode_t code;
+} binop_t;
+
+static const binop_t binop_levels[][5] = {
+    { { "*", "=*", OP_MUL }, { "/", "=", OP_DIV }, { "%", "=", OP_MOD }, { NULL, NULL, 0 } },
+    { { "+", "=+", OP_ADD }, { "-", "=-", OP_SUB }, { NULL, NULL, 0 } },
+    { { "<<", "=", OP_SHL }, { ">>", "=", OP_SHR }, { NULL, NULL, 0 } },
+    { { "<=", NULL, OP_LE }, { ">=", NULL, OP_GE }, { "<", "<", OP_LT }, { ">", ">", OP_GT }, { NULL, NULL, 0 } },
+    { { "==", NULL, OP_EQ }, { "!=", NULL, OP_NE }, { NULL, NULL, 0 } },
+    { { "&", "&=", OP_BAND }, { NULL, NULL, 0 } },
+    { { "^", "=", OP_BXOR }, { NULL, NULL, 0 } },
+    { { "|", "|=", OP_BOR }, { NULL, NULL, 0 } },
+};
+
+#define NUM_BINOP_LEVELS ((int)(sizeof(binop_levels) / sizeof(binop_levels[0])))
+
+// Left-associative binary operators at a precedence level
+static void parse_binary(arith_parser_t* ap, int level) {
+    if (level < 0) {
+        parse_power(ap);
+        return;
+    }
+
+    parse_binary(ap, level - 1);
+    while (ap->error == NULL) {
+        const binop_t* found = NULL;
+        for (const binop_t* b = binop_levels[level]; b->op != NULL; b++) {
+            if (accept_op(ap, b->op, b->not_followed_by)) {
+                found = b;
+                break;
+            }
+        }
+        if (found == NULL) break;
+        parse_binary(ap, level - 1);
+        emit(ap, found->code, 0, NULL);
+    }
+}
+
+// logical and: a && b, short-circuit
+static void parse_logand(arith_parser_t* ap) {
+    parse_binary(ap, NUM_BINOP_LEVELS - 1);
+    while (ap->error == NULL && accept_op(ap, "&&", NULL)) {
+        int jump = emit(ap, OP_AND_JUMP, 0, NULL);
+        parse_binary(ap, NUM_BINOP_LEVELS - 1);
+        emit(ap, OP_BOOL, 0, NULL);
+        ap->expr->code[jump].value = ap->expr->count;
+    }
+}
+
+// logical or: a || b, short-circuit
+static void parse_logor(arith_parser_t* ap) {
+    parse_logand(ap);
+    while (ap->error == NULL && accept_op(ap, "||", NULL)) {
+        int jump = emit(ap, OP_OR_JUMP, 0, NULL);
+        parse_logand(ap);
+        emit(ap, OP_BOOL, 0, NULL);
+        ap->expr->code[jump].value = ap->expr->count;
+    }
+}
+
+// conditional: logor [? comma : conditional]
+static void parse_ternary(arith_parser_t* ap) {
+    parse_logor(ap);
+    if (ap->error == NULL && accept_op(ap, "?", NULL)) {
+        int to_else = emit(ap, OP_JZ, 0, NULL);
+        parse_comma(ap);
+        int to_end = emit(ap, OP_JMP, 0, NULL);
+        if (!accept_op(ap, ":", NULL) && ap->error == NULL) {
+            ap->error = "missing ':' in conditional expression";
+        }
+        ap->expr->code[to_else].value = ap->expr->count;
+        parse_ternary(ap);
+        ap->expr->code[to_end].value = ap->expr->count;
+    }
+}
+
+// Compound assignment operators and the binary operation they apply
+static const binop_t assign_ops[] = {
+    { "*=", NULL, OP_MUL }, { "/=", NULL, OP_DIV }, { "%=", NULL, OP_MOD },
+    { "+=", NULL, OP_ADD }, { "-=", NULL, OP_SUB }, { "<<=", NULL, OP_SHL },
+    { ">>=", NULL, OP_SHR }, { "&=", NULL, OP_BAND }, { "^=", NULL, OP_BXOR },
+    { "|=", NULL, OP_BOR }, { NULL, NULL, 0 }
+};
+
+// assignment: name (= | op=) assignment | conditional
+static void parse_assign(arith_parser_t* ap) {
+    char name[VAR_NAME_LEN];
+    const char* start = ap->p;
+
+    if (read_name(ap, name, sizeof(name))) {
+        if (accept_op(ap, "=", "=")) {
+            parse_assign(ap);
+            emit(ap, OP_STORE, 0, name);
+            return;
+        }
+        for (const binop_t* b = assign_ops; b->op != NULL; b++) {
+            if (accept_op(ap, b->op, NULL)) {
+                emit(ap, OP_LOAD, 0, name);
+                parse_assign(ap);
+                emit(ap, b->code, 0, NULL);
+                emit(ap, OP_STORE, 0, name);
+                return;
+            }
+        }
+        ap->p = start; // Not an assignment: re-read as an operand
+    }
+
+    parse_ternary(ap);
+}
+
+// comma: assignment (, assignment)*
+static void parse_comma(arith_parser_t* ap) {
+    parse_assign(ap);
+    while (ap->error == NULL && accept_op(ap, ",", NULL)) {
+        emit(ap, OP_POP, 0, NULL);
+        parse_assign(ap);
+    }
+}
+
+// Free a compiled expression
+void free_arith(arith_expr_t* expr) {
+    if (expr == NULL) return;
+    for (int i = 0; i < expr->count; i++) {
+        free(expr->code[i].name);
+    }
+    free(expr->code);
+    free(expr->text);
+    free(expr);
+}
+
+// Compile an expression into bytecode. Returns NULL (after printing an
+// error) if the expression is malformed.
+arith_expr_t* compile_arith(const char* text) {
+    arith_expr_t* expr = calloc(1, sizeof(arith_expr_t));
+    if (expr == NULL) {
+        perror("calloc failed");
+        exit(1);
+    }
+    expr->text = strdup(text);
+
+    arith_parser_t ap = { text, expr, NULL };
+    skip_space(&ap);
+    if (*ap.p == '\0') {
+        emit(&ap, OP_PUSH, 0, NULL); // Empty expression is 0
+    } else {
+        parse_comma(&ap);
+        skip_space(&ap);
+        if (ap.error == NULL && *ap.p != '\0') {
+            ap.error = "syntax error in expression";
+        }
+    }
+
+    if (ap.error != NULL) {
+        fprintf(stderr, "arithmetic: %s (error token is \"%s\")\n", ap.error, ap.p);
+        free_arith(expr);
+        return NULL;
+    }
+    return expr;
+}
+
+// Read a variable as an integer; unset or non-numeric values are 0
+static long long load_variable(const char* name) {
+    char* value = get_variable(name);
+    if (value == NULL || *value == '\0') return 0;
+    return strtoll(value, NULL, 0);
+}
+
+// Store an integer in a variable
+static void store_variable(const char* name, long long value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", value);
+    set_variable(name, buf);
+}
+
+// Run compiled bytecode. Returns 0 and sets *result, or -1 on error.
+int eval_arith(arith_expr_t* expr, long long* result) {
+    long long small[32];
+    long long* stack = small;
+    if (expr->count > (int)(sizeof(small) / sizeof(small[0]))) {
+        stack = malloc(expr->count * sizeof(long long));
+        if (stack == NULL) return -1;
+    }
+    int sp = 0;
+    int status = 0;
+
+    for (int pc = 0; pc < expr->count; pc++) {
+        arith_insn_t* insn = &expr->code[pc];
+        long long a, b;
+
+        switch (insn->op) {
+            case OP_PUSH:  stack[sp++] = insn->value; break;
+            case OP_LOAD:  stack[sp++] = load_variable(insn->name); break;
+            case OP_STORE: store_variable(insn->name, stack[sp - 1]); break;
+            case OP_POP:   sp--; break;
+            case OP_NEG:   stack[sp - 1] = -(unsigned long long)stack[sp - 1]; break;
+            case OP_NOT:   stack[sp - 1] = !stack[sp - 1]; break;
+            case OP_BNOT:  stack[sp - 1] = ~stack[sp - 1]; break;
+            case OP_BOOL:  stack[sp - 1] = stack[sp - 1] != 0; break;
+            case OP_INC:
+                a = load_variable(insn->name);
+                b = (long long)((unsigned long long)a + insn->value);
+                store_variable(insn->name, b);
+                stack[sp++] = insn->post ? a : b;
+                break;
+            case OP_JZ:
+                if (stack[--sp] == 0) pc = insn->value - 1;
+                break;
+            case OP_JMP:
+                pc = insn->value - 1;
+                break;
+            case OP_AND_JUMP:
+                if (stack[sp - 1] == 0) pc = insn->value - 1;
+                else sp--;
+                break;
+            case OP_OR_JUMP:
+                if (stack[sp - 1] != 0) {
+                    stack[sp - 1] = 1;
+                    pc = insn->value - 1;
+                } else {
+                    sp--;
+                }
+                break;
+            default:
+                // Binary operators
+                b = stack[--sp];
+                a = stack[sp - 1];
+                switch (insn->op) {
+                    case OP_MUL: a = (long long)((unsigned long long)a * b); break;
+                    case OP_ADD: a = (long long)((unsigned long long)a + b); break;
+                    case OP_SUB: a = (long long)((unsigned long long)a - b); break;
+                    case OP_DIV:
+                    case OP_MOD:
+                        if (b == 0) {
+                            fprintf(stderr, "arithmetic: division by zero\n");
+                            status = -1;
+                            a = 0;
+                        } else if (b == -1) {
+                            a = insn->op == OP_DIV ? (long long)(-(unsigned long long)a) : 0;
+                        } else {
+                            a = insn->op == OP_DIV ? a / b : a % b;
+                        }
+                        break;
+                    case OP_POW: {
+                        long long r = 1;
+                        if (b < 0) {
+                            fprintf(stderr, "arithmetic: exponent less than 0\n");
+                            status = -1;
+                        }
+                        for (; b > 0; b--) r = (long long)((unsigned long long)r * a);
+                        a = r;
+                        break;
+                    }
+                    case OP_SHL:  a = (long long)((unsigned long long)a << (b & 63)); break;
+                    case OP_SHR:  a = a >> (b & 63); break;
+                    case OP_LT:   a = a < b; break;
+                    case OP_LE:   a = a <= b; break;
+                    case OP_GT:   a = a > b; break;
+                    case OP_GE:   a = a >= b; break;
+                    case OP_EQ:   a = a == b; break;
+                    case OP_NE:   a = a != b; break;
+                    case OP_BAND: a = a & b; break;
+                    case OP_BXOR: a = a ^ b; break;
+                    case OP_BOR:  a = a | b; break;
+                    default: break;
+                }
+                stack[sp - 1] = a;
+                if (status != 0) pc = expr->count;
+                break;
+        }
+    }
+
+    *result = sp > 0 ? stack[sp - 1] : 0;
+    if (stack != small) free(stack);
+    return status;
+}
+
+// Find or compile an expression in the cache, keyed by its text
+static arith_expr_t* cached_arith(const char* text) {
+    unsigned int bucket = hash_string(text) % ARITH_CACHE_SIZE;
+    for (arith_expr_t* expr = arith_cache[bucket]; expr != NULL; expr = expr->next) {
+        if (strcmp(expr->text, text) == 0) {
+            return expr;
+        }
+    }
+
+    arith_expr_t* expr = compile_arith(text);
+    if (expr == NULL) {
+        return NULL;
+    }
+
+    // Flush everything when full; loops reuse a small working set
+    if (arith_cache_count >= ARITH_CACHE_MAX) {
+        for (int i = 0; i < ARITH_CACHE_SIZE; i++) {
+            while (arith_cache[i] != NULL) {
+                arith_expr_t* next = arith_cache[i]->next;
+                free_arith(arith_cache[i]);
+                arith_cache[i] = next;
+            }
+        }
+        arith_cache_count = 0;
+    }
+
+    expr->next = arith_cache[bucket];
+    arith_cache[bucket] = expr;
+    arith_cache_count++;
+    return expr;
+}
+
+// Evaluate expression text. $ references are expanded first; the compiled
+// bytecode is cached so an expression inside a loop is parsed only once.
+int arith_evaluate(const char* text, long long* result) {
+    char* expanded = NULL;
+    if (strchr(text, '$') != NULL) {
+        expanded = expand_variables(text);
+        text = expanded;
+    }
+
+    arith_expr_t* expr = cached_arith(text);
+    int status = expr != NULL ? eval_arith(expr, result) : -1;
+
+    free(expanded);
+    return status;
+}
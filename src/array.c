@@ -0,0 +1,271 @@
+#include "shell.h"
+#include <limits.h>
+
+// Shell arrays. Indexed arrays are sparse: only the elements set are
+// stored, as (index, value) pairs sorted by index, so a lookup is a binary
+// search and ${a[@]} costs the number of elements, not the highest index.
+// Associative arrays keep their entries in insertion order and find them
+// through an open-addressing table of entry numbers, so lookups are O(1)
+// and ${!a[@]} is stable.
+
+typedef struct {
+    long long index;
+    char* value;
+} indexed_item_t;
+
+typedef struct {
+    char* key;               // NULL once the entry is deleted
+    char* value;
+    unsigned int hash;
+} assoc_entry_t;
+
+struct array {
+    int assoc;
+
+    // Indexed
+    indexed_item_t* items;   // Sorted by index
+    long long num_items;
+    long long cap;
+
+    // Associative
+    assoc_entry_t* entries;
+    int num_entries;         // Entries used, including deleted ones
+    int entries_cap;
+    int* slots;              // Entry number + 1; 0 marks an empty slot
+    int num_slots;           // Power of two
+
+    long long count;         // Elements set
+};
+
+// Create an empty array
+array_t* array_new(int assoc) {
+    array_t* a = calloc(1, sizeof(array_t));
+    if (a == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    a->assoc = assoc;
+    return a;
+}
+
+// Free an array and its elements
+void array_free(array_t* a) {
+    if (a == NULL) return;
+    for (long long i = 0; i < a->num_items; i++) {
+        free(a->items[i].value);
+    }
+    for (int i = 0; i < a->num_entries; i++) {
+        free(a->entries[i].key);
+        free(a->entries[i].value);
+    }
+    free(a->items);
+    free(a->entries);
+    free(a->slots);
+    free(a);
+}
+
+// Deep copy of an array
+array_t* array_copy(const array_t* a) {
+    array_t* copy = array_new(a->assoc);
+    long long pos = 0, index;
+    const char *key, *value;
+    while (array_next(a, &pos, &index, &key, &value)) {
+        if (a->assoc) {
+            array_set_key(copy, key, value);
+        } else {
+            array_set_index(copy, index, value);
+        }
+    }
+    return copy;
+}
+
+// Check if an array is associative
+int array_is_assoc(const array_t* a) {
+    return a->assoc;
+}
+
+// Number of elements set
+long long array_count(const array_t* a) {
+    return a->count;
+}
+
+// One past the highest index set (indexed arrays); where += appends
+long long array_end(const array_t* a) {
+    return a->num_items > 0 ? a->items[a->num_items - 1].index + 1 : 0;
+}
+
+// Position of the first item with an index of at least index
+static long long find_item(const array_t* a, long long index) {
+    long long low = 0, high = a->num_items;
+    if (high > 0 && a->items[high - 1].index < index) {
+        return high; // Past the end: the common append case
+    }
+    while (low < high) {
+        long long mid = low + (high - low) / 2;
+        if (a->items[mid].index < index) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Element at index, or NULL; negative indexes count back from the end
+const char* array_get_index(const array_t* a, long long index) {
+    if (index < 0) index += array_end(a);
+    if (index < 0) return NULL;
+    long long pos = find_item(a, index);
+    return pos < a->num_items && a->items[pos].index == index ? a->items[pos].value : NULL;
+}
+
+// Set the element at index (negative counts back from the end).
+// Returns -1 if a negative index is out of range, or the index is the
+// largest one representable (one past it could not be appended to).
+int array_set_index(array_t* a, long long index, const char* value) {
+    if (index < 0) index += array_end(a);
+    if (index < 0 || index == LLONG_MAX) return -1;
+
+    long long pos = find_item(a, index);
+    if (pos < a->num_items && a->items[pos].index == index) {
+        free(a->items[pos].value);
+        a->items[pos].value = strdup(value);
+        return 0;
+    }
+
+    if (a->num_items == a->cap) {
+        a->cap = a->cap ? a->cap * 2 : 16;
+        a->items = realloc(a->items, a->cap * sizeof(indexed_item_t));
+        if (a->items == NULL) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    memmove(&a->items[pos + 1], &a->items[pos], (a->num_items - pos) * sizeof(indexed_item_t));
+    a->items[pos].index = index;
+    a->items[pos].value = strdup(value);
+    a->num_items++;
+    a->count++;
+    return 0;
+}
+
+// Remove the element at index
+void array_unset_index(array_t* a, long long index) {
+    if (index < 0) index += array_end(a);
+    if (index < 0) return;
+    long long pos = find_item(a, index);
+    if (pos >= a->num_items || a->items[pos].index != index) return;
+    free(a->items[pos].value);
+    memmove(&a->items[pos], &a->items[pos + 1], (a->num_items - pos - 1) * sizeof(indexed_item_t));
+    a->num_items--;
+    a->count--;
+}
+
+// Find the slot of key, or the empty slot where it would go
+static int find_slot(const array_t* a, const char* key, unsigned int hash) {
+    int mask = a->num_slots - 1;
+    for (int i = hash & mask; ; i = (i + 1) & mask) {
+        int e = a->slots[i] - 1;
+        if (e < 0) return i;
+        const assoc_entry_t* entry = &a->entries[e];
+        if (entry->hash == hash && entry->key != NULL && strcmp(entry->key, key) == 0) {
+            return i;
+        }
+    }
+}
+
+// Rebuild the slot table with room to grow, dropping deleted entries
+static void rehash(array_t* a) {
+    int n = 0;
+    for (int i = 0; i < a->num_entries; i++) {
+        if (a->entries[i].key != NULL) {
+            a->entries[n++] = a->entries[i];
+        }
+    }
+    a->num_entries = n;
+
+    int slots = 16;
+    while (slots < (n + 1) * 2) slots *= 2;
+    free(a->slots);
+    a->slots = calloc(slots, sizeof(int));
+    if (a->slots == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    a->num_slots = slots;
+    for (int i = 0; i < n; i++) {
+        a->slots[find_slot(a, a->entries[i].key, a->entries[i].hash)] = i + 1;
+    }
+}
+
+// Value for key, or NULL
+const char* array_get_key(const array_t* a, const char* key) {
+    if (a->num_slots == 0) return NULL;
+    int e = a->slots[find_slot(a, key, hash_string(key))] - 1;
+    return e >= 0 ? a->entries[e].value : NULL;
+}
+
+// Set the value for key
+void array_set_key(array_t* a, const char* key, const char* value) {
+    unsigned int hash = hash_string(key);
+    if (a->num_slots > 0) {
+        int e = a->slots[find_slot(a, key, hash)] - 1;
+        if (e >= 0) {
+            free(a->entries[e].value);
+            a->entries[e].value = strdup(value);
+            return;
+        }
+    }
+
+    // Keep the table at most half full, counting deleted entries
+    if ((a->num_entries + 1) * 2 > a->num_slots) {
+        rehash(a);
+    }
+    if (a->num_entries == a->entries_cap) {
+        a->entries_cap = a->entries_cap ? a->entries_cap * 2 : 16;
+        a->entries = realloc(a->entries, a->entries_cap * sizeof(assoc_entry_t));
+        if (a->entries == NULL) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    assoc_entry_t* entry = &a->entries[a->num_entries];
+    entry->key = strdup(key);
+    entry->value = strdup(value);
+    entry->hash = hash;
+    a->slots[find_slot(a, key, hash)] = ++a->num_entries;
+    a->count++;
+}
+
+// Remove key; its slot keeps pointing at the dead entry until a rehash
+void array_unset_key(array_t* a, const char* key) {
+    if (a->num_slots == 0) return;
+    int e = a->slots[find_slot(a, key, hash_string(key))] - 1;
+    if (e < 0) return;
+    free(a->entries[e].key);
+    free(a->entries[e].value);
+    a->entries[e].key = NULL;
+    a->entries[e].value = NULL;
+    a->count--;
+}
+
+// Step through the elements in order: *pos starts at 0. Sets *index
+// (indexed arrays) or *key (associative ones) and *value; returns 0 at
+// the end.
+int array_next(const array_t* a, long long* pos, long long* index, const char** key,
+               const char** value) {
+    if (a->assoc) {
+        while (*pos < a->num_entries && a->entries[*pos].key == NULL) (*pos)++;
+        if (*pos >= a->num_entries) return 0;
+        *key = a->entries[*pos].key;
+        *value = a->entries[*pos].value;
+        *index = *pos;
+    } else {
+        if (*pos >= a->num_items) return 0;
+        *index = a->items[*pos].index;
+        *key = NULL;
+        *value = a->items[*pos].value;
+    }
+    (*pos)++;
+    return 1;
+}
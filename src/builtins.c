@@ -2,8 +2,42 @@
 
 // Built-in command: exit
 int builtin_exit(char** arglist) {
-    printf("Shell terminated.\n");
-    exit(0);
+    int status = arglist[1] != NULL ? atoi(arglist[1]) : last_status;
+    if (substitution_exit != NULL) {
+        longjmp(*substitution_exit, (status & 0xff) + 1); // Leave $(...) only
+    }
+    if (interactive) {
+        printf("Shell terminated.\n");
+    }
+    exit(status);
+}
+
+// Built-in command: exec command [args...]
+// Replaces the shell with command (exec with only redirections is handled
+// by execute_command()). In an in-process $(...) the command runs in a
+// child instead and ends the substitution; in a server session it runs in
+// a child and the session exits with its status, which the exit handler
+// reports to the client.
+int builtin_exec(char** arglist) {
+    if (arglist[1] == NULL) {
+        return 0;
+    }
+    if (substitution_exit != NULL) {
+        int status = execute(arglist + 1, NULL);
+        longjmp(*substitution_exit, (status & 0xff) + 1);
+    }
+    if (server_session) {
+        exit(execute(arglist + 1, NULL));
+    }
+    fflush(stdout);
+    stats_count(STAT_EXECS);
+    execvp(arglist[1], arglist + 1);
+    int status = errno == ENOENT ? 127 : 126;
+    fprintf(stderr, "exec: %s: %s\n", arglist[1], strerror(errno));
+    if (!interactive) {
+        exit(status);
+    }
+    return status;
 }
 
 // Built-in command: cd
@@ -36,15 +70,47 @@ int builtin_cd(char** arglist) {
     return 0;
 }
 
+// Built-in command: pwd
+int builtin_pwd(char** arglist) {
+    (void)arglist;
+    char cwd[1024];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("pwd");
+        return 1;
+    }
+    fprintf(stage_stream(), "%s\n", cwd);
+    return 0;
+}
+
 // Built-in command: help
 int builtin_help(char** arglist) {
     printf("Built-in commands:\n");
     printf("  cd <directory>    - Change current working directory\n");
+    printf("  pwd               - Print the current working directory\n");
     printf("  exit              - Terminate the shell\n");
+    printf("  exec [cmd args]   - Replace the shell with cmd\n");
     printf("  help              - Display this help message\n");
     printf("  history           - Display command history\n");
     printf("  jobs              - Display background jobs\n");
-    printf("  set               - Display all variables\n");
+    printf("  set [-o|+o opt]   - Display variables or set shell options\n");
+    printf("  echo [-n] [args]  - Print arguments\n");
+    printf("  true / false / :  - Return success / failure / success\n");
+    printf("  break [n]         - Exit from n enclosing loops\n");
+    printf("  continue [n]      - Resume the next iteration of a loop\n");
+    printf("  local name[=val]  - Declare a function-local variable\n");
+    printf("  declare [-aAp] name[=val] - Declare variables and arrays (also typeset)\n");
+    printf("  unset name[[sub]] - Remove a variable or an array element\n");
+    printf("  return [n]        - Return from a shell function\n");
+    printf("  let expr...       - Evaluate arithmetic expressions\n");
+    printf("  batch [-j n] [-k n] cmd [opts --] args - Run cmd in batches that fit in ARG_MAX\n");
+    printf("  parallel [-j n] [-k] cmd ::: args - Run cmd per arg on n workers\n");
+    printf("  cached [-e var] [-i file] cmd - Replay cmd's output from a cache (--stats)\n");
+    printf("  cat [-V] [file..] - Copy files to stdout without a user-space copy\n");
+    printf("  cp [-V] src dest  - Copy a file with copy_file_range\n");
+    printf("  tee [-a] [-V] f.. - Copy stdin to stdout and files with tee/splice\n");
+    printf("  read [-r] [-d c] names - Read a line from stdin into variables\n");
+    printf("  mapfile [-t] [arr] - Read all of stdin into an array (also readarray)\n");
+    printf("  stats [on|off|reset] - Per-phase latency percentiles and counters\n");
     return 0;
 }
 
@@ -60,36 +126,354 @@ int builtin_history(char** arglist) {
     return 0;
 }
 
-// NEW: Built-in command: set (display variables)
+// Shell options changed with set -o / set +o
+static const struct {
+    const char* name;
+    int* flag;
+} shell_options[] = {
+    { "pipestats", &pipe_stats },
+    { NULL, NULL }
+};
+
+// Built-in command: set [-o|+o option] (no arguments: display variables)
 int builtin_set(char** arglist) {
-    print_variables();
+    if (arglist[1] == NULL) {
+        print_variables();
+        return 0;
+    }
+    if (strcmp(arglist[1], "-o") != 0 && strcmp(arglist[1], "+o") != 0) {
+        fprintf(stderr, "set: %s: invalid option\n", arglist[1]);
+        return 2;
+    }
+
+    if (arglist[2] == NULL) {
+        for (int i = 0; shell_options[i].name != NULL; i++) {
+            printf("%-15s %s\n", shell_options[i].name, *shell_options[i].flag ? "on" : "off");
+        }
+        return 0;
+    }
+    for (int i = 0; shell_options[i].name != NULL; i++) {
+        if (strcmp(arglist[2], shell_options[i].name) == 0) {
+            *shell_options[i].flag = arglist[1][0] == '-';
+            return 0;
+        }
+    }
+    fprintf(stderr, "set: %s: invalid option name\n", arglist[2]);
+    return 2;
+}
+
+// Built-in command: echo
+int builtin_echo(char** arglist) {
+    int i = 1;
+    int newline = 1;
+    if (arglist[1] != NULL && strcmp(arglist[1], "-n") == 0) {
+        newline = 0;
+        i++;
+    }
+    FILE* out = stage_stream();
+    for (int first = i; arglist[i] != NULL; i++) {
+        if (i > first) fputc(' ', out);
+        fputs(arglist[i], out);
+    }
+    if (newline) {
+        fputc('\n', out);
+    }
+    return 0;
+}
+
+// Built-in commands: true and ':'
+int builtin_true(char** arglist) {
+    return 0;
+}
+
+// Built-in command: false
+int builtin_false(char** arglist) {
+    return 1;
+}
+
+// Parse the loop count argument of break / continue
+static int loop_levels(char** arglist) {
+    if (loop_depth == 0) {
+        fprintf(stderr, "%s: only meaningful in a loop\n", arglist[0]);
+        return 0;
+    }
+    int n = arglist[1] != NULL ? atoi(arglist[1]) : 1;
+    if (n < 1) {
+        fprintf(stderr, "%s: %s: loop count out of range\n", arglist[0], arglist[1]);
+        return 0;
+    }
+    return n > loop_depth ? loop_depth : n;
+}
+
+// Built-in command: break
+int builtin_break(char** arglist) {
+    break_levels = loop_levels(arglist);
+    return break_levels > 0 ? 0 : 1;
+}
+
+// Built-in command: continue
+int builtin_continue(char** arglist) {
+    continue_levels = loop_levels(arglist);
+    return continue_levels > 0 ? 0 : 1;
+}
+
+// Declare each NAME[=value] argument of declare, typeset or local; -a and
+// -A make NAME an indexed or associative array, -p prints the declarations.
+// With local set the names get saved and restored by the function.
+static int declare_variables(char** arglist, int local) {
+    int assoc = -1;
+    int print = 0;
+    int i = 1;
+    for (; arglist[i] != NULL && arglist[i][0] == '-' && arglist[i][1] != '\0'; i++) {
+        for (const char* opt = arglist[i] + 1; *opt != '\0'; opt++) {
+            if (*opt == 'a' || *opt == 'A') {
+                assoc = *opt == 'A';
+            } else if (*opt == 'p') {
+                print = 1;
+            } else if (*opt == 'g') {
+                local = 0;
+            } else {
+                fprintf(stderr, "%s: -%c: invalid option\n", arglist[0], *opt);
+                return 2;
+            }
+        }
+    }
+    if (print || (arglist[i] == NULL && strcmp(arglist[0], "local") != 0)) {
+        return print_declarations(arglist[i] != NULL ? &arglist[i] : NULL, 1);
+    }
+
+    int status = 0;
+    for (; arglist[i] != NULL; i++) {
+        char name[VAR_NAME_LEN];
+        size_t len = strcspn(arglist[i], "=[+");
+        snprintf(name, sizeof(name), "%.*s", (int)len, arglist[i]);
+        if (!is_valid_name(name)) {
+            fprintf(stderr, "%s: '%s': not a valid identifier\n", arglist[0], arglist[i]);
+            status = 1;
+            continue;
+        }
+
+        if (local) {
+            make_local(name);
+        }
+        if (assoc >= 0 && make_array(name, assoc) == NULL) {
+            fprintf(stderr, "%s: %s: cannot convert %s array\n", arglist[0], name,
+                    assoc ? "indexed to associative" : "associative to indexed");
+            status = 1;
+            continue;
+        }
+        if (arglist[i][len] != '\0' && assign_word(arglist[i], 0) != 0) {
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// Built-in command: local [-a|-A] NAME[=value]...
+int builtin_local(char** arglist) {
+    if (function_depth == 0) {
+        fprintf(stderr, "local: can only be used in a function\n");
+        return 1;
+    }
+    return declare_variables(arglist, 1);
+}
+
+// Built-in commands: declare and typeset [-a|-A|-g|-p] [NAME[=value]...]
+// Inside a function they declare local variables unless -g is given.
+int builtin_declare(char** arglist) {
+    return declare_variables(arglist, function_depth > 0);
+}
+
+// Built-in command: unset [-v] NAME|NAME[subscript]...
+int builtin_unset(char** arglist) {
+    int i = 1;
+    if (arglist[i] != NULL && strcmp(arglist[i], "-v") == 0) i++;
+
+    int status = 0;
+    for (; arglist[i] != NULL; i++) {
+        char* bracket = strchr(arglist[i], '[');
+        if (bracket == NULL) {
+            if (is_valid_name(arglist[i])) {
+                unset_variable(arglist[i]);
+            } else {
+                fprintf(stderr, "unset: '%s': not a valid identifier\n", arglist[i]);
+                status = 1;
+            }
+            continue;
+        }
+
+        // NAME[subscript]: remove one element
+        size_t len = strlen(bracket);
+        *bracket = '\0';
+        array_t* a = get_array(arglist[i]);
+        char* sub = strndup(bracket + 1, len > 1 && bracket[len - 1] == ']' ? len - 2 : len - 1);
+        long long index;
+        if (a != NULL && array_is_assoc(a)) {
+            array_unset_key(a, sub);
+        } else if (a != NULL && arith_evaluate(sub, &index) == 0) {
+            array_unset_index(a, index);
+        } else if (a == NULL && get_variable(arglist[i])[0] != '\0' &&
+                   arith_evaluate(sub, &index) == 0 && index == 0) {
+            unset_variable(arglist[i]); // A scalar is element 0
+        }
+        free(sub);
+        *bracket = '[';
+    }
+    return status;
+}
+
+// Built-in command: return [n]
+int builtin_return(char** arglist) {
+    if (function_depth == 0) {
+        fprintf(stderr, "return: can only be used in a function\n");
+        return 1;
+    }
+    return_pending = 1;
+    return arglist[1] != NULL ? atoi(arglist[1]) : last_status;
+}
+
+// Built-in command: let EXPR...
+// Status is 0 if the last expression is non-zero
+int builtin_let(char** arglist) {
+    if (arglist[1] == NULL) {
+        fprintf(stderr, "let: expression expected\n");
+        return 1;
+    }
+
+    long long value = 0;
+    for (int i = 1; arglist[i] != NULL; i++) {
+        if (arith_evaluate(arglist[i], &value) != 0) {
+            return 1;
+        }
+    }
+    return value == 0;
+}
+
+// Built-in command: batch [-j N] [-k N] command args...
+// Runs command with args split to fit in ARG_MAX; -j runs N at once. The
+// first N args, or those through a "--", are repeated in every batch.
+// Whether an option takes an argument is unknown here, so leading options
+// followed by other words without -k or "--" are refused.
+int builtin_batch(char** arglist) {
+    int jobs = 1;
+    int fixed = -1;
+    int i = 1;
+
+    while (arglist[i] != NULL && arglist[i][0] == '-' && arglist[i + 1] != NULL) {
+        if (strcmp(arglist[i], "-j") == 0) {
+            jobs = atoi(arglist[i + 1]);
+            if (jobs <= 0) {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                jobs = cpus > 0 ? (int)cpus : 1;
+            }
+        } else if (strcmp(arglist[i], "-k") == 0) {
+            fixed = atoi(arglist[i + 1]);
+        } else {
+            break;
+        }
+        i += 2;
+    }
+
+    if (arglist[i] == NULL) {
+        fprintf(stderr, "batch: usage: batch [-j jobs] [-k fixed] command [args...]\n");
+        return 2;
+    }
+
+    char** argv = &arglist[i];
+    if (fixed < 0) {
+        int j = 1;
+        while (argv[j] != NULL && strcmp(argv[j], "--") != 0) j++;
+        if (argv[j] != NULL) {
+            fixed = j; // Everything through "--"
+        } else {
+            fixed = 0;
+            j = 1;
+            while (argv[j] != NULL && argv[j][0] == '-') j++;
+            if (j > 1 && argv[j] != NULL) {
+                fprintf(stderr, "batch: %s: cannot tell where the options end; "
+                        "use -k N or end them with --\n", argv[0]);
+                return 2;
+            }
+        }
+    }
+    return execute_batched(argv, fixed, jobs, command_assigns);
+}
+
+// Table of built-in commands
+typedef struct {
+    const char* name;
+    builtin_func_t func;
+    int stream;  // Only reads stage_in and writes stage_out, touching no
+                 // shell state, so a pipeline may run it on a thread
+} builtin_t;
+
+static const builtin_t builtins[] = {
+    { "exit", builtin_exit, 0 },
+    { "exec", builtin_exec, 0 },
+    { "cd", builtin_cd, 0 },
+    { "pwd", builtin_pwd, 1 },
+    { "help", builtin_help, 0 },
+    { "jobs", builtin_jobs, 0 },
+    { "history", builtin_history, 0 },
+    { "set", builtin_set, 0 },
+    { "echo", builtin_echo, 1 },
+    { "true", builtin_true, 1 },
+    { ":", builtin_true, 1 },
+    { "false", builtin_false, 1 },
+    { "break", builtin_break, 0 },
+    { "continue", builtin_continue, 0 },
+    { "local", builtin_local, 0 },
+    { "declare", builtin_declare, 0 },
+    { "typeset", builtin_declare, 0 },
+    { "unset", builtin_unset, 0 },
+    { "return", builtin_return, 0 },
+    { "let", builtin_let, 0 },
+    { "batch", builtin_batch, 0 },
+    { "parallel", builtin_parallel, 0 },
+    { "cached", builtin_cached, 0 },
+    { "cat", builtin_cat, 1 },
+    { "cp", builtin_cp, 0 },
+    { "tee", builtin_tee, 1 },
+    { "read", builtin_read, 0 },
+    { "mapfile", builtin_mapfile, 0 },
+    { "readarray", builtin_mapfile, 0 },
+    { "stats", builtin_stats, 0 },
+    { NULL, NULL, 0 }
+};
+
+// Check if a name is a built-in command
+int is_builtin(const char* name) {
+    for (int i = 0; builtins[i].name != NULL; i++) {
+        if (strcmp(name, builtins[i].name) == 0) {
+            return 1;
+        }
+    }
     return 0;
 }
 
+// The stream builtin called name, or NULL if there is none
+builtin_func_t stream_builtin(const char* name) {
+    for (int i = 0; builtins[i].name != NULL; i++) {
+        if (builtins[i].stream && strcmp(name, builtins[i].name) == 0) {
+            return builtins[i].func;
+        }
+    }
+    return NULL;
+}
+
 // Main built-in command handler
+// Returns 1 if the command was a built-in; its exit status goes to last_status
 int handle_builtin(char** arglist) {
     if (arglist[0] == NULL) {
         return 0; // No command
     }
 
-    if (strcmp(arglist[0], "exit") == 0) {
-        builtin_exit(arglist);
-        return 1;
-    } else if (strcmp(arglist[0], "cd") == 0) {
-        builtin_cd(arglist);
-        return 1;
-    } else if (strcmp(arglist[0], "help") == 0) {
-        builtin_help(arglist);
-        return 1;
-    } else if (strcmp(arglist[0], "jobs") == 0) {
-        builtin_jobs(arglist);
-        return 1;
-    } else if (strcmp(arglist[0], "history") == 0) {
-        builtin_history(arglist);
-        return 1;
-    } else if (strcmp(arglist[0], "set") == 0) {  // NEW: set command
-        builtin_set(arglist);
-        return 1;
+    for (int i = 0; builtins[i].name != NULL; i++) {
+        if (strcmp(arglist[0], builtins[i].name) == 0) {
+            stats_count(STAT_BUILTINS);
+            last_status = builtins[i].func(arglist);
+            return 1;
+        }
     }
 
     return 0; // Not a built-in command
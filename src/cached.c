@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <dirent.h>
+#include <stdint.h>
+
+#define CACHED_BUFFER 65536
+#define CACHED_DEFAULT_SIZE (64L << 20)  // Cache size without CACHED_SIZE
+#define CACHED_MAX_OPTIONS 32            // -e and -i options each
+#define CACHED_HEADER_LEN 21             // "MSC1 ssss kkkkkkkkkk\n"
+
+// Counters for cached --stats, for this shell
+static struct {
+    long hits;
+    long misses;
+    long uncacheable;
+    long evictions;
+    long long bytes_replayed;
+} cached_stats;
+
+// One cache file, for eviction
+typedef struct {
+    char name[32];
+    off_t size;
+    struct timespec used;
+} cache_entry_t;
+
+// Directory myshell/name under $XDG_CACHE_HOME or ~/.cache, or dir if it
+// is set. Created if needed; NULL if that fails.
+const char* cache_directory(const char* name, const char* dir) {
+    static char path[PATH_MAX];
+    const char* base;
+    if (dir != NULL && *dir != '\0') {
+        snprintf(path, sizeof(path), "%s", dir);
+    } else if ((base = getenv("XDG_CACHE_HOME")) != NULL && *base != '\0') {
+        snprintf(path, sizeof(path), "%s/myshell/%s", base, name);
+    } else if ((base = getenv("HOME")) != NULL) {
+        snprintf(path, sizeof(path), "%s/.cache/myshell/%s", base, name);
+    } else {
+        return NULL;
+    }
+
+    // mkdir -p
+    for (char* p = path + 1; ; p++) {
+        if (*p == '/' || *p == '\0') {
+            char c = *p;
+            *p = '\0';
+            int failed = mkdir(path, 0700) != 0 && errno != EEXIST;
+            *p = c;
+            if (failed) return NULL;
+            if (c == '\0') break;
+        }
+    }
+    return path;
+}
+
+// Directory of the command cache: the MYSHELL_CACHE variable, else
+// myshell/cached under the user's cache directory
+static const char* cache_dir() {
+    return cache_directory("cached", get_variable("MYSHELL_CACHE"));
+}
+
+// Total size allowed for the cache (CACHED_SIZE, e.g. 64m)
+static long cache_limit() {
+    const char* text = get_variable("CACHED_SIZE");
+    long size = text != NULL && *text != '\0' ? parse_size(text) : -1;
+    return size > 0 ? size : CACHED_DEFAULT_SIZE;
+}
+
+// Value of a variable in the environment the command will get: its prefix
+// assignments, then the shell's environment
+static const char* command_env(const char* name) {
+    size_t len = strlen(name);
+    const char* value = NULL;
+    for (int i = 0; command_assigns != NULL && command_assigns[i] != NULL; i++) {
+        if (strncmp(command_assigns[i], name, len) == 0 && command_assigns[i][len] == '=') {
+            value = command_assigns[i] + len + 1;
+        }
+    }
+    return value != NULL ? value : getenv(name);
+}
+
+// Everything the output may depend on: directory, argv, the selected
+// environment variables and the size and mtime of the input files.
+// Fields are separated by NUL bytes.
+static void build_key(strbuf_t* key, char** argv, char** vars, int num_vars,
+                      char** inputs, int num_inputs) {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        sb_append(key, cwd);
+    }
+    sb_putc(key, '\0');
+    for (int i = 0; argv[i] != NULL; i++) {
+        sb_append(key, argv[i]);
+        sb_putc(key, '\0');
+    }
+    for (int i = 0; i < num_vars; i++) {
+        const char* value = command_env(vars[i]);
+        sb_append(key, vars[i]);
+        sb_append(key, value != NULL ? "=" : " unset");
+        if (value != NULL) sb_append(key, value);
+        sb_putc(key, '\0');
+    }
+    for (int i = 0; i < num_inputs; i++) {
+        struct stat st;
+        char info[96];
+        if (stat(inputs[i], &st) == 0) {
+            snprintf(info, sizeof(info), " %lld %lld.%09ld", (long long)st.st_size,
+                     (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+        } else {
+            snprintf(info, sizeof(info), " missing");
+        }
+        sb_append(key, inputs[i]);
+        sb_append(key, info);
+        sb_putc(key, '\0');
+    }
+}
+
+// Write all of buf to fd
+static int write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Replay a cache file if it holds this key. Returns the stored exit
+// status, or -1 on a miss.
+static int replay_entry(const char* path, const strbuf_t* key) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // The name is only a hash: check the stored key too
+    char header[CACHED_HEADER_LEN + 1];
+    int status = -1;
+    size_t key_len;
+    if (read(fd, header, CACHED_HEADER_LEN) == CACHED_HEADER_LEN) {
+        header[CACHED_HEADER_LEN] = '\0';
+        if (sscanf(header, "MSC1 %d %zu", &status, &key_len) != 2 || key_len != key->len) {
+            status = -1;
+        }
+    }
+    if (status >= 0) {
+        char* stored = malloc(key_len + 1);
+        if (stored == NULL) {
+            perror("malloc failed");
+            exit(1);
+        }
+        if (read(fd, stored, key_len) != (ssize_t)key_len ||
+            memcmp(stored, key->data, key_len) != 0) {
+            status = -1;
+        }
+        free(stored);
+    }
+
+    if (status >= 0) {
+        struct stat st;
+        fflush(stdout);
+        if (fstat(fd, &st) == 0) {
+            cached_stats.bytes_replayed += st.st_size - CACHED_HEADER_LEN - key_len;
+        }
+        copy_stream(fd, STDOUT_FILENO);
+        futimens(fd, NULL); // The mtime records the last use for LRU
+    }
+    close(fd);
+    return status;
+}
+
+// Oldest use first
+static int compare_entries(const void* a, const void* b) {
+    const cache_entry_t* x = a;
+    const cache_entry_t* y = b;
+    if (x->used.tv_sec != y->used.tv_sec) return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    if (x->used.tv_nsec != y->used.tv_nsec) return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+// Check for a cache file name: 16 hex digits
+static int is_entry_name(const char* name) {
+    return strlen(name) == 16 && strspn(name, "0123456789abcdef") == 16;
+}
+
+// List the cache files; returns the count and their total size in *total
+static int list_entries(const char* dir, cache_entry_t** entries, off_t* total) {
+    int count = 0, cap = 0;
+    *entries = NULL;
+    *total = 0;
+
+    DIR* d = opendir(dir);
+    if (d == NULL) {
+        return 0;
+    }
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        struct stat st;
+        if (!is_entry_name(ent->d_name) || fstatat(dirfd(d), ent->d_name, &st, 0) != 0) {
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            *entries = realloc(*entries, cap * sizeof(cache_entry_t));
+            if (*entries == NULL) {
+                perror("realloc failed");
+                exit(1);
+            }
+        }
+        cache_entry_t* e = &(*entries)[count++];
+        memcpy(e->name, ent->d_name, 17); // 16 hex digits and the NUL
+        e->size = st.st_size;
+        e->used = st.st_mtim;
+        *total += st.st_size;
+    }
+    closedir(d);
+    return count;
+}
+
+// Remove the least recently used files until the cache fits in limit
+static void evict_entries(const char* dir, long limit) {
+    cache_entry_t* entries;
+    off_t total;
+    int count = list_entries(dir, &entries, &total);
+    if (total > limit) {
+        qsort(entries, count, sizeof(cache_entry_t), compare_entries);
+        char path[PATH_MAX];
+        for (int i = 0; i < count && total > limit; i++) {
+            snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+            if (unlink(path) == 0) {
+                total -= entries[i].size;
+                cached_stats.evictions++;
+            }
+        }
+    }
+    free(entries);
+}
+
+// Run argv with its stdout streamed to ours and, while it stays under
+// entry_limit bytes, into a temporary cache file that becomes path if the
+// command exits normally. Returns the exit status.
+static int run_and_store(char** argv, const char* dir, const char* path,
+                         const strbuf_t* key, long entry_limit) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s/tmp.XXXXXX", dir);
+    int store = mkostemp(tmp, O_CLOEXEC);
+    if (store >= 0) {
+        // Placeholder header, filled in once the status is known
+        char header[64];
+        snprintf(header, sizeof(header), "MSC1 %4d %10zu\n", 0, key->len);
+        if (write_all(store, header, CACHED_HEADER_LEN) != 0 ||
+            write_all(store, key->data, key->len) != 0) {
+            close(store);
+            unlink(tmp);
+            store = -1;
+        }
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        perror("pipe failed");
+        if (store >= 0) {
+            close(store);
+            unlink(tmp);
+        }
+        return 1;
+    }
+    fflush(stdout);
+    pid_t pid = stats_fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        exec_in_child(argv, command_assigns);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        perror("fork failed");
+        close(fds[0]);
+        if (store >= 0) {
+            close(store);
+            unlink(tmp);
+        }
+        return 1;
+    }
+
+    char* buf = malloc(CACHED_BUFFER);
+    if (buf == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    long stored = 0;
+    for (;;) {
+        ssize_t n = read(fds[0], buf, CACHED_BUFFER);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        write_all(STDOUT_FILENO, buf, n);
+        stored += n;
+        if (store >= 0 && (stored > entry_limit || write_all(store, buf, n) != 0)) {
+            close(store); // Too big to keep
+            unlink(tmp);
+            store = -1;
+        }
+    }
+    free(buf);
+    close(fds[0]);
+
+    int wstatus;
+    while (stats_waitpid(pid, &wstatus, 0) < 0 && errno == EINTR) {
+    }
+    int status = decode_status(wstatus);
+
+    // Failures to run the command and deaths by signal are not results
+    int kept = 0;
+    if (store >= 0 && status < 126) {
+        char header[64];
+        snprintf(header, sizeof(header), "MSC1 %4d %10zu\n", status, key->len);
+        kept = pwrite(store, header, CACHED_HEADER_LEN, 0) == CACHED_HEADER_LEN &&
+               rename(tmp, path) == 0;
+    }
+    if (store >= 0) {
+        close(store);
+        if (!kept) unlink(tmp);
+    }
+    if (!kept) {
+        cached_stats.uncacheable++;
+    }
+    return status;
+}
+
+// Print the cache location, size and counters
+static int print_cache_stats() {
+    const char* dir = cache_dir();
+    if (dir == NULL) {
+        fprintf(stderr, "cached: no cache directory\n");
+        return 1;
+    }
+    cache_entry_t* entries;
+    off_t total;
+    int count = list_entries(dir, &entries, &total);
+    free(entries);
+
+    long lookups = cached_stats.hits + cached_stats.misses;
+    printf("directory:   %s\n", dir);
+    printf("entries:     %d\n", count);
+    printf("size:        %lld of %ld bytes\n", (long long)total, cache_limit());
+    printf("hits:        %ld (%.1f%%)\n", cached_stats.hits,
+           lookups > 0 ? 100.0 * cached_stats.hits / lookups : 0.0);
+    printf("misses:      %ld (%ld not stored)\n", cached_stats.misses, cached_stats.uncacheable);
+    printf("evictions:   %ld\n", cached_stats.evictions);
+    printf("replayed:    %lld bytes\n", cached_stats.bytes_replayed);
+    return 0;
+}
+
+// Remove every cache file
+static int clear_cache() {
+    const char* dir = cache_dir();
+    if (dir == NULL) {
+        return 1;
+    }
+    cache_entry_t* entries;
+    off_t total;
+    int count = list_entries(dir, &entries, &total);
+    char path[PATH_MAX];
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+        unlink(path);
+    }
+    free(entries);
+    return 0;
+}
+
+// Built-in command: cached [-e VAR]... [-i FILE]... command [args...]
+//                   cached --stats | --clear
+// Memoizes a deterministic command: the key covers the directory, argv,
+// the -e environment variables and the size and mtime of the -i files
+// (stdin is not part of it). A hit replays the stored stdout and exit
+// status without running anything; a miss streams the output while
+// storing it. The cache is kept under CACHED_SIZE (default 64m) by
+// evicting the least recently used entries; one entry may use a quarter.
+int builtin_cached(char** arglist) {
+    if (arglist[1] != NULL && strcmp(arglist[1], "--stats") == 0) {
+        return print_cache_stats();
+    }
+    if (arglist[1] != NULL && strcmp(arglist[1], "--clear") == 0) {
+        return clear_cache();
+    }
+
+    char* vars[CACHED_MAX_OPTIONS];
+    char* inputs[CACHED_MAX_OPTIONS];
+    int num_vars = 0, num_inputs = 0;
+    int i = 1;
+    for (; arglist[i] != NULL && arglist[i][0] == '-'; i++) {
+        if (strcmp(arglist[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (arglist[i + 1] != NULL && strcmp(arglist[i], "-e") == 0 &&
+            num_vars < CACHED_MAX_OPTIONS) {
+            vars[num_vars++] = arglist[++i];
+        } else if (arglist[i + 1] != NULL && strcmp(arglist[i], "-i") == 0 &&
+                   num_inputs < CACHED_MAX_OPTIONS) {
+            inputs[num_inputs++] = arglist[++i];
+        } else {
+            break;
+        }
+    }
+    if (arglist[i] == NULL) {
+        fprintf(stderr, "cached: usage: cached [-e var]... [-i file]... command [args...]\n");
+        return 2;
+    }
+    char** argv = &arglist[i];
+
+    const char* dir = cache_dir();
+    if (dir == NULL) {
+        // No cache: just run it
+        fflush(stdout);
+        pid_t pid = stats_fork();
+        if (pid == 0) exec_in_child(argv, command_assigns);
+        int wstatus;
+        return pid > 0 && stats_waitpid(pid, &wstatus, 0) == pid ? decode_status(wstatus) : 1;
+    }
+
+    strbuf_t key;
+    sb_init(&key);
+    build_key(&key, argv, vars, num_vars, inputs, num_inputs);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%016llx", dir,
+             (unsigned long long)hash_bytes(key.data, key.len));
+
+    int status = replay_entry(path, &key);
+    if (status >= 0) {
+        cached_stats.hits++;
+    } else {
+        cached_stats.misses++;
+        long limit = cache_limit();
+        status = run_and_store(argv, dir, path, &key, limit / 4);
+        evict_entries(dir, limit);
+    }
+    sb_free(&key);
+    return status;
+}
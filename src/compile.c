@@ -0,0 +1,656 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define MSHC_MAGIC 0x4348534dU      // "MSHC" as a little-endian word
+#define MSHC_VERSION 2
+#define MSHC_STALE 1                // load_compiled(): the script has changed
+#define MSHC_DAMAGED -2             // load_compiled(): truncated or corrupt
+#define MSHC_MIN_SOURCE 4096        // Smaller scripts parse faster than a lookup
+
+// Compiled script: a header followed by 4-byte aligned records that refer
+// to each other by their offset in the file, so the blob needs no
+// relocation wherever it is mapped. Offset 0 (the header) means NULL.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t root;              // Root node record
+    uint32_t source_path;       // String: the script this was compiled from
+    uint64_t source_size;       // Its size and mtime at the time
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint64_t payload_size;      // Bytes after the header
+    uint64_t payload_hash;      // 64-bit FNV-1a of them
+} mshc_header_t;
+
+// Node record; the fields depend on the type:
+//   COMMAND          a = words, b = assigns (word arrays), c = redirections
+//   PIPELINE         a = node array, b = negate
+//   AND / OR         a = left, b = right
+//   LIST             a = node array
+//   IF               a = condition, b = then, c = else
+//   WHILE            a = condition, b = body, c = until
+//   FOR              a = variable, b = word array, c = body
+//   FUNCDEF          a = name, b = body
+//   CASE             a = word text, b = word flags, c = arm array
+//   GROUP, SUBSHELL  a = body
+//   ARITH            a = expression text
+// The redirections after a compound command are in 'redirect' (0 if none).
+// Arrays are a count followed by the items: offsets for nodes, text/flags
+// pairs for words, (type, fd, text, flags, here-doc) for redirections,
+// (pattern words, body) for case arms. A here-doc is (text, flags, here_string).
+typedef struct {
+    uint32_t type;
+    uint32_t background;
+    uint32_t source;            // String
+    uint32_t redirect;          // Redirections
+    uint32_t a, b, c;
+} mshc_node_t;
+
+// Append a record to the blob at the next 4-byte boundary; returns its offset
+static uint32_t put(strbuf_t* blob, const void* data, size_t len) {
+    while (blob->len % 4 != 0) {
+        sb_putc(blob, '\0');
+    }
+    uint32_t offset = blob->len;
+    sb_appendn(blob, data, len);
+    return offset;
+}
+
+static uint32_t put_string(strbuf_t* blob, const char* str) {
+    return str != NULL ? put(blob, str, strlen(str) + 1) : 0;
+}
+
+static uint32_t put_words(strbuf_t* blob, const word_t* words, int count) {
+    uint32_t* record = malloc((1 + 2 * count) * sizeof(uint32_t));
+    if (record == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    record[0] = count;
+    for (int i = 0; i < count; i++) {
+        record[1 + 2 * i] = put_string(blob, words[i].text);
+        record[2 + 2 * i] = words[i].flags;
+    }
+    uint32_t offset = put(blob, record, (1 + 2 * count) * sizeof(uint32_t));
+    free(record);
+    return offset;
+}
+
+static uint32_t put_node(strbuf_t* blob, const node_t* node);
+
+static uint32_t put_nodes(strbuf_t* blob, node_t* const* nodes, int count) {
+    uint32_t* record = malloc((1 + count) * sizeof(uint32_t));
+    if (record == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    record[0] = count;
+    for (int i = 0; i < count; i++) {
+        record[1 + i] = put_node(blob, nodes[i]);
+    }
+    uint32_t offset = put(blob, record, (1 + count) * sizeof(uint32_t));
+    free(record);
+    return offset;
+}
+
+static uint32_t put_redirections(strbuf_t* blob, const command_t* cmd) {
+    uint32_t* record = malloc((1 + 5 * cmd->num_redirs) * sizeof(uint32_t));
+    if (record == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    record[0] = cmd->num_redirs;
+    for (int i = 0; i < cmd->num_redirs; i++) {
+        const redirection_t* r = &cmd->redirs[i];
+        uint32_t* item = &record[1 + 5 * i];
+        item[0] = r->type;
+        item[1] = r->fd;
+        item[2] = put_string(blob, r->target.text);
+        item[3] = r->target.flags;
+        item[4] = 0;
+        if (r->here_doc != NULL) {
+            uint32_t here_doc[3] = { put_string(blob, r->here_doc->body.text),
+                                     r->here_doc->body.flags, r->here_doc->here_string };
+            item[4] = put(blob, here_doc, sizeof(here_doc));
+        }
+    }
+    uint32_t offset = put(blob, record, (1 + 5 * cmd->num_redirs) * sizeof(uint32_t));
+    free(record);
+    return offset;
+}
+
+// Write a node and everything under it; returns its offset
+static uint32_t put_node(strbuf_t* blob, const node_t* node) {
+    if (node == NULL) {
+        return 0;
+    }
+    mshc_node_t rec = { node->type, node->background, put_string(blob, node->source), 0, 0, 0, 0 };
+    if (node->redirect != NULL) {
+        rec.redirect = put_redirections(blob, node->redirect);
+    }
+
+    switch (node->type) {
+        case NODE_COMMAND:
+            rec.a = put_words(blob, node->command.words, node->command.num_words);
+            rec.b = put_words(blob, node->command.assigns, node->command.num_assigns);
+            rec.c = put_redirections(blob, &node->command);
+            break;
+        case NODE_PIPELINE:
+            rec.a = put_nodes(blob, node->pipeline.commands, node->pipeline.num_commands);
+            rec.b = node->pipeline.negate;
+            break;
+        case NODE_AND:
+        case NODE_OR:
+            rec.a = put_node(blob, node->binary.left);
+            rec.b = put_node(blob, node->binary.right);
+            break;
+        case NODE_LIST:
+            rec.a = put_nodes(blob, node->list.items, node->list.count);
+            break;
+        case NODE_IF:
+            rec.a = put_node(blob, node->if_block.condition);
+            rec.b = put_node(blob, node->if_block.then_part);
+            rec.c = put_node(blob, node->if_block.else_part);
+            break;
+        case NODE_WHILE:
+            rec.a = put_node(blob, node->loop.condition);
+            rec.b = put_node(blob, node->loop.body);
+            rec.c = node->loop.until;
+            break;
+        case NODE_FOR:
+            rec.a = put_string(blob, node->for_loop.var);
+            rec.b = put_words(blob, node->for_loop.words, node->for_loop.num_words);
+            rec.c = put_node(blob, node->for_loop.body);
+            break;
+        case NODE_FUNCDEF:
+            rec.a = put_string(blob, node->function->name);
+            rec.b = put_node(blob, node->function->body);
+            break;
+        case NODE_CASE: {
+            const case_block_t* cb = &node->case_block;
+            uint32_t* arms = malloc((1 + 2 * cb->num_arms) * sizeof(uint32_t));
+            if (arms == NULL) {
+                perror("malloc failed");
+                exit(1);
+            }
+            arms[0] = cb->num_arms;
+            for (int i = 0; i < cb->num_arms; i++) {
+                arms[1 + 2 * i] = put_words(blob, cb->arms[i].patterns, cb->arms[i].num_patterns);
+                arms[2 + 2 * i] = put_node(blob, cb->arms[i].body);
+            }
+            rec.a = put_string(blob, cb->word.text);
+            rec.b = cb->word.flags;
+            rec.c = put(blob, arms, (1 + 2 * cb->num_arms) * sizeof(uint32_t));
+            free(arms);
+            break;
+        }
+        case NODE_GROUP:
+        case NODE_SUBSHELL:
+            rec.a = put_node(blob, node->body);
+            break;
+        case NODE_ARITH:
+            rec.a = put_string(blob, node->arith.text);
+            break;
+    }
+    return put(blob, &rec, sizeof(rec));
+}
+
+// Write the tree of the script source_path (as it was when st was taken)
+// to file; the file is replaced atomically. Returns 0 on success.
+int save_compiled(const char* file, node_t* tree, const char* source_path,
+                  const struct stat* st) {
+    strbuf_t blob;
+    sb_init(&blob);
+    mshc_header_t header = { 0 };
+    put(&blob, &header, sizeof(header));
+    header.magic = MSHC_MAGIC;
+    header.version = MSHC_VERSION;
+    header.source_path = put_string(&blob, source_path);
+    header.source_size = st->st_size;
+    header.source_mtime_sec = st->st_mtim.tv_sec;
+    header.source_mtime_nsec = st->st_mtim.tv_nsec;
+    header.root = encode_tree(&blob, tree);
+    header.payload_size = blob.len - sizeof(header);
+    header.payload_hash = hash_bytes(blob.data + sizeof(header), header.payload_size);
+    memcpy(blob.data, &header, sizeof(header));
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file);
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    int result = -1;
+    if (fd >= 0) {
+        size_t done = 0;
+        while (done < blob.len) {
+            ssize_t n = write(fd, blob.data + done, blob.len - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        fchmod(fd, 0644);
+        close(fd);
+        if (done == blob.len && rename(tmp, file) == 0) {
+            result = 0;
+        } else {
+            unlink(tmp);
+        }
+    }
+    sb_free(&blob);
+    return result;
+}
+
+// Mapped blob being turned back into a tree
+typedef struct {
+    const char* base;
+    size_t size;
+    size_t start;               // Records begin after the header
+    int bad;                    // An offset or value was out of range
+    unsigned char* seen;        // Bit per 4-byte offset: node records decoded
+} mshc_reader_t;
+
+// Record of len bytes at offset, or NULL (and bad set) if out of range
+static const void* record_at(mshc_reader_t* r, uint32_t offset, size_t len) {
+    if (offset < r->start || offset % 4 != 0 || offset > r->size ||
+        len > r->size - offset) {
+        r->bad = 1;
+        return NULL;
+    }
+    return r->base + offset;
+}
+
+// Array record: its count and items of 'width' words each
+static const uint32_t* array_at(mshc_reader_t* r, uint32_t offset, int width, uint32_t* count) {
+    const uint32_t* head = record_at(r, offset, sizeof(uint32_t));
+    if (head == NULL || *head > (r->size - offset) / sizeof(uint32_t) / width) {
+        r->bad = 1;
+        *count = 0;
+        return NULL;
+    }
+    *count = *head;
+    return record_at(r, offset, (1 + (size_t)width * *count) * sizeof(uint32_t)) ? head + 1 : NULL;
+}
+
+static char* get_string(mshc_reader_t* r, uint32_t offset) {
+    if (offset == 0) {
+        return NULL;
+    }
+    if (offset < r->start || offset >= r->size ||
+        memchr(r->base + offset, '\0', r->size - offset) == NULL) {
+        r->bad = 1;
+        return NULL;
+    }
+    return strdup(r->base + offset);
+}
+
+static word_t* get_words(mshc_reader_t* r, uint32_t offset, int* count) {
+    uint32_t n;
+    const uint32_t* items = array_at(r, offset, 2, &n);
+    *count = 0;
+    if (items == NULL) {
+        return NULL;
+    }
+    word_t* words = calloc(n + 1, sizeof(word_t));
+    if (words == NULL) {
+        perror("calloc failed");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        words[i].text = get_string(r, items[2 * i]);
+        words[i].flags = items[2 * i + 1];
+        if (words[i].text == NULL) r->bad = 1;
+    }
+    *count = n;
+    return words;
+}
+
+static node_t* get_node(mshc_reader_t* r, uint32_t offset);
+
+static node_t** get_nodes(mshc_reader_t* r, uint32_t offset, int* count) {
+    uint32_t n;
+    const uint32_t* items = array_at(r, offset, 1, &n);
+    *count = 0;
+    if (items == NULL) {
+        return NULL;
+    }
+    node_t** nodes = calloc(n + 1, sizeof(node_t*));
+    if (nodes == NULL) {
+        perror("calloc failed");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        nodes[i] = get_node(r, items[i]);
+    }
+    *count = n;
+    return nodes;
+}
+
+static void get_redirections(mshc_reader_t* r, uint32_t offset, command_t* cmd) {
+    uint32_t n;
+    const uint32_t* items = array_at(r, offset, 5, &n);
+    if (items == NULL || n == 0) {
+        return;
+    }
+    cmd->redirs = calloc(n, sizeof(redirection_t));
+    if (cmd->redirs == NULL) {
+        perror("calloc failed");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const uint32_t* item = &items[5 * i];
+        redirection_t* redir = &cmd->redirs[i];
+        redir->type = item[0] <= REDIR_HERE_DOC ? (redir_type_t)item[0] : REDIR_INPUT;
+        redir->fd = item[1];
+        redir->target.text = get_string(r, item[2]);
+        redir->target.flags = item[3];
+        if (item[4] != 0) {
+            const uint32_t* here_doc = record_at(r, item[4], 3 * sizeof(uint32_t));
+            redir->here_doc = calloc(1, sizeof(here_doc_t));
+            if (redir->here_doc == NULL) {
+                perror("calloc failed");
+                exit(1);
+            }
+            if (here_doc != NULL) {
+                redir->here_doc->body.text = get_string(r, here_doc[0]);
+                redir->here_doc->body.flags = here_doc[1];
+                redir->here_doc->here_string = here_doc[2];
+            }
+            if (redir->here_doc->body.text == NULL) r->bad = 1;
+        }
+        if (item[0] > REDIR_HERE_DOC || redir->target.text == NULL) r->bad = 1;
+    }
+    cmd->num_redirs = n;
+}
+
+// Rebuild a node from its record, compiling what the parser compiles
+static node_t* get_node(mshc_reader_t* r, uint32_t offset) {
+    if (offset == 0) {
+        return NULL;
+    }
+    // Every node has one parent, so a record reached twice means a cycle
+    const mshc_node_t* rec = record_at(r, offset, sizeof(mshc_node_t));
+    if (rec == NULL || rec->type > NODE_ARITH || (r->seen[offset / 32] & (1 << (offset / 4 % 8)))) {
+        r->bad = 1;
+        return NULL;
+    }
+    r->seen[offset / 32] |= 1 << (offset / 4 % 8);
+
+    node_t* node = new_node((node_type_t)rec->type);
+    node->background = rec->background;
+    node->source = get_string(r, rec->source);
+    if (rec->redirect != 0) {
+        node->redirect = calloc(1, sizeof(command_t));
+        if (node->redirect == NULL) {
+            perror("calloc failed");
+            exit(1);
+        }
+        get_redirections(r, rec->redirect, node->redirect);
+    }
+
+    switch (node->type) {
+        case NODE_COMMAND:
+            node->command.words = get_words(r, rec->a, &node->command.num_words);
+            node->command.assigns = get_words(r, rec->b, &node->command.num_assigns);
+            get_redirections(r, rec->c, &node->command);
+            break;
+        case NODE_PIPELINE:
+            node->pipeline.commands = get_nodes(r, rec->a, &node->pipeline.num_commands);
+            node->pipeline.negate = rec->b;
+            break;
+        case NODE_AND:
+        case NODE_OR:
+            node->binary.left = get_node(r, rec->a);
+            node->binary.right = get_node(r, rec->b);
+            break;
+        case NODE_LIST:
+            node->list.items = get_nodes(r, rec->a, &node->list.count);
+            break;
+        case NODE_IF:
+            node->if_block.condition = get_node(r, rec->a);
+            node->if_block.then_part = get_node(r, rec->b);
+            node->if_block.else_part = get_node(r, rec->c);
+            break;
+        case NODE_WHILE:
+            node->loop.condition = get_node(r, rec->a);
+            node->loop.body = get_node(r, rec->b);
+            node->loop.until = rec->c;
+            break;
+        case NODE_FOR:
+            node->for_loop.var = get_string(r, rec->a);
+            node->for_loop.words = get_words(r, rec->b, &node->for_loop.num_words);
+            node->for_loop.body = get_node(r, rec->c);
+            if (node->for_loop.var == NULL) r->bad = 1;
+            break;
+        case NODE_FUNCDEF: {
+            char* name = get_string(r, rec->a);
+            node->function = new_function(name != NULL ? name : "", get_node(r, rec->b));
+            free(name);
+            break;
+        }
+        case NODE_CASE: {
+            case_block_t* cb = &node->case_block;
+            uint32_t n;
+            const uint32_t* arms = array_at(r, rec->c, 2, &n);
+            cb->word.text = get_string(r, rec->a);
+            cb->word.flags = rec->b;
+            cb->arms = calloc(n + 1, sizeof(case_arm_t));
+            if (cb->arms == NULL) {
+                perror("calloc failed");
+                exit(1);
+            }
+            for (uint32_t i = 0; arms != NULL && i < n; i++) {
+                cb->arms[i].patterns = get_words(r, arms[2 * i], &cb->arms[i].num_patterns);
+                cb->arms[i].body = get_node(r, arms[2 * i + 1]);
+                cb->num_arms++;
+            }
+            if (cb->word.text == NULL) {
+                r->bad = 1;
+                cb->word.text = strdup("");
+            }
+            if (!r->bad) {
+                compile_case_patterns(cb);
+            }
+            break;
+        }
+        case NODE_GROUP:
+        case NODE_SUBSHELL:
+            node->body = get_node(r, rec->a);
+            break;
+        case NODE_ARITH:
+            node->arith.text = get_string(r, rec->a);
+            if (node->arith.text == NULL) {
+                r->bad = 1;
+            } else if (strchr(node->arith.text, '$') == NULL) {
+                node->arith.expr = compile_arith(node->arith.text);
+            }
+            break;
+    }
+    return node;
+}
+
+// Append the records of a tree to blob, which must not be empty (offset
+// 0 means NULL); returns the offset of the root
+uint32_t encode_tree(strbuf_t* blob, const node_t* tree) {
+    return put_node(blob, tree);
+}
+
+// Rebuild the tree whose root record is at offset in data (size bytes,
+// records from 'start' on). Returns 0, or -1 if a record is damaged.
+int decode_tree(const char* data, size_t size, size_t start, uint32_t offset, node_t** tree) {
+    mshc_reader_t r = { data, size, start, 0, calloc(size / 32 + 1, 1) };
+    if (r.seen == NULL) {
+        perror("calloc failed");
+        exit(1);
+    }
+    *tree = get_node(&r, offset);
+    free(r.seen);
+    if (r.bad) {
+        free_node(*tree);
+        *tree = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Map a compiled script and rebuild its tree in *tree. Returns 0 on
+// success, -1 if file is not a compiled script, MSHC_DAMAGED if it is
+// one but fails its checks, or MSHC_STALE if the script it was compiled
+// from has changed since (*source_path is set to that script so it can
+// be run instead).
+int load_compiled(const char* file, node_t** tree, char** source_path) {
+    *tree = NULL;
+    *source_path = NULL;
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // Check the header before mapping anything
+    mshc_header_t header;
+    struct stat st;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != MSHC_MAGIC) {
+        close(fd);
+        return -1;
+    }
+    if (header.version != MSHC_VERSION || fstat(fd, &st) != 0 ||
+        (uint64_t)st.st_size != sizeof(header) + header.payload_size) {
+        close(fd);
+        return MSHC_DAMAGED;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return MSHC_DAMAGED;
+    }
+
+    mshc_reader_t r = { map, st.st_size, sizeof(header), 0, NULL };
+    int result = MSHC_DAMAGED;
+    if (hash_bytes(r.base + sizeof(header), header.payload_size) == header.payload_hash) {
+        *source_path = get_string(&r, header.source_path);
+        struct stat source;
+        if (*source_path != NULL && stat(*source_path, &source) == 0 &&
+            ((uint64_t)source.st_size != header.source_size ||
+             source.st_mtim.tv_sec != header.source_mtime_sec ||
+             source.st_mtim.tv_nsec != header.source_mtime_nsec)) {
+            result = MSHC_STALE; // Edited since: run the source
+        } else {
+            result = decode_tree(map, st.st_size, sizeof(header), header.root, tree) == 0
+                     ? 0 : MSHC_DAMAGED;
+        }
+    }
+    munmap(map, st.st_size);
+    if (result < 0) {
+        free(*source_path);
+        *source_path = NULL;
+    }
+    return result;
+}
+
+// File of the automatic cache for the script at path; NULL if the cache is
+// off (MYSHELL_MSHC=0) or has no directory. Keyed by the real path; the
+// header holds the size and mtime the entry is valid for.
+static char* cache_file(const char* path, char** real) {
+    const char* setting = getenv("MYSHELL_MSHC");
+    if (setting != NULL && strcmp(setting, "0") == 0) {
+        return NULL;
+    }
+    *real = realpath(path, NULL);
+    const char* dir = *real != NULL ? cache_directory("mshc", NULL) : NULL;
+    if (dir == NULL) {
+        free(*real);
+        *real = NULL;
+        return NULL;
+    }
+    char* file = malloc(strlen(dir) + 32);
+    if (file == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    sprintf(file, "%s/%016llx.mshc", dir, hash_bytes(*real, strlen(*real)));
+    return file;
+}
+
+// Tree of the script at path from the automatic cache, or NULL if it is
+// not cached, is small enough to parse directly, or has changed
+node_t* load_cached_script(const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || st.st_size < MSHC_MIN_SOURCE) {
+        return NULL;
+    }
+    char* real;
+    char* file = cache_file(path, &real);
+    if (file == NULL) {
+        return NULL;
+    }
+    node_t* tree = NULL;
+    char* source_path;
+    if (load_compiled(file, &tree, &source_path) == 0 && strcmp(source_path, real) != 0) {
+        free_node(tree); // Another script with the same hash
+        tree = NULL;
+    } else if (tree == NULL) {
+        unlink(file); // Stale or damaged
+    }
+    free(source_path);
+    free(real);
+    free(file);
+    return tree;
+}
+
+// Store the parsed tree of the script at path (as of st) in the cache
+void cache_script(const char* path, const struct stat* st, node_t* tree) {
+    if (st->st_size < MSHC_MIN_SOURCE) {
+        return;
+    }
+    char* real;
+    char* file = cache_file(path, &real);
+    if (file != NULL) {
+        save_compiled(file, tree, real, st);
+        free(real);
+        free(file);
+    }
+}
+
+// Compile the script at path to a .mshc file next to it (script.sh
+// becomes script.mshc). Returns 0 on success.
+int compile_script(const char* path) {
+    struct stat st;
+    char* source = read_file(path, &st);
+    if (source == NULL) {
+        perror(path);
+        return 1;
+    }
+
+    node_t* tree;
+    int result = parse_program(source, &tree);
+    free(source);
+    if (result != PARSE_OK) {
+        if (result == PARSE_INCOMPLETE) {
+            fprintf(stderr, "%s: Syntax error: unexpected end of file\n", path);
+        }
+        return 2;
+    }
+
+    char* real = realpath(path, NULL);
+    size_t len = strlen(path);
+    char* out = malloc(len + 6);
+    if (out == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    strcpy(out, path);
+    if (len > 3 && strcmp(out + len - 3, ".sh") == 0) {
+        out[len - 3] = '\0';
+    }
+    strcat(out, ".mshc");
+
+    int status = 0;
+    if (save_compiled(out, tree, real != NULL ? real : path, &st) != 0) {
+        perror(out);
+        status = 1;
+    }
+    free_node(tree);
+    free(real);
+    free(out);
+    return status;
+}
@@ -1,235 +1,470 @@
 #include "shell.h"
 
+// Loop nesting and pending break / continue levels
+int loop_depth = 0;
+int break_levels = 0;
+int continue_levels = 0;
+
+// Check if a break, continue or return is unwinding the current block
+int is_unwinding() {
+    return break_levels > 0 || continue_levels > 0 || return_pending;
+}
+
 // Check if a word is a control structure keyword
 int is_control_keyword(const char* word) {
     return (strcmp(word, "if") == 0 ||
             strcmp(word, "then") == 0 ||
+            strcmp(word, "elif") == 0 ||
             strcmp(word, "else") == 0 ||
-            strcmp(word, "fi") == 0);
-}
-
-// Read multiline command for control structures
-char* read_multiline_command(const char* initial_prompt) {
-    printf("%s", initial_prompt);
-    
-    char* full_command = malloc(MAX_LEN);
-    if (!full_command) return NULL;
-    full_command[0] = '\0';
-    
-    char line[MAX_LEN];
-    int if_count = 0;
-    int reading_block = 0;
-    
-    while (fgets(line, MAX_LEN, stdin)) {
-        // Remove newline
-        line[strcspn(line, "\n")] = '\0';
-        
-        // Tokenize to check for control keywords
-        char* tokens[MAXARGS];
-        int token_count = 0;
-        char* token = strtok(line, " \t");
-        
-        while (token != NULL && token_count < MAXARGS - 1) {
-            tokens[token_count++] = token;
-            token = strtok(NULL, " \t");
-        }
-        tokens[token_count] = NULL;
-        
-        // Count if/fi to track block structure
-        if (token_count > 0) {
-            if (strcmp(tokens[0], "if") == 0) {
-                if_count++;
-                reading_block = 1;
-            } else if (strcmp(tokens[0], "fi") == 0) {
-                if_count--;
-            }
+            strcmp(word, "fi") == 0 ||
+            strcmp(word, "while") == 0 ||
+            strcmp(word, "until") == 0 ||
+            strcmp(word, "for") == 0 ||
+            strcmp(word, "in") == 0 ||
+            strcmp(word, "do") == 0 ||
+            strcmp(word, "done") == 0 ||
+            strcmp(word, "case") == 0 ||
+            strcmp(word, "esac") == 0);
+}
+
+// Parse an if-then-elif-else-fi block starting at 'if' (or 'elif').
+// Bodies are parsed into AST nodes here, once, and may nest freely.
+node_t* parse_if_block(parser_t* p) {
+    p->pos++; // Skip 'if' / 'elif'
+
+    node_t* node = new_node(NODE_IF);
+    if_block_t* if_block = &node->if_block;
+
+    // Condition list, terminated by 'then'
+    if_block->condition = parse_compound_list(p);
+    if (if_block->condition == NULL || !expect_keyword(p, "then")) {
+        free_node(node);
+        return NULL;
+    }
+
+    // Then block, terminated by elif, else or fi
+    if_block->then_part = parse_compound_list(p);
+    if (if_block->then_part == NULL) {
+        free_node(node);
+        return NULL;
+    }
+
+    // An elif chain becomes a nested if that also consumes the closing fi
+    if (is_keyword(peek_token(p), "elif")) {
+        if_block->else_part = parse_if_block(p);
+        if (if_block->else_part == NULL) {
+            free_node(node);
+            return NULL;
         }
-        
-        // Append line to full command
-        if (strlen(full_command) + strlen(line) + 2 < MAX_LEN) {
-            if (full_command[0] != '\0') {
-                strcat(full_command, " ");
-            }
-            strcat(full_command, line);
+        return node;
+    }
+
+    if (accept_keyword(p, "else")) {
+        if_block->else_part = parse_compound_list(p);
+        if (if_block->else_part == NULL) {
+            free_node(node);
+            return NULL;
+        }
+    }
+
+    // Check for closing fi
+    if (!expect_keyword(p, "fi")) {
+        free_node(node);
+        return NULL;
+    }
+
+    return node;
+}
+
+// Execute an if-then-else block
+int execute_if_block(if_block_t* if_block) {
+    if (if_block == NULL || if_block->condition == NULL) {
+        return -1;
+    }
+
+    // Execute appropriate block based on condition result
+    if (execute_node(if_block->condition) == 0) {
+        return execute_node(if_block->then_part);
+    } else if (if_block->else_part != NULL) {
+        return execute_node(if_block->else_part);
+    }
+
+    return 0;
+}
+
+// Parse 'do LIST done' into a loop body
+static node_t* parse_do_group(parser_t* p) {
+    skip_newlines(p);
+    if (!expect_keyword(p, "do")) {
+        return NULL;
+    }
+    node_t* body = parse_compound_list(p);
+    if (body == NULL) {
+        return NULL;
+    }
+    if (!expect_keyword(p, "done")) {
+        free_node(body);
+        return NULL;
+    }
+    return body;
+}
+
+// Parse 'while LIST do LIST done' or 'until LIST do LIST done'
+node_t* parse_while_loop(parser_t* p) {
+    node_t* node = new_node(NODE_WHILE);
+    node->loop.until = is_keyword(peek_token(p), "until");
+    p->pos++; // Skip 'while' / 'until'
+
+    node->loop.condition = parse_compound_list(p);
+    if (node->loop.condition == NULL) {
+        free_node(node);
+        return NULL;
+    }
+
+    node->loop.body = parse_do_group(p);
+    if (node->loop.body == NULL) {
+        free_node(node);
+        return NULL;
+    }
+
+    return node;
+}
+
+// Parse 'for NAME [in WORDS...] ; do LIST done'
+node_t* parse_for_loop(parser_t* p) {
+    p->pos++; // Skip 'for'
+
+    token_t* tok = peek_token(p);
+    if (tok->type != TOK_WORD) {
+        syntax_error(p, tok, "variable name");
+        return NULL;
+    }
+    if (!is_valid_name(tok->text)) {
+        syntax_error(p, tok, "variable name");
+        return NULL;
+    }
+
+    node_t* node = new_node(NODE_FOR);
+    node->for_loop.var = strdup(tok->text);
+    p->pos++;
+
+    // The word list is kept unexpanded; it is expanded once per loop run
+    skip_newlines(p);
+    if (accept_keyword(p, "in")) {
+        while (peek_token(p)->type == TOK_WORD) {
+            append_word(&node->for_loop.words, &node->for_loop.num_words,
+                        peek_token(p)->text);
+            p->pos++;
         }
-        
-        // Stop reading when we reach the matching fi
-        if (if_count == 0 && reading_block) {
+    }
+    if (peek_token(p)->type == TOK_SEMI) {
+        p->pos++;
+    }
+
+    node->for_loop.body = parse_do_group(p);
+    if (node->for_loop.body == NULL) {
+        free_node(node);
+        return NULL;
+    }
+
+    return node;
+}
+
+// Check pending break / continue after running a loop body.
+// Returns 1 if the current loop must stop.
+static int loop_should_stop() {
+    if (return_pending) {
+        return 1;
+    }
+    if (break_levels > 0) {
+        break_levels--;
+        return 1;
+    }
+    if (continue_levels > 1) {
+        continue_levels--; // Continue an enclosing loop
+        return 1;
+    }
+    continue_levels = 0;
+    return 0;
+}
+
+// Execute a while / until loop; the body AST is reused on every iteration
+int execute_while_loop(loop_t* loop) {
+    int status = 0;
+
+    loop_depth++;
+    while (1) {
+        int condition = execute_node(loop->condition);
+        if (is_unwinding()) {
+            if (loop_should_stop()) break;
+            continue;
+        }
+        if ((condition == 0) == loop->until) {
             break;
         }
-        
-        if (if_count < 0) {
-            fprintf(stderr, "Syntax error: unexpected 'fi'\n");
-            free(full_command);
-            return NULL;
+
+        status = execute_node(loop->body);
+        if (is_unwinding() && loop_should_stop()) {
+            break;
         }
-        
-        // Show continuation prompt
-        if (if_count > 0) {
-            printf("> ");
+    }
+    loop_depth--;
+
+    return status;
+}
+
+// Execute a for loop over its expanded word list
+int execute_for_loop(for_loop_t* for_loop) {
+    int status = 0;
+    expansion_error = 0;
+    char** values = expand_words(for_loop->words, for_loop->num_words);
+    if (expansion_error) {
+        free_argv(values);
+        return expansion_failed();
+    }
+
+    loop_depth++;
+    for (int i = 0; values[i] != NULL; i++) {
+        set_variable(for_loop->var, values[i]);
+
+        status = execute_node(for_loop->body);
+        if (is_unwinding() && loop_should_stop()) {
+            break;
         }
     }
-    
-    if (if_count != 0) {
-        fprintf(stderr, "Syntax error: unclosed if block\n");
-        free(full_command);
-        return NULL;
+    loop_depth--;
+
+    free_argv(values);
+    return status;
+}
+
+// Add a literal pattern to the case dispatch table; the first arm wins
+static void add_case_literal(case_block_t* case_block, const char* text, int arm) {
+    unsigned int bucket = hash_string(text) & (case_block->num_buckets - 1);
+    for (case_literal_t* lit = case_block->buckets[bucket]; lit != NULL; lit = lit->next) {
+        if (strcmp(lit->text, text) == 0) {
+            return;
+        }
+    }
+
+    case_literal_t* lit = malloc(sizeof(case_literal_t));
+    if (lit == NULL) {
+        perror("malloc failed");
+        exit(1);
     }
-    
-    return full_command;
+    lit->text = strdup(text);
+    lit->arm = arm;
+    lit->next = case_block->buckets[bucket];
+    case_block->buckets[bucket] = lit;
 }
 
-// Parse if-then-else block from command lines
-int parse_if_block(char** lines, int num_lines, if_block_t* if_block) {
-    if (num_lines < 3) { // Minimum: if, then, fi
-        fprintf(stderr, "Syntax error: incomplete if block\n");
-        return -1;
+// Compile the patterns of every arm once: literal patterns go into a hash
+// table, glob patterns become pre-compiled matchers, and patterns that
+// contain $ are kept for expansion at run time
+void compile_case_patterns(case_block_t* case_block) {
+    int total = 0;
+    for (int i = 0; i < case_block->num_arms; i++) {
+        total += case_block->arms[i].num_patterns;
     }
-    
-    // Initialize if_block
-    if_block->condition = NULL;
-    if_block->then_count = 0;
-    if_block->else_count = 0;
-    if_block->has_else = 0;
-    
-    for (int i = 0; i < MAX_BLOCK_LINES; i++) {
-        if_block->then_commands[i] = NULL;
-        if_block->else_commands[i] = NULL;
-    }
-    
-    int line_index = 0;
-    int in_then_block = 0;
-    int in_else_block = 0;
-    
-    // Parse first line: if condition
-    if (strncmp(lines[line_index], "if ", 3) != 0) {
-        fprintf(stderr, "Syntax error: expected 'if' at beginning\n");
-        return -1;
+
+    case_block->num_buckets = 8;
+    while (case_block->num_buckets < total * 2) {
+        case_block->num_buckets *= 2;
     }
-    
-    // Extract condition (everything after "if ")
-    if_block->condition = strdup(lines[line_index] + 3);
-    line_index++;
-    
-    // Parse then block
-    if (line_index >= num_lines || strcmp(lines[line_index], "then") != 0) {
-        fprintf(stderr, "Syntax error: expected 'then' after if condition\n");
-        free(if_block->condition);
-        return -1;
+    case_block->buckets = calloc(case_block->num_buckets, sizeof(case_literal_t*));
+    case_block->patterns = malloc((total + 1) * sizeof(case_pattern_t));
+    if (case_block->buckets == NULL || case_block->patterns == NULL) {
+        perror("malloc failed");
+        exit(1);
     }
-    line_index++;
-    
-    in_then_block = 1;
-    
-    // Parse then commands until else or fi
-    while (line_index < num_lines && in_then_block) {
-        if (strcmp(lines[line_index], "else") == 0) {
-            in_then_block = 0;
-            in_else_block = 1;
-            if_block->has_else = 1;
-            line_index++;
-        } else if (strcmp(lines[line_index], "fi") == 0) {
-            in_then_block = 0;
-            // Don't increment line_index - fi will be handled below
-        } else {
-            if (if_block->then_count < MAX_BLOCK_LINES) {
-                if_block->then_commands[if_block->then_count++] = strdup(lines[line_index]);
+
+    for (int i = 0; i < case_block->num_arms; i++) {
+        case_arm_t* arm = &case_block->arms[i];
+        for (int j = 0; j < arm->num_patterns; j++) {
+            word_t* word = &arm->patterns[j];
+            case_pattern_t* pattern = &case_block->patterns[case_block->num_patterns];
+            pattern->arm = i;
+            pattern->glob = NULL;
+            pattern->word = NULL;
+
+            if (strchr(word->text, '$') != NULL) {
+                pattern->word = word;
+                case_block->num_patterns++;
+                continue;
+            }
+
+            char* text = expand_word_pattern(word);
+            glob_pattern_t* glob = compile_glob(text);
+            free(text);
+
+            if (!glob->has_wildcards) {
+                add_case_literal(case_block, glob->literal, i);
+                free_glob(glob);
             } else {
-                fprintf(stderr, "Error: too many commands in then block\n");
-                return -1;
+                pattern->glob = glob;
+                case_block->num_patterns++;
             }
-            line_index++;
         }
     }
-    
-    // Parse else block if present
-    if (in_else_block) {
-        while (line_index < num_lines && in_else_block) {
-            if (strcmp(lines[line_index], "fi") == 0) {
-                in_else_block = 0;
-                // Don't increment line_index - fi will be handled below
-            } else {
-                if (if_block->else_count < MAX_BLOCK_LINES) {
-                    if_block->else_commands[if_block->else_count++] = strdup(lines[line_index]);
-                } else {
-                    fprintf(stderr, "Error: too many commands in else block\n");
-                    return -1;
-                }
-                line_index++;
+}
+
+// Parse 'case WORD in [(]pattern[|pattern]...) list ;; ... esac'
+node_t* parse_case_block(parser_t* p) {
+    p->pos++; // Skip 'case'
+
+    token_t* tok = peek_token(p);
+    if (tok->type != TOK_WORD) {
+        syntax_error(p, tok, "word");
+        return NULL;
+    }
+
+    node_t* node = new_node(NODE_CASE);
+    case_block_t* case_block = &node->case_block;
+    init_word(&case_block->word, tok->text);
+    p->pos++;
+
+    skip_newlines(p);
+    if (!expect_keyword(p, "in")) {
+        free_node(node);
+        return NULL;
+    }
+    skip_newlines(p);
+
+    while (!accept_keyword(p, "esac")) {
+        if (peek_token(p)->type == TOK_LPAREN) {
+            p->pos++;
+        }
+
+        case_block->arms = realloc(case_block->arms, (case_block->num_arms + 1) * sizeof(case_arm_t));
+        if (case_block->arms == NULL) {
+            perror("realloc failed");
+            exit(1);
+        }
+        case_arm_t* arm = &case_block->arms[case_block->num_arms++];
+        memset(arm, 0, sizeof(case_arm_t));
+
+        // Pattern alternatives separated by '|'
+        while (1) {
+            tok = peek_token(p);
+            if (tok->type != TOK_WORD) {
+                syntax_error(p, tok, "pattern");
+                free_node(node);
+                return NULL;
             }
+            append_word(&arm->patterns, &arm->num_patterns, tok->text);
+            p->pos++;
+            if (peek_token(p)->type != TOK_PIPE) break;
+            p->pos++;
+        }
+
+        if (peek_token(p)->type != TOK_RPAREN) {
+            syntax_error(p, peek_token(p), ")");
+            free_node(node);
+            return NULL;
+        }
+        p->pos++;
+
+        // The arm body may be empty
+        arm->body = parse_list(p);
+        if (arm->body == NULL) {
+            free_node(node);
+            return NULL;
+        }
+
+        if (peek_token(p)->type == TOK_DSEMI) {
+            p->pos++;
+            skip_newlines(p);
+        } else if (!is_keyword(peek_token(p), "esac")) {
+            syntax_error(p, peek_token(p), ";;");
+            free_node(node);
+            return NULL;
         }
     }
-    
-    // Check for closing fi
-    if (line_index >= num_lines || strcmp(lines[line_index], "fi") != 0) {
-        fprintf(stderr, "Syntax error: expected 'fi' at end of if block\n");
-        return -1;
-    }
-    
-    return 0;
+
+    compile_case_patterns(case_block);
+    return node;
 }
 
-// Execute an if-then-else block
-int execute_if_block(if_block_t* if_block) {
-    if (if_block == NULL || if_block->condition == NULL) {
-        return -1;
+// Execute a case block: a hash lookup picks the first literal match, and
+// only glob patterns from earlier arms need to be tried before it
+int execute_case_block(case_block_t* case_block) {
+    expansion_error = 0;
+    char* value = expand_word_string(&case_block->word);
+    if (expansion_error) {
+        free(value);
+        return expansion_failed();
     }
-    
-    // Execute the condition command
-    pipeline_t pipeline;
-    int condition_result = 0;
-    
-    if (parse_redirection_pipes(if_block->condition, &pipeline) > 0) {
-        condition_result = execute_pipeline(&pipeline);
-        free_pipeline(&pipeline);
-    } else {
-        fprintf(stderr, "Error: failed to parse condition command\n");
-        return -1;
+    int selected = case_block->num_arms;
+
+    unsigned int bucket = hash_string(value) & (case_block->num_buckets - 1);
+    for (case_literal_t* lit = case_block->buckets[bucket]; lit != NULL; lit = lit->next) {
+        if (strcmp(lit->text, value) == 0) {
+            selected = lit->arm;
+            break;
+        }
     }
-    
-    // Execute appropriate block based on condition result
-    if (condition_result == 0) {
-        // Condition succeeded - execute then block
-        for (int i = 0; i < if_block->then_count; i++) {
-            if (if_block->then_commands[i] != NULL) {
-                if (parse_redirection_pipes(if_block->then_commands[i], &pipeline) > 0) {
-                    execute_pipeline(&pipeline);
-                    free_pipeline(&pipeline);
-                }
-            }
+
+    for (int i = 0; i < case_block->num_patterns; i++) {
+        case_pattern_t* pattern = &case_block->patterns[i];
+        if (pattern->arm >= selected) {
+            break;
         }
-    } else if (if_block->has_else) {
-        // Condition failed and else exists - execute else block
-        for (int i = 0; i < if_block->else_count; i++) {
-            if (if_block->else_commands[i] != NULL) {
-                if (parse_redirection_pipes(if_block->else_commands[i], &pipeline) > 0) {
-                    execute_pipeline(&pipeline);
-                    free_pipeline(&pipeline);
-                }
-            }
+
+        int matched;
+        if (pattern->glob != NULL) {
+            matched = glob_match(pattern->glob, value);
+        } else {
+            char* text = expand_word_pattern(pattern->word);
+            matched = glob_match(cached_glob(text), value);
+            free(text);
+        }
+
+        if (matched) {
+            selected = pattern->arm;
+            break;
         }
     }
-    
+
+    free(value);
+
+    if (selected < case_block->num_arms) {
+        return execute_node(case_block->arms[selected].body);
+    }
     return 0;
 }
 
-// Free memory allocated for if block
-void free_if_block(if_block_t* if_block) {
-    if (if_block == NULL) return;
-    
-    if (if_block->condition) {
-        free(if_block->condition);
+// Free memory allocated for a case block
+void free_case_block(case_block_t* case_block) {
+    free(case_block->word.text);
+
+    for (int i = 0; i < case_block->num_arms; i++) {
+        free_word_array(case_block->arms[i].patterns, case_block->arms[i].num_patterns);
+        free_node(case_block->arms[i].body);
     }
-    
-    for (int i = 0; i < if_block->then_count; i++) {
-        if (if_block->then_commands[i]) {
-            free(if_block->then_commands[i]);
+    free(case_block->arms);
+
+    for (int i = 0; i < case_block->num_buckets; i++) {
+        case_literal_t* lit = case_block->buckets[i];
+        while (lit != NULL) {
+            case_literal_t* next = lit->next;
+            free(lit->text);
+            free(lit);
+            lit = next;
         }
     }
-    
-    for (int i = 0; i < if_block->else_count; i++) {
-        if (if_block->else_commands[i]) {
-            free(if_block->else_commands[i]);
-        }
+    free(case_block->buckets);
+
+    for (int i = 0; i < case_block->num_patterns; i++) {
+        free_glob(case_block->patterns[i].glob);
     }
+    free(case_block->patterns);
+}
+
+// Free memory allocated for if block
+void free_if_block(if_block_t* if_block) {
+    if (if_block == NULL) return;
+
+    free_node(if_block->condition);
+    free_node(if_block->then_part);
+    free_node(if_block->else_part);
 }
@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <sys/sendfile.h>
+#include <time.h>
+
+#define COPY_CHUNK (1 << 20)     // Bytes requested per zero-copy call
+#define COPY_BUFFER 131072       // Buffer size of the read/write fallback
+#define TEE_MAX_OUTPUTS 64
+
+// How a copy was carried out, for the -V report
+typedef struct {
+    const char* method;
+    off_t bytes;
+} copy_stats_t;
+
+// Write all of buf to fd
+static int write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Check if fd is open for appending (splice and copy_file_range refuse it)
+static int is_append(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && (flags & O_APPEND);
+}
+
+// Copy everything from in to out with a plain read/write loop
+static int copy_buffered(int in, int* out, int nout, copy_stats_t* stats) {
+    char* buf = malloc(COPY_BUFFER);
+    if (buf == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    stats->method = "read/write";
+
+    int result = 0;
+    for (;;) {
+        ssize_t n = read(in, buf, COPY_BUFFER);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            result = -1;
+            break;
+        }
+        if (n == 0) break;
+        for (int i = 0; i < nout; i++) {
+            if (write_all(out[i], buf, n) != 0) {
+                result = -1;
+            }
+        }
+        if (result != 0) break;
+        stats->bytes += n;
+    }
+
+    free(buf);
+    return result;
+}
+
+// Move everything from in to out without copying through user space when
+// the kernel allows it. Each fast path reports "unsupported" (EINVAL and
+// friends) on its first call, so nothing has been moved when we fall back.
+static int copy_fd(int in, int out, copy_stats_t* stats) {
+    struct stat in_st, out_st;
+    if (fstat(in, &in_st) != 0 || fstat(out, &out_st) != 0) {
+        return -1;
+    }
+    int append = is_append(out);
+    ssize_t n;
+
+    stats->bytes = 0;
+
+    // File to file: let the filesystem copy (or reflink) the extents
+    if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode) && !append) {
+        stats->method = "copy_file_range";
+        while ((n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0)) > 0) {
+            stats->bytes += n;
+        }
+        if (n == 0) return 0;
+        if (stats->bytes > 0 || (errno != EXDEV && errno != EINVAL &&
+                                 errno != ENOSYS && errno != EOPNOTSUPP)) {
+            return -1;
+        }
+    }
+
+    // File to anything: send the page cache straight to the output
+    if (S_ISREG(in_st.st_mode)) {
+        stats->method = "sendfile";
+        while ((n = sendfile(out, in, NULL, COPY_CHUNK)) > 0) {
+            stats->bytes += n;
+        }
+        if (n == 0) return 0;
+        if (stats->bytes > 0 || (errno != EINVAL && errno != ENOSYS)) {
+            return -1;
+        }
+    }
+
+    // Pipe to anything, or anything to pipe: move pipe buffers by reference
+    if ((S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode)) && !append) {
+        stats->method = "splice";
+        while ((n = splice(in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE)) > 0) {
+            stats->bytes += n;
+        }
+        if (n == 0) return 0;
+        if (stats->bytes > 0 || (errno != EINVAL && errno != ENOSYS)) {
+            return -1;
+        }
+    }
+
+    return copy_buffered(in, &out, 1, stats);
+}
+
+// Splice exactly len bytes from in to out
+static int splice_all(int in, int out, size_t len) {
+    while (len > 0) {
+        ssize_t n = splice(in, NULL, out, NULL, len, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+// Fan a pipe out to several outputs with tee(2). Each chunk is duplicated
+// into a scratch pipe and spliced to every output but the last; the last
+// output consumes it from the input. Returns 1 if the outputs don't allow
+// it, before anything has been read.
+static int tee_pipe(int in, int* out, int nout, copy_stats_t* stats) {
+    for (int i = 0; i < nout; i++) {
+        struct stat st;
+        if (fstat(out[i], &st) != 0 || is_append(out[i]) ||
+            !(S_ISFIFO(st.st_mode) || S_ISREG(st.st_mode))) {
+            return 1;
+        }
+    }
+
+    int scratch[2];
+    if (pipe(scratch) != 0) {
+        return 1;
+    }
+    // An empty scratch pipe as large as the input takes any tee of it whole
+    int size = fcntl(in, F_GETPIPE_SZ);
+    if (size > 0) fcntl(scratch[1], F_SETPIPE_SZ, size);
+    stats->method = "tee";
+
+    int result = 0;
+    for (;;) {
+        ssize_t n;
+        if (nout > 1) {
+            n = tee(in, scratch[1], COPY_CHUNK, 0);
+        } else {
+            n = splice(in, NULL, out[0], NULL, COPY_CHUNK, SPLICE_F_MOVE);
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            result = stats->bytes == 0 && errno == EINVAL ? 1 : -1;
+            break;
+        }
+        if (n == 0) break;
+
+        for (int i = 0; i < nout - 1 && result == 0; i++) {
+            if (i > 0 && tee(in, scratch[1], n, 0) != n) {
+                result = -1;
+            } else if (splice_all(scratch[0], out[i], n) != 0) {
+                result = -1;
+            }
+        }
+        if (result == 0 && nout > 1 && splice_all(in, out[nout - 1], n) != 0) {
+            result = -1;
+        }
+        if (result != 0) break;
+        stats->bytes += n;
+    }
+
+    close(scratch[0]);
+    close(scratch[1]);
+    return result;
+}
+
+// Current time in seconds
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Print the -V report for one copy
+static void report(const char* name, const copy_stats_t* stats, double start) {
+    double elapsed = now() - start;
+    double rate = elapsed > 0 ? stats->bytes / elapsed / 1e6 : 0;
+    fprintf(stderr, "%s: %lld bytes in %.6f s (%.1f MB/s) via %s\n", name,
+            (long long)stats->bytes, elapsed, rate, stats->method);
+}
+
+// Parse the options shared by cat, cp and tee. Returns the index of the
+// first operand, or -1 for an option we don't implement.
+static int parse_copy_options(char** arglist, const char* allowed, int* verbose, int* append) {
+    int i = 1;
+    for (; arglist[i] != NULL && arglist[i][0] == '-' && arglist[i][1] != '\0'; i++) {
+        if (strcmp(arglist[i], "--") == 0) {
+            return i + 1;
+        }
+        for (const char* c = arglist[i] + 1; *c != '\0'; c++) {
+            if (strchr(allowed, *c) == NULL) return -1;
+            if (*c == 'V') *verbose = 1;
+            if (*c == 'a') *append = 1;
+        }
+    }
+    return i;
+}
+
+// Copy everything from in to out the fastest way available
+int copy_stream(int in, int out) {
+    copy_stats_t stats = { "none", 0 };
+    return copy_fd(in, out, &stats);
+}
+
+// Built-in command: cat [-V] [file...]
+// Options we don't implement are handed to the external cat.
+int builtin_cat(char** arglist) {
+    int verbose = 0, append = 0;
+    int i = parse_copy_options(arglist, "V", &verbose, &append);
+    if (i < 0) {
+        return execute(arglist, NULL);
+    }
+
+    char* stdin_only[] = { "-", NULL };
+    char** files = arglist[i] != NULL ? &arglist[i] : stdin_only;
+    int status = 0;
+    fflush(stage_stream());
+
+    for (; *files != NULL; files++) {
+        int in = stage_in;
+        if (strcmp(*files, "-") != 0) {
+            in = open(*files, O_RDONLY | O_CLOEXEC);
+            if (in < 0) {
+                fprintf(stderr, "cat: %s: %s\n", *files, strerror(errno));
+                status = 1;
+                continue;
+            }
+        }
+
+        copy_stats_t stats = { "none", 0 };
+        double start = now();
+        if (copy_fd(in, stage_out, &stats) != 0) {
+            // A reader that went away is reported by SIGPIPE, as for cat(1)
+            if (errno != EPIPE) fprintf(stderr, "cat: %s: %s\n", *files, strerror(errno));
+            status = 1;
+        }
+        if (verbose) report("cat", &stats, start);
+        if (in != stage_in) close(in);
+    }
+    return status;
+}
+
+// Built-in command: cp [-V] source dest
+// dest may be a directory. Options we don't implement (and more than one
+// source) are handed to the external cp.
+int builtin_cp(char** arglist) {
+    int verbose = 0, append = 0;
+    int i = parse_copy_options(arglist, "V", &verbose, &append);
+    if (i < 0 || (arglist[i] != NULL && arglist[i + 1] != NULL && arglist[i + 2] != NULL)) {
+        return execute(arglist, NULL);
+    }
+    if (arglist[i] == NULL || arglist[i + 1] == NULL) {
+        fprintf(stderr, "cp: usage: cp [-V] source dest\n");
+        return 2;
+    }
+
+    const char* source = arglist[i];
+    int in = open(source, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (in < 0 || fstat(in, &st) != 0) {
+        fprintf(stderr, "cp: %s: %s\n", source, strerror(errno));
+        if (in >= 0) close(in);
+        return 1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        close(in);
+        return execute(arglist, NULL); // Directory copies need -r anyway
+    }
+
+    // Copying into a directory keeps the source's base name
+    strbuf_t dest;
+    sb_init(&dest);
+    sb_append(&dest, arglist[i + 1]);
+    struct stat dest_st;
+    if (stat(dest.data, &dest_st) == 0 && S_ISDIR(dest_st.st_mode)) {
+        const char* base = strrchr(source, '/');
+        sb_putc(&dest, '/');
+        sb_append(&dest, base != NULL ? base + 1 : source);
+    }
+    if (stat(dest.data, &dest_st) == 0 && dest_st.st_dev == st.st_dev &&
+        dest_st.st_ino == st.st_ino) {
+        fprintf(stderr, "cp: '%s' and '%s' are the same file\n", source, dest.data);
+        close(in);
+        sb_free(&dest);
+        return 1;
+    }
+
+    int status = 0;
+    int out = open(dest.data, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+    if (out < 0) {
+        fprintf(stderr, "cp: %s: %s\n", dest.data, strerror(errno));
+        status = 1;
+    } else {
+        copy_stats_t stats = { "none", 0 };
+        double start = now();
+        if (copy_fd(in, out, &stats) != 0) {
+            fprintf(stderr, "cp: %s: %s\n", dest.data, strerror(errno));
+            status = 1;
+        }
+        if (close(out) != 0) status = 1;
+        if (verbose) report("cp", &stats, start);
+    }
+
+    close(in);
+    sb_free(&dest);
+    return status;
+}
+
+// Built-in command: tee [-a] [-V] [file...]
+int builtin_tee(char** arglist) {
+    int verbose = 0, append = 0;
+    int i = parse_copy_options(arglist, "aV", &verbose, &append);
+    if (i < 0) {
+        return execute(arglist, NULL);
+    }
+
+    int out[TEE_MAX_OUTPUTS];
+    int nout = 0;
+    int status = 0;
+    fflush(stage_stream());
+
+    for (; arglist[i] != NULL; i++) {
+        if (nout == TEE_MAX_OUTPUTS - 1) {
+            fprintf(stderr, "tee: too many files\n");
+            status = 1;
+            break;
+        }
+        // -a seeks to the end instead of using O_APPEND so splice() still works
+        int fd = open(arglist[i], O_WRONLY | O_CREAT | O_CLOEXEC | (append ? 0 : O_TRUNC), 0644);
+        if (fd < 0) {
+            fprintf(stderr, "tee: %s: %s\n", arglist[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (append) lseek(fd, 0, SEEK_END);
+        out[nout++] = fd;
+    }
+    out[nout++] = stage_out; // Last, so it consumes the input
+
+    copy_stats_t stats = { "none", 0 };
+    double start = now();
+    struct stat st;
+    int result = 1;
+    if (fstat(stage_in, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        result = tee_pipe(stage_in, out, nout, &stats);
+    }
+    if (result > 0) {
+        result = copy_buffered(stage_in, out, nout, &stats);
+    }
+    if (result != 0) {
+        if (errno != EPIPE) perror("tee");
+        status = 1;
+    }
+    if (verbose) report("tee", &stats, start);
+
+    for (int j = 0; j < nout - 1; j++) {
+        close(out[j]);
+    }
+    return status;
+}
@@ -1,20 +1,420 @@
 #include "shell.h"
 
-int execute(char* arglist[]) {
+#define ARG_HEADROOM 4096  // Bytes of argument space kept free, as xargs does
+
+extern char** environ;
+
+// Exit status of the last command ($?)
+int last_status = 0;
+
+char** command_assigns = NULL;
+
+// Convert a waitpid() status into a shell exit status
+int decode_status(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return 1;
+}
+
+int execute(char* arglist[], char** assigns) {
     int status;
-    int cpid = fork();
+    fflush(stage_stream());
+    int cpid = stats_fork();
+    uint64_t start = stats_clock();
 
     switch (cpid) {
         case -1:
             perror("fork failed");
             exit(1);
         case 0: // Child process
+            // Run from a pipeline stage thread: use its pipe ends
+            if (stage_in != STDIN_FILENO) dup2(stage_in, STDIN_FILENO);
+            if (stage_out != STDOUT_FILENO) dup2(stage_out, STDOUT_FILENO);
+            for (int i = 0; assigns != NULL && assigns[i] != NULL; i++) {
+                putenv(assigns[i]);
+            }
+            stats_count(STAT_EXECS);
             execvp(arglist[0], arglist);
             perror("Command not found"); // This line runs only if execvp fails
-            exit(1);
+            exit(127);
         default: // Parent process
-            waitpid(cpid, &status, 0);
-            // printf("Child pid:%d exited with status %d\n", cpid, status >> 8);
-            return 0;
+            stats_waitpid(cpid, &status, 0);
+            stats_record(STAT_RUN, start);
+            return decode_status(status);
+    }
+}
+
+// Run argv in a child that has already been forked, with assigns (or
+// NULL) added to its environment: functions and builtins in-process,
+// anything else through execvp. Does not return.
+void exec_in_child(char** argv, char** assigns) {
+    for (int i = 0; assigns != NULL && assigns[i] != NULL; i++) {
+        putenv(assigns[i]);
+    }
+    function_t* func = find_function(argv[0]);
+    if (func != NULL) {
+        exit(call_function(func, argv, assigns));
+    }
+    if (handle_builtin(argv)) {
+        exit(last_status);
+    }
+    stats_count(STAT_EXECS);
+    execvp(argv[0], argv);
+    perror("Command not found");
+    exit(127);
+}
+
+// Mark the simple commands after which a tree runs nothing more: the end
+// of a list, the right side of && and ||, the branches of if and case and
+// the body of a { group }. Commands in loops, pipelines, subshells and
+// background jobs never qualify. Only for a tree that is the last thing
+// the shell runs (script and -c modes).
+void mark_tail_commands(node_t* node) {
+    if (node == NULL || node->background) {
+        return;
+    }
+    switch (node->type) {
+        case NODE_COMMAND:
+            node->command.exec_tail = 1;
+            break;
+        case NODE_AND:
+        case NODE_OR:
+            mark_tail_commands(node->binary.right);
+            break;
+        case NODE_LIST:
+            if (node->list.count > 0) {
+                mark_tail_commands(node->list.items[node->list.count - 1]);
+            }
+            break;
+        case NODE_IF:
+            mark_tail_commands(node->if_block.then_part);
+            mark_tail_commands(node->if_block.else_part);
+            break;
+        case NODE_CASE:
+            for (int i = 0; i < node->case_block.num_arms; i++) {
+                mark_tail_commands(node->case_block.arms[i].body);
+            }
+            break;
+        case NODE_GROUP:
+            mark_tail_commands(node->body);
+            break;
+        default:
+            break;
+    }
+}
+
+// Bytes an argument occupies in the exec argument area
+static size_t arg_size(const char* arg) {
+    return strlen(arg) + 1 + sizeof(char*);
+}
+
+// Argument space available to argv: ARG_MAX minus the environment
+static size_t arg_space() {
+    long max = sysconf(_SC_ARG_MAX);
+    size_t space = max > 0 ? (size_t)max : 131072;
+    for (char** env = environ; *env != NULL; env++) {
+        space -= arg_size(*env);
+    }
+    return space > ARG_HEADROOM * 2 ? space - ARG_HEADROOM : ARG_HEADROOM;
+}
+
+// Run argv[0] with the first 'fixed' arguments repeated and the rest split
+// into the largest batches that fit in ARG_MAX. Up to 'jobs' batches run at
+// once. Returns the highest exit status of any batch.
+int execute_batched(char** argv, int fixed, int jobs, char** assigns) {
+    int argc = 0;
+    while (argv[argc] != NULL) argc++;
+    if (fixed > argc - 1) fixed = argc - 1;
+
+    size_t space = arg_space();
+    size_t fixed_size = 0;
+    for (int i = 0; i <= fixed; i++) {
+        fixed_size += arg_size(argv[i]);
+    }
+
+    // Batch argv: the fixed part followed by a slice of the rest
+    char** chunk = malloc((argc + 1) * sizeof(char*));
+    pid_t* running = malloc((jobs > 0 ? jobs : 1) * sizeof(pid_t));
+    if (chunk == NULL || running == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    memcpy(chunk, argv, (fixed + 1) * sizeof(char*));
+
+    int status = 0;
+    int head = 0, count = 0; // Ring of running batches, oldest at head
+    int next = fixed + 1;
+
+    fflush(stdout);
+    do {
+        int n = fixed + 1;
+        size_t size = fixed_size;
+        while (next < argc && (n == fixed + 1 || size + arg_size(argv[next]) <= space)) {
+            size += arg_size(argv[next]);
+            chunk[n++] = argv[next++];
+        }
+        chunk[n] = NULL;
+
+        // Wait for the oldest batch when all slots are busy
+        if (count == jobs) {
+            int wstatus;
+            stats_waitpid(running[head], &wstatus, 0);
+            int s = decode_status(wstatus);
+            if (s > status) status = s;
+            head = (head + 1) % jobs;
+            count--;
+        }
+
+        pid_t pid = stats_fork();
+        if (pid == 0) {
+            for (int i = 0; assigns != NULL && assigns[i] != NULL; i++) {
+                putenv(assigns[i]);
+            }
+            stats_count(STAT_EXECS);
+            execvp(chunk[0], chunk);
+            perror("Command not found");
+            exit(127);
+        } else if (pid < 0) {
+            perror("fork failed");
+            status = status > 1 ? status : 1;
+            break;
+        }
+        running[(head + count) % jobs] = pid;
+        count++;
+    } while (next < argc);
+
+    while (count > 0) {
+        int wstatus;
+        stats_waitpid(running[head], &wstatus, 0);
+        int s = decode_status(wstatus);
+        if (s > status) status = s;
+        head = (head + 1) % jobs;
+        count--;
+    }
+
+    free(running);
+    free(chunk);
+    return status;
+}
+
+// Expand a NAME=value word into a "NAME=value" string
+static char* expand_assignment(word_t* assign) {
+    char* equal_sign = strchr(assign->text, '=');
+    word_t value = { equal_sign + 1, assign->flags };
+
+    strbuf_t result;
+    sb_init(&result);
+    sb_appendn(&result, assign->text, equal_sign - assign->text + 1);
+    char* expanded = expand_word_string(&value);
+    sb_append(&result, expanded);
+    free(expanded);
+    return sb_release(&result);
+}
+
+// An expansion failed (expansion_error): the command is not run and its
+// status is 1. A non-interactive shell exits, and an in-process $(...)
+// ends like the subshell it stands for.
+int expansion_failed() {
+    expansion_error = 0;
+    if (substitution_exit != NULL) {
+        longjmp(*substitution_exit, 1 + 1 /* status 1, +1 for setjmp */);
+    }
+    if (!interactive) {
+        exit(1);
+    }
+    return last_status = 1;
+}
+
+// Run argv if it is a builtin, with the command's prefix assignments in
+// command_assigns. Returns 0 if it is not one.
+static int run_builtin(char** argv, char** assigns) {
+    char** outer = command_assigns;
+    command_assigns = assigns;
+    int found = handle_builtin(argv);
+    command_assigns = outer;
+    return found;
+}
+
+// Execute a simple command. Words are expanded here, at execution time.
+// When in_child is set we are already in a forked process and exec directly.
+int execute_command(command_t* cmd, int in_child) {
+    substitution_status = 0;
+    expansion_error = 0;
+    int mark = process_substitution_mark();
+    uint64_t start = stats_clock();
+    char** argv = expand_words(cmd->words, cmd->num_words);
+    stats_record(STAT_EXPAND, start);
+    char** assigns = NULL;
+    redir_undo_t undo;
+    int status = 0;
+    function_t* func;
+
+    // Without a command, assignments set shell variables in order;
+    // otherwise they only go into the environment of the command
+    if (cmd->num_assigns > 0 && argv[0] == NULL) {
+        for (int i = 0; i < cmd->num_assigns && !expansion_error; i++) {
+            if (assign_word(cmd->assigns[i].text, 1) != 0) {
+                substitution_status = 1;
+            }
+        }
+    } else if (cmd->num_assigns > 0) {
+        assigns = calloc(cmd->num_assigns + 1, sizeof(char*));
+        for (int i = 0; i < cmd->num_assigns; i++) {
+            assigns[i] = expand_assignment(&cmd->assigns[i]);
+        }
+    }
+
+    int keep_fds = argv[0] != NULL && argv[1] == NULL && strcmp(argv[0], "exec") == 0;
+    if (expansion_error) {
+        status = expansion_failed();
+    } else if (keep_fds) {
+        // exec with only redirections: they stay in effect for the shell
+        status = apply_redirections(cmd, NULL) != 0;
+    } else if (apply_redirections(cmd, in_child ? NULL : &undo) != 0) {
+        status = 1;
+    } else {
+        if (argv[0] == NULL) {
+            status = substitution_status; // Status of the last $(...), if any
+        } else if ((func = find_function(argv[0])) != NULL) {
+            status = call_function(func, argv, assigns); // Runs in-process, no fork
+        } else if (assigns != NULL && strcmp(argv[0], "exec") == 0) {
+            for (int i = 0; assigns[i] != NULL; i++) {
+                putenv(strdup(assigns[i])); // For the program exec runs
+            }
+            handle_builtin(argv);
+            status = last_status;
+        } else if (run_builtin(argv, assigns)) {
+            status = last_status;
+        } else if (in_child || (cmd->exec_tail && !has_jobs() && !server_session &&
+                                process_substitution_mark() == mark)) {
+            // Already forked, or nothing runs after this: exec in place
+            // (not in a server session, which must report the status)
+            fflush(stdout);
+            for (int i = 0; assigns != NULL && assigns[i] != NULL; i++) {
+                putenv(assigns[i]);
+            }
+            stats_count(STAT_EXECS);
+            execvp(argv[0], argv);
+            perror("Command not found");
+            exit(127);
+        } else {
+            status = execute(argv, assigns);
+        }
+        restore_redirections(in_child ? NULL : &undo);
+    }
+
+    // <(...) and >(...) live as long as the command that uses them
+    finish_process_substitutions(mark, !keep_fds);
+    free_argv(argv);
+    free_argv(assigns);
+    return status;
+}
+
+// Execute a node in the current redirection context
+static int run_node(node_t* node) {
+    int status = 0;
+
+    switch (node->type) {
+        case NODE_COMMAND:
+            status = execute_command(&node->command, 0);
+            break;
+        case NODE_PIPELINE:
+            status = execute_pipeline(&node->pipeline);
+            break;
+        case NODE_AND:
+            status = execute_node(node->binary.left);
+            if (status == 0 && !is_unwinding()) {
+                status = execute_node(node->binary.right);
+            }
+            break;
+        case NODE_OR:
+            status = execute_node(node->binary.left);
+            if (status != 0 && !is_unwinding()) {
+                status = execute_node(node->binary.right);
+            }
+            break;
+        case NODE_LIST:
+            for (int i = 0; i < node->list.count; i++) {
+                status = execute_node(node->list.items[i]);
+                if (is_unwinding()) {
+                    break; // Unwind to the enclosing loop or function
+                }
+            }
+            break;
+        case NODE_IF:
+            status = execute_if_block(&node->if_block);
+            break;
+        case NODE_WHILE:
+            status = execute_while_loop(&node->loop);
+            break;
+        case NODE_FOR:
+            status = execute_for_loop(&node->for_loop);
+            break;
+        case NODE_CASE:
+            status = execute_case_block(&node->case_block);
+            break;
+        case NODE_FUNCDEF:
+            define_function(node->function);
+            status = 0;
+            break;
+        case NODE_GROUP:
+            status = execute_node(node->body);
+            break;
+        case NODE_SUBSHELL: {
+            fflush(stdout);
+            pid_t pid = stats_fork();
+            if (pid == 0) {
+                exit(execute_node(node->body));
+            } else if (pid > 0) {
+                int wstatus;
+                stats_waitpid(pid, &wstatus, 0);
+                status = decode_status(wstatus);
+            } else {
+                perror("fork");
+                status = 1;
+            }
+            break;
+        }
+        case NODE_ARITH: {
+            long long value = 0;
+            int error = node->arith.expr != NULL
+                ? eval_arith(node->arith.expr, &value)
+                : arith_evaluate(node->arith.text, &value);
+            status = error ? expansion_failed() : value == 0;
+            break;
+        }
+    }
+
+    last_status = status;
+    return status;
+}
+
+// Execute an AST node and return its exit status
+int execute_node(node_t* node) {
+    if (node == NULL) {
+        return 0;
+    }
+
+    if (node->background) {
+        return last_status = execute_background(node);
+    }
+
+    if (node->redirect == NULL) {
+        return run_node(node);
+    }
+
+    // Redirections of a compound command cover its whole body
+    redir_undo_t undo;
+    int status;
+    if (apply_redirections(node->redirect, &undo) != 0) {
+        status = last_status = 1;
+    } else {
+        status = run_node(node);
+        restore_redirections(&undo);
     }
+    return status;
 }
@@ -0,0 +1,752 @@
+#include "shell.h"
+
+int expansion_error = 0;
+
+// Growable list of expanded fields (becomes a NULL-terminated argv)
+typedef struct {
+    char** items;
+    int count;
+    int capacity;
+    dir_cache_t* cache;  // Directory listings for pathname expansion, made on first use
+} field_list_t;
+
+// Append a field, taking ownership of the string
+static void add_field(field_list_t* fields, char* field) {
+    if (fields->count + 1 >= fields->capacity) {
+        fields->capacity = fields->capacity ? fields->capacity * 2 : 8;
+        fields->items = realloc(fields->items, fields->capacity * sizeof(char*));
+        if (fields->items == NULL) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    fields->items[fields->count++] = field;
+    fields->items[fields->count] = NULL;
+}
+
+// Expansion modes
+#define EXPAND_SPLIT 0x01    // Split unquoted expansions into fields
+#define EXPAND_PATTERN 0x02  // Escape quoted glob characters
+#define EXPAND_GLOB 0x04     // Pathname expansion of fields with unquoted wildcards
+
+static const char* read_parameter_name(const char* p, char* name);
+
+// Check if a character separates fields after an unquoted expansion
+static int is_ifs(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// Append text that came from a quoted context. In pattern mode glob
+// characters are escaped so they only match themselves.
+static void append_quoted(strbuf_t* sb, const char* text, size_t n, int mode) {
+    if (!(mode & (EXPAND_PATTERN | EXPAND_GLOB))) {
+        sb_appendn(sb, text, n);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (is_glob_char(text[i]) || text[i] == ']' || text[i] == '\\') {
+            sb_putc(sb, '\\');
+        }
+        sb_putc(sb, text[i]);
+    }
+}
+
+// Add the paths matching a pattern as fields. Returns 0 if nothing matches.
+static int add_pathnames(field_list_t* fields, const char* pattern) {
+    if (fields->cache == NULL) {
+        fields->cache = dir_cache_new();
+    }
+    char** matches;
+    int count = expand_pathname(pattern, fields->cache, &matches);
+    for (int i = 0; i < count; i++) {
+        add_field(fields, matches[i]);
+    }
+    free(matches);
+    return count;
+}
+
+// Remove the backslashes added by append_quoted(), in place
+static void remove_escapes(char* text) {
+    char* out = text;
+    for (char* p = text; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') p++;
+        *out++ = *p;
+    }
+    *out = '\0';
+}
+
+// Finish the current field. In glob mode a field with unquoted wildcards is
+// replaced by the matching paths; otherwise its escapes are removed.
+static void end_field(field_list_t* fields, strbuf_t* current, int mode, int* has_glob) {
+    char* field = sb_release(current);
+    if (mode & EXPAND_GLOB) {
+        if (*has_glob && add_pathnames(fields, field)) {
+            free(field);
+            *has_glob = 0;
+            return;
+        }
+        if (strchr(field, '\\') != NULL) {
+            remove_escapes(field);
+        }
+    }
+    *has_glob = 0;
+    add_field(fields, field);
+}
+
+// Split an unquoted expansion result on whitespace into fields
+static void split_value(field_list_t* fields, strbuf_t* current, const char* value, size_t len,
+                        int mode, int* have_field, int* has_glob) {
+    for (size_t i = 0; i < len; i++) {
+        char c = value[i];
+        if (is_ifs(c)) {
+            if (*have_field || current->len > 0) {
+                end_field(fields, current, mode, has_glob);
+                *have_field = 0;
+            }
+            continue;
+        }
+        if (mode & EXPAND_GLOB) {
+            if (c == '\\') sb_putc(current, '\\');
+            if (is_glob_char(c)) *has_glob = 1;
+        }
+        sb_putc(current, c);
+    }
+}
+
+// Match ${name[@]} or ${!name[@]} at p. Sets name and keys and returns the
+// end of the reference, or NULL if p is something else.
+static const char* array_all_ref(const char* p, char* name, int* keys) {
+    if (p[0] != '$' || p[1] != '{') return NULL;
+    const char* q = p + 2;
+    *keys = *q == '!';
+    if (*keys) q++;
+    q = read_parameter_name(q, name);
+    if (!is_valid_name(name) || strncmp(q, "[@]}", 4) != 0) return NULL;
+    return q + 4;
+}
+
+// Next element (or with keys set, subscript) of an array for field
+// expansion; a scalar is a one-element array. Returns NULL at the end.
+static const char* next_element(const char* name, int keys, long long* pos, char num[32]) {
+    array_t* a = get_array(name);
+    if (a == NULL) {
+        const char* value = get_variable(name);
+        if (*pos > 0 || value == NULL) return NULL;
+        (*pos)++;
+        return keys ? "0" : value;
+    }
+    long long index;
+    const char *key, *value;
+    if (!array_next(a, pos, &index, &key, &value)) return NULL;
+    if (!keys) return value;
+    if (key != NULL) return key;
+    snprintf(num, 32, "%lld", index);
+    return num;
+}
+
+// Expand one raw word: quote removal, $ expansion and (with EXPAND_SPLIT)
+// field splitting of unquoted expansion results
+static void expand_word_fields(const char* text, int mode, field_list_t* fields) {
+    strbuf_t current;
+    sb_init(&current);
+    int split = mode & EXPAND_SPLIT;
+    int have_field = 0; // Quotes produce a field even when empty
+    int quoted_at = 0;  // "$@" with no parameters produces no field
+    int has_glob = 0;   // Current field has an unquoted wildcard
+    char name[VAR_NAME_LEN];
+    char num[32];
+    const char* end;
+    int keys;
+
+    const char* p = text;
+    while (*p != '\0') {
+        if (*p == '\'') {
+            // Single quotes: everything literal
+            const char* end = strchr(p + 1, '\'');
+            if (end == NULL) end = p + strlen(p);
+            append_quoted(&current, p + 1, end - p - 1, mode);
+            p = *end ? end + 1 : end;
+            have_field = 1;
+        } else if (*p == '"') {
+            // Double quotes: $ expands, backslash escapes only a few characters
+            p++;
+            while (*p != '\0' && *p != '"') {
+                if (*p == '\\' && p[1] != '\0' && strchr("$`\"\\\n", p[1])) {
+                    if (p[1] != '\n') append_quoted(&current, p + 1, 1, mode);
+                    p += 2;
+                } else if (*p == '$' && split &&
+                           (strncmp(p, "$@", 2) == 0 || strncmp(p, "${@}", 4) == 0)) {
+                    // "$@": one field per positional parameter
+                    for (int i = 0; i < positional_count; i++) {
+                        if (i > 0) end_field(fields, &current, mode, &has_glob);
+                        append_quoted(&current, positional_args[i], strlen(positional_args[i]), mode);
+                    }
+                    quoted_at = positional_count == 0;
+                    p += p[1] == '@' ? 2 : 4;
+                } else if (*p == '$' && split && (end = array_all_ref(p, name, &keys)) != NULL) {
+                    // "${a[@]}": one field per element, straight from the array
+                    long long pos = 0;
+                    const char* item;
+                    int n = 0;
+                    while ((item = next_element(name, keys, &pos, num)) != NULL) {
+                        if (n++ > 0) end_field(fields, &current, mode, &has_glob);
+                        append_quoted(&current, item, strlen(item), mode);
+                    }
+                    quoted_at = n == 0;
+                    p = end;
+                } else if (*p == '$') {
+                    strbuf_t value;
+                    sb_init(&value);
+                    p = expand_dollar(p, &value);
+                    append_quoted(&current, value.data ? value.data : "", value.len, mode);
+                    sb_free(&value);
+                } else {
+                    // Plain run up to the next ", \ or $
+                    const char* run = scan_until(p + 1, SCAN_DQUOTE);
+                    append_quoted(&current, p, run - p, mode);
+                    p = run;
+                }
+            }
+            if (*p == '"') p++;
+            have_field = !quoted_at;
+        } else if (*p == '\\') {
+            if (p[1] == '\n') {
+                p += 2; // Line continuation
+            } else if (p[1] != '\0') {
+                append_quoted(&current, p + 1, 1, mode);
+                p += 2;
+                have_field = 1;
+            } else {
+                p++;
+            }
+        } else if (*p == '$' && split && (end = array_all_ref(p, name, &keys)) != NULL) {
+            // Unquoted ${a[@]}: each element is split on its own, never joined
+            long long pos = 0;
+            const char* item;
+            while ((item = next_element(name, keys, &pos, num)) != NULL) {
+                if (have_field || current.len > 0) {
+                    end_field(fields, &current, mode, &has_glob);
+                    have_field = 0;
+                }
+                split_value(fields, &current, item, strlen(item), mode, &have_field, &has_glob);
+            }
+            p = end;
+        } else if (*p == '$' && split) {
+            // Unquoted expansion: split the result on whitespace
+            strbuf_t value;
+            sb_init(&value);
+            p = expand_dollar(p, &value);
+            split_value(fields, &current, value.data, value.len, mode, &have_field, &has_glob);
+            sb_free(&value);
+        } else if (*p == '$') {
+            p = expand_dollar(p, &current);
+        } else if ((*p == '<' || *p == '>') && p[1] == '(') {
+            // Process substitution: the /dev/fd path is one literal field
+            const char* end = skip_balanced(p + 1, '(', ')');
+            if (end == NULL) end = p + strlen(p);
+            char* command = strndup(p + 2, end - p - 3);
+            process_substitution(command, *p == '>', &current);
+            free(command);
+            p = end;
+            have_field = 1;
+        } else {
+            // Plain run: only its first byte can be a glob character
+            const char* run = scan_until(p + 1, SCAN_EXPAND);
+            if (is_glob_char(*p)) has_glob = 1;
+            sb_appendn(&current, p, run - p);
+            p = run;
+        }
+    }
+
+    if (have_field || current.len > 0 || !split) {
+        end_field(fields, &current, mode, &has_glob);
+    } else {
+        sb_free(&current);
+    }
+}
+
+// Expand a list of words into a NULL-terminated argv for execution
+char** expand_words(word_t* words, int count) {
+    field_list_t fields = { NULL, 0, 0, NULL };
+
+    for (int i = 0; i < count; i++) {
+        int flags = words[i].flags;
+        if ((flags & WORD_ASSIGNMENT) && is_compound_assignment(words[i].text)) {
+            add_field(&fields, strdup(words[i].text)); // (list) is expanded on assignment
+        } else if (flags & WORD_ASSIGNMENT) {
+            expand_word_fields(words[i].text, 0, &fields);
+        } else if (!(flags & WORD_NEEDS_EXPANSION)) {
+            // Literal fast path; a bare pattern needs no quote handling
+            if (!(flags & WORD_HAS_GLOB) || !add_pathnames(&fields, words[i].text)) {
+                add_field(&fields, strdup(words[i].text));
+            }
+        } else {
+            expand_word_fields(words[i].text, EXPAND_SPLIT | EXPAND_GLOB, &fields);
+        }
+    }
+    dir_cache_free(fields.cache);
+
+    if (fields.items == NULL) {
+        add_field(&fields, NULL); // Allocate an empty argv
+        fields.count = 0;
+    }
+    return fields.items;
+}
+
+// Expand a word into a single string without field splitting
+// (assignment values and redirection targets)
+char* expand_word_string(word_t* word) {
+    if (!(word->flags & WORD_NEEDS_EXPANSION)) {
+        return strdup(word->text);
+    }
+
+    field_list_t fields = { NULL, 0, 0, NULL };
+    expand_word_fields(word->text, 0, &fields);
+    char* result = fields.items[0];
+    free(fields.items);
+    return result;
+}
+
+// Expand a word into a glob pattern: quoted characters are backslash-escaped
+// so that only unquoted wildcards are special
+char* expand_word_pattern(word_t* word) {
+    field_list_t fields = { NULL, 0, 0, NULL };
+    expand_word_fields(word->text, EXPAND_PATTERN, &fields);
+    char* result = fields.items[0];
+    free(fields.items);
+    return result;
+}
+
+// Expand raw operator text (the word in ${V:-word}) into a string
+static char* expand_text(const char* text) {
+    word_t word = { (char*)text, WORD_NEEDS_EXPANSION };
+    return expand_word_string(&word);
+}
+
+// Expand raw operator text into a pattern and compile it through the cache
+static glob_pattern_t* expand_pattern(const char* text) {
+    word_t word = { (char*)text, WORD_NEEDS_EXPANSION };
+    char* pattern = expand_word_pattern(&word);
+    glob_pattern_t* g = cached_glob(pattern);
+    free(pattern);
+    return g;
+}
+
+// Find an unquoted c in operator text, skipping quotes and nested $(...) / ${...}
+static const char* find_unquoted(const char* s, char c) {
+    while (*s != '\0') {
+        if (*s == c) {
+            return s;
+        }
+        if (*s == '\\' && s[1] != '\0') {
+            s += 2;
+        } else if (*s == '\'' || *s == '"') {
+            const char* end = strchr(s + 1, *s);
+            s = end != NULL ? end + 1 : s + strlen(s);
+        } else if (*s == '$' && (s[1] == '(' || s[1] == '{')) {
+            const char* end = skip_balanced(s + 1, s[1], s[1] == '(' ? ')' : '}');
+            s = end != NULL ? end : s + strlen(s);
+        } else {
+            s++;
+        }
+    }
+    return NULL;
+}
+
+// Read the parameter name at the start of ${...} into name.
+// Returns a pointer to the operator that follows it.
+static const char* read_parameter_name(const char* p, char* name) {
+    int len = 0;
+    if (*p != '\0' && strchr("?$#@*", *p) != NULL) {
+        name[len++] = *p++;
+    } else if (*p >= '0' && *p <= '9') {
+        while (*p >= '0' && *p <= '9') {
+            if (len < VAR_NAME_LEN - 1) name[len++] = *p;
+            p++;
+        }
+    } else {
+        while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+               (*p >= '0' && *p <= '9') || *p == '_') {
+            if (len < VAR_NAME_LEN - 1) name[len++] = *p;
+            p++;
+        }
+    }
+    name[len] = '\0';
+    return p;
+}
+
+// ${V#pat} ${V##pat} ${V%pat} ${V%%pat}: remove a matching prefix or suffix
+static void append_trimmed(const char* value, const glob_pattern_t* g, char op,
+                           int longest, strbuf_t* out) {
+    size_t len = strlen(value);
+
+    if (op == '#') {
+        int n = glob_match_prefix(g, value, longest);
+        if (n < 0) n = 0;
+        sb_appendn(out, value + n, len - n);
+        return;
+    }
+
+    // Suffix: try start positions from the end (shortest) or the front (longest)
+    size_t cut = len;
+    for (size_t i = 0; i <= len; i++) {
+        size_t start = longest ? i : len - i;
+        if (glob_match(g, value + start)) {
+            cut = start;
+            break;
+        }
+    }
+    sb_appendn(out, value, cut);
+}
+
+// ${V/pat/rep} ${V//pat/rep} ${V/#pat/rep} ${V/%pat/rep}
+static void append_replaced(const char* value, const glob_pattern_t* g, char mode,
+                            const char* rep, strbuf_t* out) {
+    size_t len = strlen(value);
+
+    if (mode == '#') {
+        int n = glob_match_prefix(g, value, 1);
+        if (n >= 0) sb_append(out, rep);
+        sb_append(out, value + (n > 0 ? n : 0));
+        return;
+    }
+    if (mode == '%') {
+        for (size_t i = 0; i <= len; i++) {
+            if (glob_match(g, value + i)) {
+                sb_appendn(out, value, i);
+                sb_append(out, rep);
+                return;
+            }
+        }
+        sb_append(out, value);
+        return;
+    }
+
+    int all = mode == '/';
+    const char* p = value;
+
+    if (!g->has_wildcards) {
+        // Literal pattern: slice around strstr() matches
+        size_t n = strlen(g->literal);
+        const char* match;
+        while (n > 0 && (match = strstr(p, g->literal)) != NULL) {
+            sb_appendn(out, p, match - p);
+            sb_append(out, rep);
+            p = match + n;
+            if (!all) break;
+        }
+        sb_append(out, p);
+        return;
+    }
+
+    while (*p != '\0') {
+        int n = glob_match_prefix(g, p, 1);
+        if (n > 0) {
+            sb_append(out, rep);
+            p += n;
+            if (!all) break;
+        } else {
+            sb_putc(out, *p++);
+        }
+    }
+    sb_append(out, p);
+}
+
+// ${V:off} ${V:off:len}; offsets are arithmetic expressions
+static void append_substring(const char* value, long long off, int has_count,
+                             long long count, strbuf_t* out) {
+    long long len = (long long)strlen(value);
+    if (off < 0) off += len;
+    if (off < 0 || off > len) return;
+
+    long long end = len;
+    if (has_count) {
+        end = count < 0 ? len + count : off + count;
+        if (end > len) end = len;
+        if (end < off) {
+            if (count < 0) fprintf(stderr, "%lld: substring expression < 0\n", count);
+            return;
+        }
+    }
+    sb_appendn(out, value + off, end - off);
+}
+
+// Look up one element of an array reference: a key of an associative
+// array, or an arithmetic index. A scalar is element 0.
+static const char* subscript_value(const char* name, const char* sub, int* error) {
+    array_t* a = get_array(name);
+    if (a != NULL && array_is_assoc(a)) {
+        char* key = expand_text(sub);
+        const char* value = array_get_key(a, key);
+        free(key);
+        return value;
+    }
+    long long index;
+    if (arith_evaluate(sub, &index) != 0) {
+        *error = expansion_error = 1;
+        return NULL;
+    }
+    if (a != NULL) {
+        return array_get_index(a, index);
+    }
+    return index == 0 || index == -1 ? get_variable(name) : NULL;
+}
+
+// Append every element (or with keys set, every subscript) of an array,
+// separated by spaces. A scalar is a one-element array.
+static void append_all_elements(const char* name, int keys, strbuf_t* out) {
+    array_t* a = get_array(name);
+    if (a == NULL) {
+        const char* value = get_variable(name);
+        if (value != NULL) sb_append(out, keys ? "0" : value);
+        return;
+    }
+    long long pos = 0, index;
+    const char *key, *value;
+    for (int n = 0; array_next(a, &pos, &index, &key, &value); n++) {
+        if (n > 0) sb_putc(out, ' ');
+        if (!keys) {
+            sb_append(out, value);
+        } else if (key != NULL) {
+            sb_append(out, key);
+        } else {
+            char num[32];
+            snprintf(num, sizeof(num), "%lld", index);
+            sb_append(out, num);
+        }
+    }
+}
+
+// Report a malformed ${...}; the command it belongs to fails
+static void bad_substitution(const char* inner) {
+    fprintf(stderr, "${%s}: bad substitution\n", inner);
+    expansion_error = 1;
+}
+
+// Expand an array reference: ${a[sub]}, ${a[@]}, ${#a[@]}, ${#a[sub]} or
+// ${!a[@]}. bracket points at the '[' after the name.
+static void expand_subscript(const char* inner, const char* name, const char* bracket, strbuf_t* out) {
+    const char* close = find_unquoted(bracket + 1, ']');
+    if (close == NULL || close[1] != '\0') {
+        bad_substitution(inner);
+        return;
+    }
+    int all = close - bracket == 2 && (bracket[1] == '@' || bracket[1] == '*');
+    char num[32];
+
+    if (inner[0] == '!') {
+        if (!all) {
+            bad_substitution(inner);
+            return;
+        }
+        append_all_elements(name, 1, out);
+    } else if (inner[0] == '#' && all) {
+        array_t* a = get_array(name);
+        long long count = a != NULL ? array_count(a) : get_variable(name) != NULL;
+        snprintf(num, sizeof(num), "%lld", count);
+        sb_append(out, num);
+    } else if (all) {
+        append_all_elements(name, 0, out);
+    } else {
+        char* sub = strndup(bracket + 1, close - bracket - 1);
+        int error = 0;
+        const char* value = subscript_value(name, sub, &error);
+        free(sub);
+        if (error) return;
+        if (inner[0] == '#') {
+            snprintf(num, sizeof(num), "%zu", value != NULL ? strlen(value) : 0);
+            sb_append(out, num);
+        } else {
+            sb_append(out, value);
+        }
+    }
+}
+
+// Expand the inside of ${...}: a parameter with an optional operator.
+// Operands are expanded first; the value is then sliced without copying.
+void expand_braced(const char* inner, strbuf_t* out) {
+    char name[VAR_NAME_LEN];
+    strbuf_t special;
+    sb_init(&special);
+
+    // Arrays: ${a[i]}, ${a[@]}, ${#a[@]}, ${!a[@]}
+    int prefixed = inner[0] == '#' || inner[0] == '!';
+    const char* bracket = read_parameter_name(prefixed ? inner + 1 : inner, name);
+    if (*bracket == '[' && name[0] != '\0') {
+        expand_subscript(inner, name, bracket, out);
+        return;
+    }
+
+    // ${#V}: length of the value
+    if (inner[0] == '#' && inner[1] != '\0') {
+        if (*read_parameter_name(inner + 1, name) != '\0' || name[0] == '\0') {
+            bad_substitution(inner);
+            return;
+        }
+        append_parameter(name, &special);
+        char num[32];
+        snprintf(num, sizeof(num), "%zu", special.len);
+        sb_append(out, num);
+        sb_free(&special);
+        return;
+    }
+
+    const char* op = read_parameter_name(inner, name);
+    if (name[0] == '\0') {
+        bad_substitution(inner);
+        return;
+    }
+    if (*op == '\0') {
+        append_parameter(name, out);
+        return;
+    }
+
+    int colon = op[0] == ':' && op[1] != '\0' && strchr("-=+", op[1]) != NULL;
+    if (colon) op++;
+
+    // Operands: expanded before the value is looked up, since expanding
+    // them can run commands that change variables
+    char* word = NULL;
+    glob_pattern_t* g = NULL;
+    long long off = 0, count = 0;
+    int has_count = 0;
+    char mode = 0;
+
+    switch (*op) {
+        case '-':
+        case '=':
+        case '+':
+            break;
+        case '#':
+        case '%': {
+            int longest = op[1] == op[0];
+            g = expand_pattern(op + 1 + longest);
+            mode = longest;
+            break;
+        }
+        case '/': {
+            const char* p = op + 1;
+            if (*p == '/' || *p == '#' || *p == '%') mode = *p++;
+            const char* slash = find_unquoted(p, '/');
+            char* pattern = slash ? strndup(p, slash - p) : strdup(p);
+            word = slash ? expand_text(slash + 1) : strdup("");
+            g = expand_pattern(pattern);
+            free(pattern);
+            break;
+        }
+        case ':': {
+            const char* colon2 = find_unquoted(op + 1, ':');
+            char* expr = colon2 ? strndup(op + 1, colon2 - op - 1) : strdup(op + 1);
+            int error = arith_evaluate(expr, &off);
+            free(expr);
+            if (!error && colon2 != NULL) {
+                has_count = 1;
+                error = arith_evaluate(colon2 + 1, &count);
+            }
+            if (error) {
+                expansion_error = 1;
+                return;
+            }
+            break;
+        }
+        default:
+            bad_substitution(inner);
+            return;
+    }
+
+    // The value: variables are used in place, special parameters are formatted
+    const char* value;
+    if (is_valid_name(name)) {
+        value = get_variable(name);
+    } else {
+        append_parameter(name, &special);
+        value = special.data;
+    }
+    if (value == NULL) value = "";
+
+    switch (*op) {
+        case '-':
+        case '=':
+        case '+': {
+            int use_value = parameter_is_set(name) && !(colon && *value == '\0');
+            if (*op == '+') {
+                if (use_value) {
+                    word = expand_text(op + 1);
+                    sb_append(out, word);
+                }
+            } else if (use_value) {
+                sb_append(out, value);
+            } else {
+                word = expand_text(op + 1);
+                if (*op == '=') {
+                    if (is_valid_name(name)) {
+                        set_variable(name, word);
+                    } else {
+                        fprintf(stderr, "$%s: cannot assign in this way\n", name);
+                    }
+                }
+                sb_append(out, word);
+            }
+            break;
+        }
+        case '#':
+        case '%':
+            append_trimmed(value, g, *op, mode, out);
+            break;
+        case '/':
+            append_replaced(value, g, mode, word, out);
+            break;
+        case ':':
+            append_substring(value, off, has_count, count, out);
+            break;
+    }
+
+    free(word);
+    sb_free(&special);
+}
+
+// Expand the text fed to stdin by a here-document or here-string. In a
+// here-document only $ and backslash before $ ` \ or newline are special.
+char* expand_here_doc(here_doc_t* here_doc) {
+    if (here_doc->here_string) {
+        strbuf_t sb;
+        sb_init(&sb);
+        char* text = expand_word_string(&here_doc->body);
+        sb_append(&sb, text);
+        sb_putc(&sb, '\n');
+        free(text);
+        return sb_release(&sb);
+    }
+
+    if (!(here_doc->body.flags & WORD_NEEDS_EXPANSION)) {
+        return strdup(here_doc->body.text); // Literal body, prepared at parse time
+    }
+
+    strbuf_t sb;
+    sb_init(&sb);
+    const char* p = here_doc->body.text;
+    while (*p != '\0') {
+        if (*p == '\\' && p[1] == '\n') {
+            p += 2;
+        } else if (*p == '\\' && p[1] != '\0' && strchr("$`\\", p[1])) {
+            sb_putc(&sb, p[1]);
+            p += 2;
+        } else if (*p == '$') {
+            p = expand_dollar(p, &sb);
+        } else {
+            const char* run = scan_until(p + 1, SCAN_HEREDOC);
+            sb_appendn(&sb, p, run - p);
+            p = run;
+        }
+    }
+    return sb_release(&sb);
+}
+
+// Free an argv returned by expand_words()
+void free_argv(char** argv) {
+    if (argv == NULL) return;
+    for (int i = 0; argv[i] != NULL; i++) {
+        free(argv[i]);
+    }
+    free(argv);
+}
@@ -0,0 +1,272 @@
+#include "shell.h"
+
+#define FUNCTION_TABLE_SIZE 128
+
+// Function registry: hash table of parsed function bodies
+static function_t* function_table[FUNCTION_TABLE_SIZE];
+
+// Function call nesting and pending return
+int function_depth = 0;
+int return_pending = 0;
+
+// Definition a name had before the first change to it inside an
+// in-process subshell
+typedef struct saved_function {
+    char* name;
+    function_t* func;             // A reference; NULL if it was undefined
+    struct saved_function* next;
+} saved_function_t;
+
+struct function_snapshot {
+    saved_function_t* journal;
+    struct function_snapshot* outer;
+};
+
+static function_snapshot_t* snapshot = NULL;
+
+// Bucket index of a function name
+static unsigned int hash_name(const char* name) {
+    return hash_string(name) % FUNCTION_TABLE_SIZE;
+}
+
+// Parse 'name() compound-command' or 'function name [()] compound-command'
+node_t* parse_function_def(parser_t* p) {
+    int keyword = accept_keyword(p, "function");
+
+    token_t* tok = peek_token(p);
+    if (tok->type != TOK_WORD || strpbrk(tok->text, "$'\"\\") != NULL) {
+        syntax_error(p, tok, "function name");
+        return NULL;
+    }
+    char* name = tok->text;
+    p->pos++;
+
+    if (peek_token(p)->type == TOK_LPAREN) {
+        p->pos++;
+        if (peek_token(p)->type != TOK_RPAREN) {
+            syntax_error(p, peek_token(p), ")");
+            return NULL;
+        }
+        p->pos++;
+    } else if (!keyword) {
+        syntax_error(p, peek_token(p), "(");
+        return NULL;
+    }
+
+    // The body is parsed here once and shared by every call
+    skip_newlines(p);
+    node_t* body = parse_command(p);
+    if (body == NULL) {
+        return NULL;
+    }
+    if (body->type == NODE_COMMAND || body->type == NODE_FUNCDEF) {
+        fprintf(stderr, "Syntax error: function body must be a compound command\n");
+        p->error = 1;
+        free_node(body);
+        return NULL;
+    }
+
+    node_t* node = new_node(NODE_FUNCDEF);
+    node->function = new_function(name, body);
+    return node;
+}
+
+// Create a function owned by its definition node
+function_t* new_function(const char* name, node_t* body) {
+    function_t* func = malloc(sizeof(function_t));
+    if (func == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    func->name = strdup(name);
+    func->body = body;
+    func->refs = 1; // Owned by the definition node
+    func->next = NULL;
+    return func;
+}
+
+// Take a function out of the registry; returns it with the registry's
+// reference, or NULL if name is not defined
+static function_t* unlink_function(const char* name) {
+    function_t** link = &function_table[hash_name(name)];
+    while (*link != NULL) {
+        if (strcmp((*link)->name, name) == 0) {
+            function_t* old = *link;
+            *link = old->next;
+            return old;
+        }
+        link = &(*link)->next;
+    }
+    return NULL;
+}
+
+// Put a function into the registry, which takes over one reference
+static void insert_function(function_t* func) {
+    unsigned int bucket = hash_name(func->name);
+    func->next = function_table[bucket];
+    function_table[bucket] = func;
+}
+
+// Remember a name's definition before the first change to it inside an
+// in-process subshell
+static void journal_function(const char* name) {
+    if (snapshot == NULL) return;
+    for (saved_function_t* s = snapshot->journal; s != NULL; s = s->next) {
+        if (strcmp(s->name, name) == 0) {
+            return;
+        }
+    }
+    saved_function_t* saved = malloc(sizeof(saved_function_t));
+    if (saved == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    saved->name = strdup(name);
+    saved->func = find_function(name);
+    if (saved->func != NULL) saved->func->refs++;
+    saved->next = snapshot->journal;
+    snapshot->journal = saved;
+}
+
+// Add a function to the registry, replacing any previous definition
+void define_function(function_t* func) {
+    journal_function(func->name);
+    release_function(unlink_function(func->name));
+    func->refs++;
+    insert_function(func);
+}
+
+// Start recording definitions so restore_functions() can undo them
+function_snapshot_t* save_functions() {
+    function_snapshot_t* snap = malloc(sizeof(function_snapshot_t));
+    if (snap == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    snap->journal = NULL;
+    snap->outer = snapshot;
+    snapshot = snap;
+    return snap;
+}
+
+// Put back the definitions replaced since save_functions()
+void restore_functions(function_snapshot_t* snap) {
+    // Not journaled again, as in restore_variables()
+    snapshot = NULL;
+    while (snap->journal != NULL) {
+        saved_function_t* saved = snap->journal;
+        snap->journal = saved->next;
+        release_function(unlink_function(saved->name));
+        if (saved->func != NULL) {
+            insert_function(saved->func); // The saved reference goes back
+        }
+        free(saved->name);
+        free(saved);
+    }
+    snapshot = snap->outer;
+    free(snap);
+}
+
+// Add every function to a startup image: the bodies go into blob as tree
+// records, and table gets the count, then each name and the offset of its
+// body, as NUL-terminated strings
+void dump_functions(strbuf_t* blob, strbuf_t* table) {
+    int count = 0;
+    strbuf_t entries;
+    sb_init(&entries);
+    for (int i = 0; i < FUNCTION_TABLE_SIZE; i++) {
+        for (function_t* func = function_table[i]; func != NULL; func = func->next) {
+            char offset[16];
+            snprintf(offset, sizeof(offset), "%u", encode_tree(blob, func->body));
+            sb_appendn(&entries, func->name, strlen(func->name) + 1);
+            sb_appendn(&entries, offset, strlen(offset) + 1);
+            count++;
+        }
+    }
+    char num[16];
+    snprintf(num, sizeof(num), "%d", count);
+    sb_appendn(table, num, strlen(num) + 1);
+    sb_appendn(table, entries.data, entries.len);
+    sb_free(&entries);
+}
+
+// Define the functions of a startup image written by dump_functions();
+// *p walks the table, whose body records are in data (size bytes, from
+// 'start' on). Returns -1 if the data is damaged.
+int load_functions(const char** p, const char* end, const char* data, size_t size, size_t start) {
+    const char* num = image_string(p, end);
+    if (num == NULL) return -1;
+    for (long n = atol(num); n > 0; n--) {
+        const char* name = image_string(p, end);
+        const char* offset = image_string(p, end);
+        node_t* body;
+        if (offset == NULL || decode_tree(data, size, start, strtoul(offset, NULL, 10), &body) != 0) {
+            return -1;
+        }
+        if (body == NULL) return -1;
+        function_t* func = new_function(name, body);
+        define_function(func);
+        release_function(func); // Owned by the table alone
+    }
+    return 0;
+}
+
+// Look up a function by name
+function_t* find_function(const char* name) {
+    for (function_t* func = function_table[hash_name(name)]; func != NULL; func = func->next) {
+        if (strcmp(func->name, name) == 0) {
+            return func;
+        }
+    }
+    return NULL;
+}
+
+// Drop one reference to a function, freeing it with the last one
+void release_function(function_t* func) {
+    if (func == NULL || --func->refs > 0) {
+        return;
+    }
+    free_node(func->body);
+    free(func->name);
+    free(func);
+}
+
+// Call a function in the current process with argv[1..] as $1..$N.
+// assigns (NAME=value strings, or NULL) are the call's prefix assignments:
+// they act as locals of the call, so the old values come back afterwards.
+int call_function(function_t* func, char** argv, char** assigns) {
+    char** saved_args = positional_args;
+    int saved_count = positional_count;
+    int saved_loop_depth = loop_depth;
+
+    int argc = 0;
+    while (argv[argc] != NULL) argc++;
+
+    positional_args = argv + 1;
+    positional_count = argc - 1;
+    loop_depth = 0; // break / continue do not cross function boundaries
+
+    // Hold a reference so redefining the function while it runs is safe
+    func->refs++;
+    function_depth++;
+    push_scope();
+    for (int i = 0; assigns != NULL && assigns[i] != NULL; i++) {
+        const char* equal = strchr(assigns[i], '=');
+        char* name = strndup(assigns[i], equal - assigns[i]);
+        make_local(name);
+        set_variable(name, equal + 1);
+        free(name);
+    }
+
+    int status = execute_node(func->body);
+    return_pending = 0;
+
+    pop_scope();
+    function_depth--;
+    release_function(func);
+
+    loop_depth = saved_loop_depth;
+    positional_args = saved_args;
+    positional_count = saved_count;
+    return status;
+}
@@ -0,0 +1,262 @@
+#include "shell.h"
+
+#define GLOB_CACHE_SIZE 256   // Hash buckets for patterns compiled at run time
+#define GLOB_CACHE_MAX 1024   // Entries kept before the cache is flushed
+
+// Cache of patterns that are only known after expansion
+typedef struct glob_cache_entry {
+    char* pattern;
+    glob_pattern_t* glob;
+    struct glob_cache_entry* next;
+} glob_cache_entry_t;
+
+static glob_cache_entry_t* glob_cache[GLOB_CACHE_SIZE];
+static int glob_cache_count = 0;
+
+// Check if a character has special meaning in a pattern
+int is_glob_char(char c) {
+    return c == '*' || c == '?' || c == '[';
+}
+
+// Append an element to a compiled pattern
+static glob_elem_t* add_elem(glob_pattern_t* g, glob_op_t op) {
+    g->elems = realloc(g->elems, (g->count + 1) * sizeof(glob_elem_t));
+    if (g->elems == NULL) {
+        perror("realloc failed");
+        exit(1);
+    }
+    glob_elem_t* elem = &g->elems[g->count++];
+    memset(elem, 0, sizeof(glob_elem_t));
+    elem->op = op;
+    return elem;
+}
+
+// Compile a [...] bracket expression at p. Returns the end of the
+// expression, or NULL if it is not closed (then '[' is a literal).
+static const char* compile_class(const char* p, glob_elem_t* elem) {
+    const char* q = p + 1;
+    int negate = 0;
+    if (*q == '!' || *q == '^') {
+        negate = 1;
+        q++;
+    }
+
+    int first = 1;
+    while (*q != '\0' && (*q != ']' || first)) {
+        unsigned char lo = (unsigned char)*q;
+        if (*q == '\\' && q[1] != '\0') {
+            lo = (unsigned char)*++q;
+        }
+        unsigned char hi = lo;
+        if (q[1] == '-' && q[2] != ']' && q[2] != '\0') {
+            q += 2;
+            hi = (unsigned char)*q;
+            if (*q == '\\' && q[1] != '\0') {
+                hi = (unsigned char)*++q;
+            }
+        }
+        for (int c = lo; c <= hi; c++) {
+            elem->set[c >> 3] |= 1 << (c & 7);
+        }
+        q++;
+        first = 0;
+    }
+    if (*q != ']') {
+        return NULL;
+    }
+
+    if (negate) {
+        for (int i = 0; i < 32; i++) {
+            elem->set[i] = ~elem->set[i];
+        }
+    }
+    return q + 1;
+}
+
+// Compile a pattern into a flat element list. In the pattern, a backslash
+// makes the next character literal (quoted text is passed in that form).
+glob_pattern_t* compile_glob(const char* pattern) {
+    glob_pattern_t* g = calloc(1, sizeof(glob_pattern_t));
+    if (g == NULL) {
+        perror("calloc failed");
+        exit(1);
+    }
+
+    strbuf_t literal;
+    sb_init(&literal);
+
+    const char* p = pattern;
+    while (*p != '\0') {
+        if (*p == '\\' && p[1] != '\0') {
+            add_elem(g, GLOB_CHAR)->ch = (unsigned char)p[1];
+            sb_putc(&literal, p[1]);
+            p += 2;
+        } else if (*p == '*') {
+            // Collapse runs of stars
+            if (g->count == 0 || g->elems[g->count - 1].op != GLOB_STAR) {
+                add_elem(g, GLOB_STAR);
+            }
+            g->has_wildcards = 1;
+            p++;
+        } else if (*p == '?') {
+            add_elem(g, GLOB_ANY);
+            g->has_wildcards = 1;
+            p++;
+        } else if (*p == '[') {
+            glob_elem_t elem;
+            memset(&elem, 0, sizeof(elem));
+            const char* end = compile_class(p, &elem);
+            if (end != NULL) {
+                elem.op = GLOB_CLASS;
+                *add_elem(g, GLOB_CLASS) = elem;
+                g->has_wildcards = 1;
+                p = end;
+            } else {
+                add_elem(g, GLOB_CHAR)->ch = '[';
+                sb_putc(&literal, '[');
+                p++;
+            }
+        } else {
+            add_elem(g, GLOB_CHAR)->ch = (unsigned char)*p;
+            sb_putc(&literal, *p);
+            p++;
+        }
+    }
+
+    g->literal = sb_release(&literal);
+    return g;
+}
+
+// Free a compiled pattern
+void free_glob(glob_pattern_t* g) {
+    if (g == NULL) return;
+    free(g->elems);
+    free(g->literal);
+    free(g);
+}
+
+// Check if element i accepts character c
+static int elem_accepts(const glob_elem_t* elem, unsigned char c) {
+    switch (elem->op) {
+        case GLOB_CHAR:  return elem->ch == c;
+        case GLOB_ANY:   return 1;
+        case GLOB_CLASS: return (elem->set[c >> 3] >> (c & 7)) & 1;
+        case GLOB_STAR:  return 1;
+    }
+    return 0;
+}
+
+// Add state i (and the states reachable through stars) to a state set
+static void add_state(const glob_pattern_t* g, unsigned char* states, int i) {
+    while (!states[i]) {
+        states[i] = 1;
+        if (i < g->count && g->elems[i].op == GLOB_STAR) {
+            i++; // A star may match nothing
+        } else {
+            break;
+        }
+    }
+}
+
+// Run the pattern over str as a set of states (no backtracking, O(n*m)).
+// With prefix set, returns the shortest or longest matching prefix length;
+// otherwise returns the full length on a match. Returns -1 if nothing matches.
+static int run_glob(const glob_pattern_t* g, const char* str, int prefix, int longest) {
+    unsigned char small[2][64];
+    unsigned char* current = small[0];
+    unsigned char* next = small[1];
+    unsigned char* heap = NULL;
+
+    if (g->count + 1 > (int)sizeof(small[0])) {
+        heap = malloc(2 * (g->count + 1));
+        if (heap == NULL) return -1;
+        current = heap;
+        next = heap + g->count + 1;
+    }
+
+    memset(current, 0, g->count + 1);
+    add_state(g, current, 0);
+
+    int result = -1;
+    size_t len = strlen(str);
+
+    for (size_t pos = 0; ; pos++) {
+        if (current[g->count]) {
+            if (prefix) {
+                result = (int)pos;
+                if (!longest) break;
+            } else if (pos == len) {
+                result = (int)pos;
+            }
+        }
+        if (pos == len) break;
+
+        memset(next, 0, g->count + 1);
+        int alive = 0;
+        unsigned char c = (unsigned char)str[pos];
+        for (int i = 0; i < g->count; i++) {
+            if (current[i] && elem_accepts(&g->elems[i], c)) {
+                add_state(g, next, g->elems[i].op == GLOB_STAR ? i : i + 1);
+                alive = 1;
+            }
+        }
+        if (!alive) break;
+
+        unsigned char* tmp = current;
+        current = next;
+        next = tmp;
+    }
+
+    free(heap);
+    return result;
+}
+
+// Check if a whole string matches a compiled pattern
+int glob_match(const glob_pattern_t* g, const char* str) {
+    if (!g->has_wildcards) {
+        return strcmp(g->literal, str) == 0; // Literal fast path
+    }
+    return run_glob(g, str, 0, 0) >= 0;
+}
+
+// Length of the shortest (or longest) prefix of str matching the pattern, or -1
+int glob_match_prefix(const glob_pattern_t* g, const char* str, int longest) {
+    return run_glob(g, str, 1, longest);
+}
+
+// Compile a pattern through the cache. The result is owned by the cache and
+// stays valid until the next call.
+glob_pattern_t* cached_glob(const char* pattern) {
+    unsigned int bucket = hash_string(pattern) % GLOB_CACHE_SIZE;
+    for (glob_cache_entry_t* e = glob_cache[bucket]; e != NULL; e = e->next) {
+        if (strcmp(e->pattern, pattern) == 0) {
+            return e->glob;
+        }
+    }
+
+    // Flush everything when full; loops reuse a small working set
+    if (glob_cache_count >= GLOB_CACHE_MAX) {
+        for (int i = 0; i < GLOB_CACHE_SIZE; i++) {
+            while (glob_cache[i] != NULL) {
+                glob_cache_entry_t* next = glob_cache[i]->next;
+                free_glob(glob_cache[i]->glob);
+                free(glob_cache[i]->pattern);
+                free(glob_cache[i]);
+                glob_cache[i] = next;
+            }
+        }
+        glob_cache_count = 0;
+    }
+
+    glob_cache_entry_t* e = malloc(sizeof(glob_cache_entry_t));
+    if (e == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    e->pattern = strdup(pattern);
+    e->glob = compile_glob(pattern);
+    e->next = glob_cache[bucket];
+    glob_cache[bucket] = e;
+    glob_cache_count++;
+    return e->glob;
+}
@@ -70,6 +70,16 @@ void update_jobs() {
     }
 }
 
+// Check if any background job is still listed
+int has_jobs() {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].pid != -1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 // Print all active jobs
 void print_jobs() {
     int found = 0;
@@ -100,44 +110,24 @@ void cleanup_zombies() {
 }
 
 // Execute a command in background
-int execute_background(command_t* cmd) {
-    if (cmd == NULL || cmd->args[0] == NULL) {
+int execute_background(node_t* node) {
+    if (node == NULL) {
         return -1;
     }
 
-    // Build command string for job tracking
-    char cmd_str[MAX_LEN] = "";
-    for (int i = 0; cmd->args[i] != NULL; i++) {
-        if (i > 0) strcat(cmd_str, " ");
-        strcat(cmd_str, cmd->args[i]);
-    }
-
-    pid_t pid = fork();
+    fflush(stdout);
+    pid_t pid = stats_fork();
     
     if (pid == 0) {
-        // Child process - set up redirection if needed
-        if (cmd->input_file != NULL) {
-            int input_fd = open(cmd->input_file, O_RDONLY);
-            if (input_fd >= 0) {
-                dup2(input_fd, STDIN_FILENO);
-                close(input_fd);
-            }
-        }
-        if (cmd->output_file != NULL) {
-            int output_fd = open(cmd->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (output_fd >= 0) {
-                dup2(output_fd, STDOUT_FILENO);
-                close(output_fd);
-            }
+        // Child process - run the node in the foreground of this process
+        node->background = 0;
+        if (node->type == NODE_COMMAND) {
+            exit(execute_command(&node->command, 1));
         }
-        
-        // Execute the command
-        execvp(cmd->args[0], cmd->args);
-        perror("execvp");
-        exit(1);
+        exit(execute_node(node));
     } else if (pid > 0) {
         // Parent process - add to job list
-        add_job(pid, cmd_str);
+        add_job(pid, node->source ? node->source : "");
         return 0;
     } else {
         perror("fork");
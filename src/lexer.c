@@ -0,0 +1,351 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+// Check if a character ends an unquoted word
+static int is_metachar(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == ';' || c == '&' ||
+           c == '|' || c == '<' || c == '>' || c == '(' || c == ')';
+}
+
+// Append a token to the list
+static void add_token(token_list_t* list, token_type_t type, char* text, int start, int end) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 32;
+        list->tokens = realloc(list->tokens, list->capacity * sizeof(token_t));
+        if (list->tokens == NULL) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    token_t* tok = &list->tokens[list->count++];
+    tok->type = type;
+    tok->text = text;
+    tok->start = start;
+    tok->end = end;
+    tok->body = NULL;
+}
+
+// Copy a token's text into the list's string pool. The pool is sized
+// for the whole input up front: texts are disjoint pieces of it, each
+// with a NUL added.
+static char* pool_text(token_list_t* list, const char* text, size_t len) {
+    char* copy = list->strings + list->used;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    list->used += len + 1;
+    return copy;
+}
+
+// Skip a balanced $( ... ) or ${ ... } starting at the opening bracket.
+// Returns a pointer just past the closing bracket, or NULL if input ends first.
+const char* skip_balanced(const char* p, char open, char close) {
+    int depth = 0;
+    while (*p != '\0') {
+        if (*p == '\\' && p[1] != '\0') {
+            p += 2;
+            continue;
+        }
+        if (*p == '\'') {
+            const char* end = strchr(p + 1, '\'');
+            if (end == NULL) return NULL;
+            p = end + 1;
+            continue;
+        }
+        if (*p == '"') {
+            p++;
+            while (*p != '\0' && *p != '"') {
+                if (*p == '\\' && p[1] != '\0') p++;
+                p++;
+            }
+            if (*p == '\0') return NULL;
+            p++;
+            continue;
+        }
+        if (*p == open) {
+            depth++;
+        } else if (*p == close) {
+            depth--;
+            if (depth == 0) return p + 1;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+// Check for the start of a process substitution, <( or >(
+static int is_process_substitution(const char* p) {
+    return (*p == '<' || *p == '>') && p[1] == '(';
+}
+
+// Check for the '(' of an array assignment, NAME=( or NAME+=(, where
+// start is the beginning of the word
+static int is_array_list(const char* start, const char* p) {
+    if (*p != '(' || p == start || p[-1] != '=') return 0;
+    const char* q = start;
+    if (!((*q >= 'a' && *q <= 'z') || (*q >= 'A' && *q <= 'Z') || *q == '_')) return 0;
+    while ((*q >= 'a' && *q <= 'z') || (*q >= 'A' && *q <= 'Z') ||
+           (*q >= '0' && *q <= '9') || *q == '_') {
+        q++;
+    }
+    if (*q == '+') q++;
+    return q == p - 1;
+}
+
+// Scan one word starting at p; returns the end of the word, or NULL if
+// the input ends inside a quote or substitution. Runs of plain bytes are
+// skipped with scan_until().
+static const char* scan_word(const char* p) {
+    const char* start = p;
+    while (*(p = scan_until(p, SCAN_WORD)) != '\0' &&
+           (!is_metachar(*p) || is_process_substitution(p) || is_array_list(start, p))) {
+        if (is_process_substitution(p)) {
+            p = skip_balanced(p + 1, '(', ')');
+            if (p == NULL) return NULL;
+        } else if (*p == '(') {
+            p = skip_balanced(p, '(', ')'); // NAME=(list)
+            if (p == NULL) return NULL;
+        } else if (*p == '\\') {
+            if (p[1] == '\0') return NULL;
+            p += 2;
+        } else if (*p == '\'') {
+            const char* end = strchr(p + 1, '\'');
+            if (end == NULL) return NULL;
+            p = end + 1;
+        } else if (*p == '"') {
+            p++;
+            while (*(p = scan_until(p, SCAN_DQUOTE)) != '"') {
+                if (*p == '\0') return NULL;
+                if (*p == '\\' && p[1] != '\0') {
+                    p += 2;
+                } else if (*p == '$' && (p[1] == '(' || p[1] == '{')) {
+                    p = skip_balanced(p + 1, p[1], p[1] == '(' ? ')' : '}');
+                    if (p == NULL) return NULL;
+                } else {
+                    p++;
+                }
+            }
+            p++;
+        } else if (*p == '$' && (p[1] == '(' || p[1] == '{')) {
+            p = skip_balanced(p + 1, p[1], p[1] == '(' ? ')' : '}');
+            if (p == NULL) return NULL;
+        } else {
+            p++;
+        }
+    }
+    return p;
+}
+
+// Find the '))' closing an arithmetic command whose expression starts at p.
+// Returns 1 and sets *end, 0 if the parentheses close some other way (nested
+// subshells), or -1 if the input ends first.
+static int find_arith_end(const char* p, const char** end) {
+    int depth = 0;
+    for (; *p != '\0'; p++) {
+        if (*p == '(') {
+            depth++;
+        } else if (*p == ')') {
+            if (depth > 0) {
+                depth--;
+                continue;
+            }
+            if (p[1] != ')') return 0;
+            *end = p;
+            return 1;
+        }
+    }
+    return -1;
+}
+
+// Read a here-document body starting at p into tok->body. The delimiter is
+// tok->text with quotes removed; strip_tabs handles <<-. Returns a pointer
+// past the delimiter line, or NULL if the input ends first.
+static const char* read_here_doc(const char* p, token_t* tok, int strip_tabs) {
+    strbuf_t delim;
+    sb_init(&delim);
+    for (const char* d = tok->text; *d != '\0'; d++) {
+        if (*d == '\\' && d[1] != '\0') {
+            sb_putc(&delim, *++d);
+        } else if (*d != '\'' && *d != '"') {
+            sb_putc(&delim, *d);
+        }
+    }
+    char* delimiter = sb_release(&delim);
+    size_t delim_len = strlen(delimiter);
+
+    strbuf_t body;
+    sb_init(&body);
+    while (*p != '\0') {
+        if (strip_tabs) {
+            while (*p == '\t') p++;
+        }
+        const char* eol = strchr(p, '\n');
+        size_t len = eol ? (size_t)(eol - p) : strlen(p);
+        if (len == delim_len && strncmp(p, delimiter, len) == 0) {
+            free(delimiter);
+            tok->body = sb_release(&body);
+            return eol ? eol + 1 : p + len;
+        }
+        sb_appendn(&body, p, len);
+        sb_putc(&body, '\n');
+        p += eol ? len + 1 : len;
+    }
+
+    free(delimiter);
+    sb_free(&body);
+    return NULL;
+}
+
+// Split input into tokens. Words keep quotes so expansion can happen later.
+int lex_input(const char* input, token_list_t* list) {
+    list->tokens = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    list->strings = malloc(2 * strlen(input) + 1);
+    list->used = 0;
+    if (list->strings == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+
+    // Delimiter tokens whose here-document bodies start after the next newline
+    int pending[16];
+    int num_pending = 0;
+
+    const char* p = input;
+    while (*p != '\0') {
+        // Skip whitespace and line continuations
+        if (*p == ' ' || *p == '\t') {
+            p++;
+            continue;
+        }
+        if (*p == '\\' && p[1] == '\n') {
+            p += 2;
+            continue;
+        }
+
+        // Comments run to the end of the line
+        if (*p == '#') {
+            p = strchrnul(p, '\n');
+            continue;
+        }
+
+        int start = p - input;
+
+        // (( expression )) is a single token
+        if (p[0] == '(' && p[1] == '(') {
+            const char* end;
+            int found = find_arith_end(p + 2, &end);
+            if (found < 0) {
+                free_tokens(list);
+                return PARSE_INCOMPLETE;
+            }
+            if (found) {
+                add_token(list, TOK_ARITH, pool_text(list, p + 2, end - p - 2), start, end + 2 - input);
+                p = end + 2;
+                continue;
+            }
+        }
+
+        token_type_t type;
+        int len = 1;
+
+        switch (*p) {
+            case '\n': type = TOK_NEWLINE; break;
+            case ';':
+                if (p[1] == ';') { type = TOK_DSEMI; len = 2; }
+                else type = TOK_SEMI;
+                break;
+            case '<':
+                if (p[1] == '(') type = TOK_WORD; // <(command)
+                else if (p[1] == '&') { type = TOK_LESSAND; len = 2; }
+                else if (p[1] == '>') { type = TOK_LESSGREAT; len = 2; }
+                else if (p[1] != '<') type = TOK_LESS;
+                else if (p[2] == '<') { type = TOK_TLESS; len = 3; }
+                else if (p[2] == '-') { type = TOK_DLESSDASH; len = 3; }
+                else { type = TOK_DLESS; len = 2; }
+                break;
+            case '>':
+                if (p[1] == '(') type = TOK_WORD; // >(command)
+                else if (p[1] == '>') { type = TOK_DGREAT; len = 2; }
+                else if (p[1] == '&') { type = TOK_GREATAND; len = 2; }
+                else if (p[1] == '|') { type = TOK_GREAT; len = 2; }
+                else type = TOK_GREAT;
+                break;
+            case '(':  type = TOK_LPAREN; break;
+            case ')':  type = TOK_RPAREN; break;
+            case '&':
+                if (p[1] == '&') { type = TOK_AND_IF; len = 2; }
+                else if (p[1] == '>' && p[2] == '>') { type = TOK_ANDDGREAT; len = 3; }
+                else if (p[1] == '>') { type = TOK_ANDGREAT; len = 2; }
+                else type = TOK_AMP;
+                break;
+            case '|':
+                if (p[1] == '|') { type = TOK_OR_IF; len = 2; }
+                else type = TOK_PIPE;
+                break;
+            default:
+                type = TOK_WORD;
+                break;
+        }
+
+        if (type != TOK_WORD) {
+            add_token(list, type, NULL, start, start + len);
+            p += len;
+
+            // Here-document bodies follow the line that introduced them
+            for (int i = 0; type == TOK_NEWLINE && i < num_pending; i++) {
+                token_t* delim = &list->tokens[pending[i]];
+                int strip_tabs = list->tokens[pending[i] - 1].type == TOK_DLESSDASH;
+                p = read_here_doc(p, delim, strip_tabs);
+                if (p == NULL) {
+                    free_tokens(list);
+                    return PARSE_INCOMPLETE;
+                }
+            }
+            if (type == TOK_NEWLINE) num_pending = 0;
+            continue;
+        }
+
+        const char* end = scan_word(p);
+        if (end == NULL) {
+            free_tokens(list);
+            return PARSE_INCOMPLETE; // Unclosed quote or substitution
+        }
+        // Digits directly before < or > name the descriptor to redirect
+        type = TOK_WORD;
+        if (*end == '<' || *end == '>') {
+            const char* d = p;
+            while (d < end && *d >= '0' && *d <= '9') d++;
+            if (d == end) type = TOK_IO_NUMBER;
+        }
+        add_token(list, type, pool_text(list, p, end - p), start, end - input);
+        p = end;
+
+        token_type_t prev = list->count > 1 ? list->tokens[list->count - 2].type : TOK_EOF;
+        if ((prev == TOK_DLESS || prev == TOK_DLESSDASH) &&
+            num_pending < (int)(sizeof(pending) / sizeof(pending[0]))) {
+            pending[num_pending++] = list->count - 1;
+        }
+    }
+
+    if (num_pending > 0) {
+        free_tokens(list);
+        return PARSE_INCOMPLETE; // Here-document without its body
+    }
+
+    add_token(list, TOK_EOF, NULL, p - input, p - input);
+    return PARSE_OK;
+}
+
+// Free memory allocated for tokens
+void free_tokens(token_list_t* list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->tokens[i].body);
+    }
+    free(list->tokens);
+    free(list->strings);
+    list->tokens = NULL;
+    list->strings = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
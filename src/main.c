@@ -1,88 +1,379 @@
 #include "shell.h"
+#include <limits.h>
 
-// Function to check if command starts with control structure
-int starts_with_control_structure(const char* cmdline) {
-    if (cmdline == NULL) return 0;
-    
-    // Skip leading whitespace
-    while (*cmdline == ' ' || *cmdline == '\t') cmdline++;
-    
-    return (strncmp(cmdline, "if ", 3) == 0);
+// Non-zero when reading commands from the terminal prompt
+int interactive = 1;
+
+// Append a continuation line to a partially read command
+static char* append_line(char* cmdline, const char* line) {
+    char* joined = malloc(strlen(cmdline) + strlen(line) + 2);
+    if (joined == NULL) {
+        perror("malloc failed");
+        return cmdline;
+    }
+    sprintf(joined, "%s\n%s", cmdline, line);
+    free(cmdline);
+    return joined;
 }
 
-// Function to split multiline command into individual lines
-int split_into_lines(const char* full_command, char*** lines) {
-    if (full_command == NULL || lines == NULL) return 0;
-    
-    // Count lines (split by semicolons or newlines in the buffer)
-    int line_count = 1;
-    const char* ptr = full_command;
-    
-    while (*ptr) {
-        if (*ptr == ';') line_count++;
-        ptr++;
+// Read a whole script file into memory; st (if not NULL) receives its
+// status as of the read
+char* read_file(const char* path, struct stat* st) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
     }
-    
-    // Allocate lines array
-    *lines = malloc(line_count * sizeof(char*));
-    if (*lines == NULL) return 0;
-    
-    // Split the command
-    char* copy = strdup(full_command);
-    int count = 0;
-    char* token = strtok(copy, ";");
-    
-    while (token != NULL && count < line_count) {
-        // Trim whitespace
-        while (*token == ' ' || *token == '\t') token++;
-        char* end = token + strlen(token) - 1;
-        while (end > token && (*end == ' ' || *end == '\t' || *end == '\n')) end--;
-        *(end + 1) = '\0';
-        
-        (*lines)[count++] = strdup(token);
-        token = strtok(NULL, ";");
+
+    struct stat buf;
+    if (st == NULL) {
+        st = &buf;
     }
-    
-    free(copy);
-    return count;
+    if (fstat(fd, st) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    char* source = malloc(st->st_size + 1);
+    ssize_t total = 0;
+    while (source != NULL && total < st->st_size) {
+        ssize_t n = read(fd, source + total, st->st_size - total);
+        if (n <= 0) break;
+        total += n;
+    }
+    close(fd);
+
+    if (source != NULL) {
+        source[total] = '\0';
+    }
+    return source;
+}
+
+// Run a parsed script and free it, returning its exit status. With last
+// set nothing runs after it, so its final command may replace the shell.
+static int run_tree(node_t* tree, int last) {
+    if (last) {
+        mark_tail_commands(tree);
+    }
+    uint64_t start = stats_clock();
+    execute_node(tree);
+    stats_record(STAT_COMMAND, start);
+    free_node(tree);
+    return last_status;
+}
+
+// parse_program(), timed for stats
+static int timed_parse(const char* source, node_t** tree) {
+    uint64_t start = stats_clock();
+    int result = parse_program(source, tree);
+    stats_record(STAT_PARSE, start);
+    return result;
+}
+
+// read_cmd_readline(), timed for stats
+static char* timed_read(const char* prompt) {
+    uint64_t start = stats_clock();
+    char* line = read_cmd_readline(prompt);
+    stats_record(STAT_READ, start);
+    return line;
+}
+
+// Parse a complete script; returns 0 or the exit status of a syntax error
+static int parse_script(const char* source, node_t** tree) {
+    int result = timed_parse(source, tree);
+
+    if (result == PARSE_INCOMPLETE) {
+        fprintf(stderr, "Syntax error: unexpected end of file\n");
+        return 2;
+    }
+    return result == PARSE_OK ? 0 : 2;
+}
+
+// Parse a complete script once and run it, returning its exit status
+int run_script(const char* source) {
+    node_t* tree;
+    int status = parse_script(source, &tree);
+    return status != 0 ? status : run_tree(tree, 0);
+}
+
+// Run a script file: a compiled .mshc file is loaded as is (or its source
+// run if that has changed since); a source file comes from the compiled
+// script cache when it has an up-to-date entry, and is added otherwise
+static int run_file(const char* path) {
+    node_t* tree;
+    char* source_path;
+    int loaded = load_compiled(path, &tree, &source_path);
+    if (loaded == 0) {
+        free(source_path);
+        return run_tree(tree, 1);
+    }
+    if (loaded > 0) {
+        int status = run_file(source_path);
+        free(source_path);
+        return status;
+    }
+    if (loaded < -1) {
+        fprintf(stderr, "%s: damaged compiled script\n", path);
+        return 126;
+    }
+
+    if ((tree = load_cached_script(path)) != NULL) {
+        return run_tree(tree, 1);
+    }
+
+    struct stat st;
+    char* source = read_file(path, &st);
+    if (source == NULL) {
+        perror(path);
+        return 127;
+    }
+    int status = parse_script(source, &tree);
+    free(source);
+    if (status != 0) {
+        return status;
+    }
+    cache_script(path, &st, tree);
+    return run_tree(tree, 1);
+}
+
+// Whether expanding a word runs commands or arithmetic: $(...), `...`,
+// $((...)), <(...) or >(...). Their effects and output would happen only
+// when the snapshot is made. Quoted text that merely looks like one is
+// refused too, which just means sourcing the file every time.
+static int expansion_runs_code(const word_t* word) {
+    return strstr(word->text, "$(") != NULL || strchr(word->text, '`') != NULL ||
+           strstr(word->text, "<(") != NULL || strstr(word->text, ">(") != NULL;
+}
+
+// Whether a command only sets variables: bare assignments, or declare /
+// typeset with -a, -A or -g and names or assignments as arguments
+static int only_assigns(const command_t* cmd) {
+    if (cmd->num_redirs > 0) {
+        return 0;
+    }
+    for (int i = 0; i < cmd->num_assigns; i++) {
+        if (expansion_runs_code(&cmd->assigns[i])) return 0;
+    }
+    if (cmd->num_words == 0) {
+        return 1;
+    }
+    if (strcmp(cmd->words[0].text, "declare") != 0 && strcmp(cmd->words[0].text, "typeset") != 0) {
+        return 0;
+    }
+    int names = 0;
+    for (int i = 1; i < cmd->num_words; i++) {
+        const char* text = cmd->words[i].text;
+        if (text[0] == '-' && text[1] != '\0' && strspn(text + 1, "aAg") == strlen(text + 1)) {
+            continue;
+        }
+        if (!is_variable_assignment(text) && !is_valid_name(text)) return 0;
+        if (expansion_runs_code(&cmd->words[i])) return 0;
+        names++;
+    }
+    return names > 0; // Without names declare prints the variables
+}
+
+// Whether a script's effect is only what it leaves in the variable and
+// function tables: every top-level command is a function definition or
+// only sets variables. Anything else (cd, set -o, exec N>file, output,
+// command substitutions) would be lost by replaying a snapshot.
+static int only_defines(const node_t* node) {
+    if (node == NULL) {
+        return 1;
+    }
+    if (node->background) {
+        return 0;
+    }
+    switch (node->type) {
+        case NODE_LIST:
+            for (int i = 0; i < node->list.count; i++) {
+                if (!only_defines(node->list.items[i])) return 0;
+            }
+            return 1;
+        case NODE_FUNCDEF:
+            return 1;
+        case NODE_COMMAND:
+            return only_assigns(&node->command);
+        default:
+            return 0;
+    }
+}
+
+// Drop the names a snapshot must not restore: the directory variables
+// describe the cwd of the start that made it, not of later ones
+static int snapshot_names(char** names, int count) {
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], "PWD") == 0 || strcmp(names[i], "OLDPWD") == 0) {
+            free(names[i]);
+        } else {
+            names[n++] = names[i];
+        }
+    }
+    names[n] = NULL;
+    return n;
+}
+
+// Source the rc file ($MYSHELLRC, else ~/.myshellrc). When it only
+// defines variables and functions, those are saved to a snapshot keyed by
+// the file's size and mtime, and later starts load that in one read
+// instead of running the file; any other rc file is sourced every time.
+static void load_rc() {
+    const char* path = getenv("MYSHELLRC");
+    char home_rc[PATH_MAX];
+    if (path == NULL) {
+        const char* home = getenv("HOME");
+        if (home == NULL) return;
+        snprintf(home_rc, sizeof(home_rc), "%s/.myshellrc", home);
+        path = home_rc;
+    }
+
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return;
+    }
+    char* file = snapshot_file(path);
+    if (file != NULL && load_snapshot(file, &st) == 0) {
+        free(file);
+        return;
+    }
+
+    char* source = read_file(path, &st);
+    if (source == NULL) {
+        perror(path);
+        free(file);
+        return;
+    }
+    node_t* tree;
+    int status = parse_script(source, &tree);
+    free(source);
+    if (status != 0) {
+        free(file);
+        return;
+    }
+    if (!only_defines(tree)) {
+        run_tree(tree, 0);
+        free(file);
+        return;
+    }
+    variable_snapshot_t* changes = save_variables();
+    run_tree(tree, 0);
+
+    int count;
+    char** names = keep_variables(changes, &count);
+    count = snapshot_names(names, count);
+    if (file != NULL) {
+        save_snapshot(file, &st, names, count);
+    }
+    for (int i = 0; i < count; i++) free(names[i]);
+    free(names);
+    free(file);
 }
 
-int main() {
+int main(int argc, char* argv[]) {
     char* cmdline;
-    pipeline_t pipeline;
+    node_t* tree;
     int result;
 
-    // Initialize Readline if available
-    initialize_readline();
-    
     // Initialize job control
     init_jobs();
     
     // Initialize variables
     init_variables();
 
+    // myshell --norc ... skips the rc file; so do client and compile runs
+    if (argc > 1 && strcmp(argv[1], "--norc") == 0) {
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    } else if (argc < 2 || (strcmp(argv[1], "--client") != 0 && strcmp(argv[1], "--compile") != 0)) {
+        load_rc();
+    }
+
+    // Non-interactive modes: myshell -c 'commands' or myshell script.sh
+    if (argc > 1) {
+        interactive = 0;
+
+        // myshell --server SOCKET [init-script]
+        if (strcmp(argv[1], "--server") == 0 && argc >= 3) {
+            char* init = NULL;
+            if (argc > 3 && (init = read_file(argv[3], NULL)) == NULL) {
+                perror(argv[3]);
+                return 127;
+            }
+            return run_server(argv[2], init);
+        }
+
+        // myshell --client SOCKET -c 'commands' [name args...] | script [args...]
+        if (strcmp(argv[1], "--client") == 0 && argc >= 4) {
+            if (strcmp(argv[3], "-c") == 0) {
+                if (argc < 5) {
+                    fprintf(stderr, "Usage: %s --client socket [-c commands | script]\n", argv[0]);
+                    return 2;
+                }
+                return run_client(argv[2], argv[4], argv + 5, argc - 5);
+            }
+            char* source = read_file(argv[3], NULL);
+            if (source == NULL) {
+                perror(argv[3]);
+                return 127;
+            }
+            int status = run_client(argv[2], source, argv + 3, argc - 3);
+            free(source);
+            return status;
+        }
+
+        if (strcmp(argv[1], "-c") == 0) {
+            if (argc < 3) {
+                fprintf(stderr, "Usage: %s [-c commands | script]\n", argv[0]);
+                return 2;
+            }
+            // Like sh -c: the next argument is $0, the rest are $1..$N
+            if (argc > 3) {
+                shell_name = argv[3];
+                positional_args = argv + 4;
+                positional_count = argc - 4;
+            }
+            node_t* tree;
+            int status = parse_script(argv[2], &tree);
+            return status != 0 ? status : run_tree(tree, 1);
+        }
+
+        // myshell --compile script... writes script.mshc next to each
+        if (strcmp(argv[1], "--compile") == 0) {
+            int status = 0;
+            for (int i = 2; i < argc; i++) {
+                int result = compile_script(argv[i]);
+                if (result > status) status = result;
+            }
+            return status;
+        }
+
+        shell_name = argv[1];
+        positional_args = argv + 2;
+        positional_count = argc - 2;
+        return run_file(argv[1]);
+    }
+
+    // Initialize Readline if available
+    initialize_readline();
+
     while (1) {
         // Clean up zombie processes before prompt
         cleanup_zombies();
         update_jobs();
 
         // Use readline if available, otherwise fallback
-        cmdline = read_cmd_readline(PROMPT);
+        cmdline = timed_read(PROMPT);
         
         if (cmdline == NULL) {
             break; // EOF (Ctrl+D)
         }
 
-        // NEW: Handle variable assignments FIRST, before history expansion
-        if (handle_variable_assignment(cmdline)) {
-            // Variable was assigned, don't execute as command
-            free(cmdline);
-            continue;
-        }
-
         // Handle history expansion before adding to our internal history
         if (is_history_command(cmdline)) {
+            uint64_t start = stats_clock();
             char* expanded_cmd = expand_history_command(cmdline);
+            stats_record(STAT_HISTORY, start);
             if (expanded_cmd != NULL) {
                 free(cmdline);
                 cmdline = malloc(strlen(expanded_cmd) + 1);
@@ -93,38 +384,17 @@ int main() {
                 continue;  // Skip to next iteration if history expansion failed
             }
         }
-        
-        // Handle control structures (if-then-else)
-        if (starts_with_control_structure(cmdline)) {
-            // Read the complete multiline block
-            char* full_block = read_multiline_command(cmdline);
-            free(cmdline);
-            
-            if (full_block == NULL) {
-                continue;
-            }
-            
-            // Split into individual lines
-            char** lines = NULL;
-            int line_count = split_into_lines(full_block, &lines);
-            
-            if (line_count > 0) {
-                // Parse and execute the if block
-                if_block_t if_block;
-                if (parse_if_block(lines, line_count, &if_block) == 0) {
-                    execute_if_block(&if_block);
-                    free_if_block(&if_block);
-                }
-                
-                // Free lines
-                for (int i = 0; i < line_count; i++) {
-                    free(lines[i]);
-                }
-                free(lines);
+
+        // Parse into an AST, reading continuation lines while a quote or
+        // control structure (if ... fi) is still open
+        while ((result = timed_parse(cmdline, &tree)) == PARSE_INCOMPLETE) {
+            char* line = timed_read("> ");
+            if (line == NULL) {
+                fprintf(stderr, "Syntax error: unexpected end of file\n");
+                break;
             }
-            
-            free(full_block);
-            continue;
+            cmdline = append_line(cmdline, line);
+            free(line);
         }
         
         // Add non-empty commands to our internal history (after expansion)
@@ -132,15 +402,12 @@ int main() {
             add_to_history(cmdline);
         }
 
-        // Parse for redirection, pipes, and command chaining
-        if (parse_redirection_pipes(cmdline, &pipeline) > 0) {
-            // Execute the parsed command(s)
-            result = execute_pipeline(&pipeline);
-            
-            // Free allocated memory
-            free_pipeline(&pipeline);
-        } else {
-            fprintf(stderr, "Error: failed to parse command\n");
+        // Execute the parsed command(s)
+        if (result == PARSE_OK && tree != NULL) {
+            uint64_t start = stats_clock();
+            execute_node(tree);
+            stats_record(STAT_COMMAND, start);
+            free_node(tree);
         }
         
         free(cmdline);
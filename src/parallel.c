@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <poll.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#define PARALLEL_READ 65536     // Bytes read from a task's output at a time
+#define PARALLEL_POLL_MS 10     // Wakeup interval when pidfds are unavailable
+
+// One run of the command with one argument
+typedef struct {
+    char* arg;
+    pid_t pid;              // -1 until started, 0 once reaped
+    int out;                // Read end of the stdout pipe, -1 at EOF
+    int pidfd;              // Readable when the child exits; -1 if unsupported
+    int status;
+    struct timespec start, end;
+    strbuf_t output;
+} parallel_task_t;
+
+// Seconds between two timestamps
+static double elapsed(const struct timespec* start, const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// The command line of a task: {} in the template words is replaced by
+// the argument, or the argument is appended if there is no {}
+static char** task_argv(char** cmd, const char* arg) {
+    int n = 0;
+    int replaced = 0;
+    while (cmd[n] != NULL) n++;
+    char** argv = malloc((n + 2) * sizeof(char*));
+    if (argv == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+        const char* braces = strstr(cmd[i], "{}");
+        if (braces == NULL) {
+            argv[i] = strdup(cmd[i]);
+            continue;
+        }
+        strbuf_t sb;
+        sb_init(&sb);
+        for (const char* p = cmd[i]; (braces = strstr(p, "{}")) != NULL; p = braces + 2) {
+            sb_appendn(&sb, p, braces - p);
+            sb_append(&sb, arg);
+            if (strstr(braces + 2, "{}") == NULL) sb_append(&sb, braces + 2);
+        }
+        argv[i] = sb_release(&sb);
+        replaced = 1;
+    }
+    argv[n] = replaced ? NULL : strdup(arg);
+    argv[n + 1] = NULL;
+    return argv;
+}
+
+// Fork a task with its stdout going into a pipe
+static int start_task(parallel_task_t* task, char** cmd) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        perror("pipe failed");
+        return -1;
+    }
+    char** argv = task_argv(cmd, task->arg);
+
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &task->start);
+    pid_t pid = stats_fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        exec_in_child(argv, command_assigns);
+    }
+    close(fds[1]);
+    free_argv(argv);
+    if (pid < 0) {
+        perror("fork failed");
+        close(fds[0]);
+        return -1;
+    }
+
+    task->pid = pid;
+    task->out = fds[0];
+    task->pidfd = syscall(SYS_pidfd_open, pid, 0);
+    return 0;
+}
+
+// Reap the task's child if it has exited
+static int reap_task(parallel_task_t* task) {
+    int wstatus;
+    if (task->pid <= 0 || waitpid(task->pid, &wstatus, WNOHANG) != task->pid) {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &task->end);
+    task->status = decode_status(wstatus);
+    task->pid = 0;
+    if (task->pidfd >= 0) {
+        close(task->pidfd);
+        task->pidfd = -1;
+    }
+    return 1;
+}
+
+// Read what is available from the task's output; closes it at EOF
+static void drain_task(parallel_task_t* task) {
+    sb_reserve(&task->output, PARALLEL_READ);
+    ssize_t n = read(task->out, task->output.data + task->output.len,
+                     task->output.cap - task->output.len - 1);
+    if (n < 0 && errno == EINTR) return;
+    if (n <= 0) {
+        close(task->out);
+        task->out = -1;
+        return;
+    }
+    task->output.len += n;
+    task->output.data[task->output.len] = '\0';
+}
+
+// Write a finished task's output in one piece
+static void print_task(parallel_task_t* task) {
+    for (size_t done = 0; done < task->output.len; ) {
+        ssize_t n = write(STDOUT_FILENO, task->output.data + done, task->output.len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    sb_free(&task->output);
+}
+
+// Run cmd once per argument with at most 'jobs' children at a time. Each
+// task's stdout is collected and printed when it finishes (in argument
+// order with keep_order). Returns the highest exit status.
+static int run_parallel(char** cmd, char** args, int count, int jobs, int keep_order) {
+    parallel_task_t* tasks = calloc(count, sizeof(parallel_task_t));
+    struct pollfd* fds = malloc((count * 2) * sizeof(struct pollfd));
+    parallel_task_t** owners = malloc((count * 2) * sizeof(parallel_task_t*));
+    int* active = malloc(count * sizeof(int)); // Started tasks not yet finished
+    if (tasks == NULL || fds == NULL || owners == NULL || active == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        tasks[i].arg = args[i];
+        tasks[i].pid = -1;
+        tasks[i].out = -1;
+        tasks[i].pidfd = -1;
+        sb_init(&tasks[i].output);
+    }
+
+    int next = 0, num_active = 0, running = 0, printed = 0;
+    while (next < count || num_active > 0) {
+        // Fill the free worker slots
+        while (next < count && running < jobs) {
+            if (start_task(&tasks[next], cmd) != 0) {
+                tasks[next].status = 126;
+                tasks[next].pid = 0;
+            } else {
+                running++;
+            }
+            active[num_active++] = next++;
+        }
+
+        // Wait for output or for a child to exit
+        int nfds = 0;
+        int all_pidfds = 1;
+        for (int k = 0; k < num_active; k++) {
+            parallel_task_t* task = &tasks[active[k]];
+            if (task->out >= 0) {
+                fds[nfds] = (struct pollfd){ task->out, POLLIN, 0 };
+                owners[nfds++] = task;
+            }
+            if (task->pid > 0 && task->pidfd >= 0) {
+                fds[nfds] = (struct pollfd){ task->pidfd, POLLIN, 0 };
+                owners[nfds++] = task;
+            } else if (task->pid > 0) {
+                all_pidfds = 0;
+            }
+        }
+        if (nfds > 0 && poll(fds, nfds, all_pidfds ? -1 : PARALLEL_POLL_MS) > 0) {
+            for (int k = 0; k < nfds; k++) {
+                if (fds[k].revents != 0 && fds[k].fd == owners[k]->out) {
+                    drain_task(owners[k]);
+                }
+            }
+        } else if (nfds == 0 && !all_pidfds) {
+            usleep(PARALLEL_POLL_MS * 1000);
+        }
+
+        // Reap exited children, then retire tasks that are fully done
+        for (int k = 0; k < num_active; k++) {
+            if (reap_task(&tasks[active[k]])) {
+                running--;
+            }
+        }
+        int kept = 0;
+        for (int k = 0; k < num_active; k++) {
+            parallel_task_t* task = &tasks[active[k]];
+            if (task->pid == 0 && task->out < 0) {
+                if (!keep_order) print_task(task);
+            } else {
+                active[kept++] = active[k];
+            }
+        }
+        num_active = kept;
+        while (keep_order && printed < next && tasks[printed].pid == 0 && tasks[printed].out < 0) {
+            print_task(&tasks[printed++]);
+        }
+    }
+
+    // Per-task report
+    int status = 0;
+    fprintf(stderr, "%-6s %-6s %10s  %s\n", "task", "exit", "seconds", "argument");
+    for (int i = 0; i < count; i++) {
+        fprintf(stderr, "%-6d %-6d %10.3f  %s\n", i + 1, tasks[i].status,
+                elapsed(&tasks[i].start, &tasks[i].end), tasks[i].arg);
+        if (tasks[i].status > status) status = tasks[i].status;
+    }
+
+    free(tasks);
+    free(fds);
+    free(owners);
+    free(active);
+    return status;
+}
+
+// Read newline-separated arguments from stdin
+static char** read_arguments(int* count) {
+    strbuf_t data;
+    sb_init(&data);
+    for (;;) {
+        sb_reserve(&data, PARALLEL_READ);
+        ssize_t n = read(STDIN_FILENO, data.data + data.len, data.cap - data.len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        data.len += n;
+    }
+
+    int n = 0, cap = 0;
+    char** args = NULL;
+    const char* p = data.data;
+    const char* limit = data.data + data.len;
+    while (p < limit) {
+        const char* end = memchr(p, '\n', limit - p);
+        if (end == NULL) end = limit;
+        if (n + 1 >= cap) {
+            cap = cap ? cap * 2 : 64;
+            args = realloc(args, cap * sizeof(char*));
+            if (args == NULL) {
+                perror("realloc failed");
+                exit(1);
+            }
+        }
+        args[n++] = strndup(p, end - p);
+        p = end + 1;
+    }
+    sb_free(&data);
+    *count = n;
+    return args;
+}
+
+// Built-in command: parallel [-j N] [-k] command [args...] [::: arg...]
+// Runs command once per argument after :::, or per line of stdin, on a pool
+// of N workers (default: one per CPU). {} in the command is replaced by the
+// argument; otherwise it is appended. -k prints outputs in argument order.
+int builtin_parallel(char** arglist) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int jobs = cpus > 0 ? (int)cpus : 1;
+    int keep_order = 0;
+    int i = 1;
+    for (; arglist[i] != NULL && arglist[i][0] == '-'; i++) {
+        if (strncmp(arglist[i], "-j", 2) == 0 && arglist[i][2] != '\0') {
+            int n = atoi(arglist[i] + 2); // -jN
+            if (n > 0) jobs = n;
+        } else if (strcmp(arglist[i], "-j") == 0 && arglist[i + 1] != NULL) {
+            int n = atoi(arglist[++i]);
+            if (n > 0) jobs = n;
+        } else if (strcmp(arglist[i], "-k") == 0) {
+            keep_order = 1;
+        } else {
+            break;
+        }
+    }
+
+    char** cmd = &arglist[i];
+    int sep = 0;
+    while (cmd[sep] != NULL && strcmp(cmd[sep], ":::") != 0) sep++;
+    if (sep == 0) {
+        fprintf(stderr, "parallel: usage: parallel [-j N] [-k] command [args...] [::: arg...]\n");
+        return 2;
+    }
+
+    int count = 0;
+    char** args;
+    char* marker = cmd[sep];
+    int owned = marker == NULL;
+    if (owned) {
+        args = read_arguments(&count);
+    } else {
+        args = &cmd[sep + 1];
+        while (args[count] != NULL) count++;
+        cmd[sep] = NULL;
+    }
+
+    int status = count > 0 ? run_parallel(cmd, args, count, jobs, keep_order) : 0;
+
+    if (owned) {
+        for (int k = 0; k < count; k++) free(args[k]);
+        free(args);
+    } else {
+        cmd[sep] = marker;
+    }
+    return status;
+}
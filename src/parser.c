@@ -1,206 +1,620 @@
 #include "shell.h"
 
-// Helper function to check if a character is a quote
-int is_quote(char c) {
-    return c == '\'' || c == '"';
+// Reserved words that end a compound list when seen in command position
+static const char* list_terminators[] = {
+    "then", "else", "elif", "fi", "do", "done", "esac", "}", NULL
+};
+
+// Builtins whose NAME=value arguments are expanded like assignments
+static const char* declaration_builtins[] = {
+    "declare", "local", "typeset", NULL
+};
+
+
+// Check if a command name is a declaration builtin
+static int is_declaration(const char* name) {
+    for (int i = 0; declaration_builtins[i] != NULL; i++) {
+        if (strcmp(name, declaration_builtins[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
-// Improved parse function that handles quotes
-int parse_redirection_pipes(char* cmdline, pipeline_t* pipeline) {
-    if (cmdline == NULL || pipeline == NULL) {
-        return -1;
+// Allocate a zeroed AST node
+node_t* new_node(node_type_t type) {
+    node_t* node = calloc(1, sizeof(node_t));
+    if (node == NULL) {
+        perror("calloc failed");
+        exit(1);
     }
+    node->type = type;
+    return node;
+}
 
-    // Expand variables in the command line
-    char* expanded_cmdline = expand_variables(cmdline);
-    if (expanded_cmdline == NULL) {
-        return -1;
+// Append a node to a growable node array
+static void append_node(node_t*** items, int* count, node_t* item) {
+    *items = realloc(*items, (*count + 1) * sizeof(node_t*));
+    if (*items == NULL) {
+        perror("realloc failed");
+        exit(1);
+    }
+    (*items)[(*count)++] = item;
+}
+
+// Initialize a word from raw source text, noting whether it needs expansion
+void init_word(word_t* word, const char* text) {
+    word->text = strdup(text);
+    word->flags = strpbrk(text, "$'\"\\<>") ? WORD_NEEDS_EXPANSION : 0;
+    if (strpbrk(text, "*?[") != NULL) {
+        word->flags |= WORD_HAS_GLOB;
+    }
+}
+
+// Append a word to a growable word array
+void append_word(word_t** words, int* count, const char* text) {
+    *words = realloc(*words, (*count + 1) * sizeof(word_t));
+    if (*words == NULL) {
+        perror("realloc failed");
+        exit(1);
+    }
+    init_word(&(*words)[(*count)++], text);
+}
+
+// Free a here-document
+static void free_here_doc(here_doc_t* here_doc) {
+    if (here_doc == NULL) return;
+    free(here_doc->body.text);
+    free(here_doc);
+}
+
+// Build a here-document from a << delimiter token, or a here-string from
+// the word after <<<
+static here_doc_t* new_here_doc(token_t* tok, int here_string) {
+    here_doc_t* here_doc = malloc(sizeof(here_doc_t));
+    if (here_doc == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    here_doc->here_string = here_string;
+    if (here_string) {
+        init_word(&here_doc->body, tok->text);
+    } else {
+        // A quoted delimiter makes the body literal; otherwise only $, `
+        // and \ are special, so the body is expanded only if it has them
+        const char* body = tok->body ? tok->body : "";
+        here_doc->body.text = strdup(body);
+        here_doc->body.flags = strpbrk(tok->text, "'\"\\") == NULL &&
+                               strpbrk(body, "$`\\") != NULL ? WORD_NEEDS_EXPANSION : 0;
+    }
+    return here_doc;
+}
+
+// Check if a token starts a redirection
+static int is_redirection(token_t* tok) {
+    switch (tok->type) {
+        case TOK_LESS: case TOK_GREAT: case TOK_DGREAT: case TOK_LESSAND:
+        case TOK_GREATAND: case TOK_LESSGREAT: case TOK_ANDGREAT: case TOK_ANDDGREAT:
+        case TOK_DLESS: case TOK_DLESSDASH: case TOK_TLESS: case TOK_IO_NUMBER:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Append a redirection to a command
+static redirection_t* add_redirection(command_t* cmd, redir_type_t type, int fd, const char* target) {
+    cmd->redirs = realloc(cmd->redirs, (cmd->num_redirs + 1) * sizeof(redirection_t));
+    if (cmd->redirs == NULL) {
+        perror("realloc failed");
+        exit(1);
+    }
+    redirection_t* r = &cmd->redirs[cmd->num_redirs++];
+    r->type = type;
+    r->fd = fd;
+    init_word(&r->target, target);
+    r->here_doc = NULL;
+    return r;
+}
+
+// Check if a word is a descriptor number or '-' (the target of >& and <&)
+static int is_fd_word(const char* text) {
+    if (strcmp(text, "-") == 0) return 1;
+    if (*text == '\0') return 0;
+    for (; *text != '\0'; text++) {
+        if (*text < '0' || *text > '9') return 0;
     }
+    return 1;
+}
 
-    // Initialize pipeline
-    pipeline->num_commands = 0;
-    for (int i = 0; i < MAX_PIPES; i++) {
-        pipeline->commands[i].input_file = NULL;
-        pipeline->commands[i].output_file = NULL;
-        pipeline->commands[i].background = 0;
-        for (int j = 0; j < MAXARGS; j++) {
-            pipeline->commands[i].args[j] = NULL;
+// Parse one redirection: [n]op word
+static int parse_redirection(parser_t* p, command_t* cmd) {
+    token_t* tok = peek_token(p);
+    int fd = -1;
+    if (tok->type == TOK_IO_NUMBER) {
+        fd = atoi(tok->text);
+        p->pos++;
+        tok = peek_token(p);
+        if (!is_redirection(tok) || tok->type == TOK_IO_NUMBER) {
+            syntax_error(p, tok, NULL);
+            return -1;
         }
     }
 
-    char* tokens[MAX_LEN];
-    int token_count = 0;
-    char* current = expanded_cmdline;
-    
-    // Improved tokenization that handles quotes
-    while (*current != '\0' && token_count < MAX_LEN - 1) {
-        // Skip leading whitespace
-        while (*current == ' ' || *current == '\t') current++;
-        
-        if (*current == '\0') break;
-        
-        // Handle quoted strings
-        if (is_quote(*current)) {
-            char quote = *current;
-            char* start = ++current; // Skip opening quote
-            
-            // Find closing quote
-            while (*current != '\0' && *current != quote) {
-                current++;
-            }
-            
-            if (*current == quote) {
-                tokens[token_count] = malloc(current - start + 1);
-                strncpy(tokens[token_count], start, current - start);
-                tokens[token_count][current - start] = '\0';
-                token_count++;
-                current++; // Skip closing quote
-            } else {
-                // Unclosed quote - use rest of string
-                tokens[token_count] = strdup(start);
-                token_count++;
+    token_t* target = &p->tokens.tokens[p->pos + 1];
+    if (target->type != TOK_WORD) {
+        if (target->type == TOK_EOF) {
+            fprintf(stderr, "Syntax error: no file specified for redirection\n");
+            p->error = 1;
+        } else {
+            syntax_error(p, target, NULL);
+        }
+        return -1;
+    }
+    p->pos += 2;
+
+    switch (tok->type) {
+        case TOK_LESS:
+            add_redirection(cmd, REDIR_INPUT, fd < 0 ? 0 : fd, target->text);
+            break;
+        case TOK_GREAT:
+            add_redirection(cmd, REDIR_OUTPUT, fd < 0 ? 1 : fd, target->text);
+            break;
+        case TOK_DGREAT:
+            add_redirection(cmd, REDIR_APPEND, fd < 0 ? 1 : fd, target->text);
+            break;
+        case TOK_LESSGREAT:
+            add_redirection(cmd, REDIR_RDWR, fd < 0 ? 0 : fd, target->text);
+            break;
+        case TOK_LESSAND:
+            add_redirection(cmd, REDIR_DUP, fd < 0 ? 0 : fd, target->text);
+            break;
+        case TOK_GREATAND:
+            if (fd >= 0 || is_fd_word(target->text)) {
+                add_redirection(cmd, REDIR_DUP, fd < 0 ? 1 : fd, target->text);
                 break;
             }
-        } 
-        // Handle redirection and pipe operators
-        else if (*current == '<' || *current == '>' || *current == '|' || *current == '&' || *current == ';') {
-            tokens[token_count] = malloc(2);
-            tokens[token_count][0] = *current;
-            tokens[token_count][1] = '\0';
-            token_count++;
-            current++;
+            // >&file is the same as &>file
+            /* fall through */
+        case TOK_ANDGREAT:
+        case TOK_ANDDGREAT:
+            // Both stdout and stderr: >file 2>&1
+            add_redirection(cmd, tok->type == TOK_ANDDGREAT ? REDIR_APPEND : REDIR_OUTPUT,
+                            1, target->text);
+            add_redirection(cmd, REDIR_DUP, 2, "1");
+            break;
+        default: {
+            // Here-document or here-string
+            redirection_t* r = add_redirection(cmd, REDIR_HERE_DOC, fd < 0 ? 0 : fd, "");
+            r->here_doc = new_here_doc(target, tok->type == TOK_TLESS);
+            break;
         }
-        // Handle regular tokens
-        else {
-            char* start = current;
-            while (*current != '\0' && *current != ' ' && *current != '\t' && 
-                   *current != '<' && *current != '>' && *current != '|' && 
-                   *current != '&' && *current != ';' && !is_quote(*current)) {
-                current++;
+    }
+    return 0;
+}
+
+// Free an array of words
+void free_word_array(word_t* words, int count) {
+    for (int i = 0; i < count; i++) {
+        free(words[i].text);
+    }
+    free(words);
+}
+
+// Free the redirections of a command
+static void free_redirections(command_t* cmd) {
+    for (int i = 0; i < cmd->num_redirs; i++) {
+        free(cmd->redirs[i].target.text);
+        free_here_doc(cmd->redirs[i].here_doc);
+    }
+    free(cmd->redirs);
+}
+
+// Free memory allocated for an AST node and its children
+void free_node(node_t* node) {
+    if (node == NULL) return;
+
+    switch (node->type) {
+        case NODE_COMMAND:
+            free_word_array(node->command.words, node->command.num_words);
+            free_word_array(node->command.assigns, node->command.num_assigns);
+            free_redirections(&node->command);
+            break;
+        case NODE_PIPELINE:
+            for (int i = 0; i < node->pipeline.num_commands; i++) {
+                free_node(node->pipeline.commands[i]);
             }
-            
-            if (current > start) {
-                tokens[token_count] = malloc(current - start + 1);
-                strncpy(tokens[token_count], start, current - start);
-                tokens[token_count][current - start] = '\0';
-                token_count++;
+            free(node->pipeline.commands);
+            break;
+        case NODE_AND:
+        case NODE_OR:
+            free_node(node->binary.left);
+            free_node(node->binary.right);
+            break;
+        case NODE_LIST:
+            for (int i = 0; i < node->list.count; i++) {
+                free_node(node->list.items[i]);
             }
+            free(node->list.items);
+            break;
+        case NODE_IF:
+            free_if_block(&node->if_block);
+            break;
+        case NODE_WHILE:
+            free_node(node->loop.condition);
+            free_node(node->loop.body);
+            break;
+        case NODE_FOR:
+            free(node->for_loop.var);
+            free_word_array(node->for_loop.words, node->for_loop.num_words);
+            free_node(node->for_loop.body);
+            break;
+        case NODE_FUNCDEF:
+            release_function(node->function);
+            break;
+        case NODE_CASE:
+            free_case_block(&node->case_block);
+            break;
+        case NODE_GROUP:
+        case NODE_SUBSHELL:
+            free_node(node->body);
+            break;
+        case NODE_ARITH:
+            free(node->arith.text);
+            free_arith(node->arith.expr);
+            break;
+    }
+
+    if (node->redirect != NULL) {
+        free_redirections(node->redirect);
+        free(node->redirect);
+    }
+    free(node->source);
+    free(node);
+}
+
+// Look at the next token without consuming it
+token_t* peek_token(parser_t* p) {
+    return &p->tokens.tokens[p->pos];
+}
+
+// Check if a token is the given unquoted reserved word
+int is_keyword(token_t* tok, const char* word) {
+    return tok->type == TOK_WORD && strcmp(tok->text, word) == 0;
+}
+
+// Check if a token ends a compound list
+static int is_list_terminator(token_t* tok) {
+    for (int i = 0; list_terminators[i] != NULL; i++) {
+        if (is_keyword(tok, list_terminators[i])) {
+            return 1;
         }
     }
-    
-    tokens[token_count] = NULL;
+    return 0;
+}
 
-    // Free expanded command line after tokenization
-    free(expanded_cmdline);
+// Report a syntax error at a token. Running out of input is not an error:
+// the caller is asked for more lines instead.
+void syntax_error(parser_t* p, token_t* tok, const char* expected) {
+    if (tok->type == TOK_EOF) {
+        p->incomplete = 1;
+        return;
+    }
+    if (p->error || p->incomplete) {
+        return; // Only report the first problem
+    }
+    const char* text = p->input + tok->start;
+    int len = tok->end - tok->start;
+    if (tok->type == TOK_NEWLINE) {
+        text = "newline";
+        len = 7;
+    }
+    if (expected != NULL) {
+        fprintf(stderr, "Syntax error: expected '%s' near '%.*s'\n", expected, len, text);
+    } else {
+        fprintf(stderr, "Syntax error: unexpected '%.*s'\n", len, text);
+    }
+    p->error = 1;
+}
 
-    if (token_count == 0) {
-        return -1; // Empty command
+// Consume a reserved word if it is next
+int accept_keyword(parser_t* p, const char* word) {
+    if (is_keyword(peek_token(p), word)) {
+        p->pos++;
+        return 1;
     }
+    return 0;
+}
 
-    int cmd_index = 0;
-    int arg_index = 0;
-    int i = 0;
+// Consume a required reserved word, reporting an error if it is missing
+int expect_keyword(parser_t* p, const char* word) {
+    if (accept_keyword(p, word)) {
+        return 1;
+    }
+    syntax_error(p, peek_token(p), word);
+    return 0;
+}
 
-    while (i < token_count) {
-        // Check for pipe symbol
-        if (strcmp(tokens[i], "|") == 0) {
-            pipeline->commands[cmd_index].args[arg_index] = NULL;
-            cmd_index++;
-            arg_index = 0;
-            i++;
-            continue;
-        }
-        
-        // Check for command separator (semicolon)
-        else if (strcmp(tokens[i], ";") == 0) {
-            pipeline->commands[cmd_index].args[arg_index] = NULL;
-            cmd_index++;
-            arg_index = 0;
-            i++;
-            continue;
-        }
-        
-        // Check for input redirection
-        else if (strcmp(tokens[i], "<") == 0) {
-            if (i + 1 < token_count) {
-                pipeline->commands[cmd_index].input_file = strdup(tokens[i + 1]);
-                i += 2;
+// Skip any newline tokens
+void skip_newlines(parser_t* p) {
+    while (peek_token(p)->type == TOK_NEWLINE) {
+        p->pos++;
+    }
+}
+
+// Parse a simple command: assignments, words and redirections
+static node_t* parse_simple_command(parser_t* p) {
+    node_t* node = new_node(NODE_COMMAND);
+    command_t* cmd = &node->command;
+
+    while (1) {
+        token_t* tok = peek_token(p);
+
+        if (is_redirection(tok)) {
+            if (parse_redirection(p, cmd) != 0) {
+                free_node(node);
+                return NULL;
+            }
+        } else if (tok->type == TOK_WORD) {
+            if (cmd->num_words == 0 && is_variable_assignment(tok->text)) {
+                append_word(&cmd->assigns, &cmd->num_assigns, tok->text);
             } else {
-                fprintf(stderr, "Syntax error: no file specified for input redirection\n");
-                return -1;
+                append_word(&cmd->words, &cmd->num_words, tok->text);
+                // Arguments like 'local x=$y' are assignments: no field splitting
+                if (cmd->num_words > 1 && is_declaration(cmd->words[0].text) &&
+                    is_variable_assignment(tok->text)) {
+                    cmd->words[cmd->num_words - 1].flags |= WORD_ASSIGNMENT;
+                }
             }
+            p->pos++;
+        } else {
+            break;
         }
-        
-        // Check for output redirection
-        else if (strcmp(tokens[i], ">") == 0) {
-            if (i + 1 < token_count) {
-                pipeline->commands[cmd_index].output_file = strdup(tokens[i + 1]);
-                i += 2;
-            } else {
-                fprintf(stderr, "Syntax error: no file specified for output redirection\n");
-                return -1;
+    }
+
+    return node;
+}
+
+// Parse the redirections after a compound command ('done < file',
+// '} > file') into node->redirect
+static node_t* parse_trailing_redirections(parser_t* p, node_t* node) {
+    if (node == NULL) return NULL;
+
+    while (is_redirection(peek_token(p))) {
+        if (node->redirect == NULL) {
+            node->redirect = calloc(1, sizeof(command_t));
+            if (node->redirect == NULL) {
+                perror("calloc failed");
+                exit(1);
             }
         }
-        
-        // Check for background execution
-        else if (strcmp(tokens[i], "&") == 0) {
-            pipeline->commands[cmd_index].background = 1;
-            i++;
+        if (parse_redirection(p, node->redirect) != 0) {
+            free_node(node);
+            return NULL;
         }
-        
-        // Regular argument
-        else {
-            pipeline->commands[cmd_index].args[arg_index++] = strdup(tokens[i++]);
+    }
+    return node;
+}
+
+// Parse a command: a compound command, a function definition or a simple command
+node_t* parse_command(parser_t* p) {
+    token_t* tok = peek_token(p);
+
+    if (is_keyword(tok, "function") ||
+        (tok->type == TOK_WORD && p->tokens.tokens[p->pos + 1].type == TOK_LPAREN)) {
+        return parse_function_def(p);
+    }
+
+    if (is_keyword(tok, "if")) {
+        return parse_trailing_redirections(p, parse_if_block(p));
+    }
+    if (is_keyword(tok, "while") || is_keyword(tok, "until")) {
+        return parse_trailing_redirections(p, parse_while_loop(p));
+    }
+    if (is_keyword(tok, "for")) {
+        return parse_trailing_redirections(p, parse_for_loop(p));
+    }
+    if (is_keyword(tok, "case")) {
+        return parse_trailing_redirections(p, parse_case_block(p));
+    }
+
+    if (is_keyword(tok, "{") || tok->type == TOK_LPAREN) {
+        int group = tok->type == TOK_WORD;
+        p->pos++;
+        node_t* body = parse_compound_list(p);
+        if (body == NULL) return NULL;
+        if (group) {
+            if (!expect_keyword(p, "}")) {
+                free_node(body);
+                return NULL;
+            }
+        } else {
+            if (peek_token(p)->type != TOK_RPAREN) {
+                syntax_error(p, peek_token(p), ")");
+                free_node(body);
+                return NULL;
+            }
+            p->pos++;
         }
+        node_t* node = new_node(group ? NODE_GROUP : NODE_SUBSHELL);
+        node->body = body;
+        return parse_trailing_redirections(p, node);
+    }
 
-        // Check bounds
-        if (cmd_index >= MAX_PIPES) {
-            fprintf(stderr, "Error: too many commands (max %d)\n", MAX_PIPES);
-            // Free tokens before returning
-            for (int j = 0; j < token_count; j++) free(tokens[j]);
-            return -1;
+    if (tok->type == TOK_ARITH) {
+        // Compile now so loops reuse the bytecode; expressions with $
+        // references are compiled (and cached) after expansion
+        arith_expr_t* expr = NULL;
+        if (strchr(tok->text, '$') == NULL) {
+            expr = compile_arith(tok->text);
+            if (expr == NULL) {
+                p->error = 1;
+                return NULL;
+            }
         }
-        if (arg_index >= MAXARGS - 1) {
-            fprintf(stderr, "Error: too many arguments (max %d)\n", MAXARGS);
-            // Free tokens before returning
-            for (int j = 0; j < token_count; j++) free(tokens[j]);
-            return -1;
+        p->pos++;
+        node_t* node = new_node(NODE_ARITH);
+        node->arith.text = strdup(tok->text);
+        node->arith.expr = expr;
+        return node;
+    }
+
+    if (tok->type == TOK_WORD || is_redirection(tok)) {
+        return parse_simple_command(p);
+    }
+
+    syntax_error(p, tok, NULL);
+    return NULL;
+}
+
+// Parse a pipeline: [!] command | command ...
+static node_t* parse_pipeline(parser_t* p) {
+    int negate = accept_keyword(p, "!");
+
+    node_t* cmd = parse_command(p);
+    if (cmd == NULL) return NULL;
+
+    if (!negate && peek_token(p)->type != TOK_PIPE) {
+        return cmd; // Plain command, no pipeline node needed
+    }
+
+    node_t* node = new_node(NODE_PIPELINE);
+    node->pipeline.negate = negate;
+    append_node(&node->pipeline.commands, &node->pipeline.num_commands, cmd);
+
+    while (peek_token(p)->type == TOK_PIPE) {
+        p->pos++;
+        skip_newlines(p);
+        cmd = parse_command(p);
+        if (cmd == NULL) {
+            free_node(node);
+            return NULL;
         }
+        append_node(&node->pipeline.commands, &node->pipeline.num_commands, cmd);
+    }
+
+    return node;
+}
+
+// Parse pipelines joined by && and ||
+static node_t* parse_and_or(parser_t* p) {
+    node_t* left = parse_pipeline(p);
+    if (left == NULL) return NULL;
+
+    while (peek_token(p)->type == TOK_AND_IF || peek_token(p)->type == TOK_OR_IF) {
+        node_type_t type = peek_token(p)->type == TOK_AND_IF ? NODE_AND : NODE_OR;
+        p->pos++;
+        skip_newlines(p);
+
+        node_t* right = parse_pipeline(p);
+        if (right == NULL) {
+            free_node(left);
+            return NULL;
+        }
+
+        node_t* node = new_node(type);
+        node->binary.left = left;
+        node->binary.right = right;
+        left = node;
     }
 
-    // Terminate the last command's argument list
-    if (arg_index > 0) {
-        pipeline->commands[cmd_index].args[arg_index] = NULL;
-    }
-    
-    pipeline->num_commands = cmd_index + 1;
-    
-    // Free tokens
-    for (int j = 0; j < token_count; j++) free(tokens[j]);
-    
-    return pipeline->num_commands;
-}
-
-// Free memory allocated for pipeline
-void free_pipeline(pipeline_t* pipeline) {
-    if (pipeline == NULL) return;
-    
-    for (int i = 0; i < pipeline->num_commands; i++) {
-        command_t* cmd = &pipeline->commands[i];
-        
-        if (cmd->input_file) {
-            free(cmd->input_file);
-            cmd->input_file = NULL;
+    return left;
+}
+
+// Parse a sequence of and-or lists separated by ; & or newlines.
+// Stops at end of input, ')', ';;' or a reserved word that closes a block.
+node_t* parse_list(parser_t* p) {
+    node_t* list = new_node(NODE_LIST);
+
+    while (1) {
+        skip_newlines(p);
+        token_t* tok = peek_token(p);
+        if (tok->type == TOK_EOF || tok->type == TOK_RPAREN || tok->type == TOK_DSEMI ||
+            is_list_terminator(tok)) {
+            break;
         }
-        if (cmd->output_file) {
-            free(cmd->output_file);
-            cmd->output_file = NULL;
+
+        int first = p->pos;
+        node_t* item = parse_and_or(p);
+        if (item == NULL) {
+            free_node(list);
+            return NULL;
         }
-        
-        for (int j = 0; j < MAXARGS && cmd->args[j] != NULL; j++) {
-            free(cmd->args[j]);
-            cmd->args[j] = NULL;
+        append_node(&list->list.items, &list->list.count, item);
+
+        tok = peek_token(p);
+        if (tok->type == TOK_AMP) {
+            // Keep the source text so the job table can display it
+            int start = p->tokens.tokens[first].start;
+            int end = p->tokens.tokens[p->pos - 1].end;
+            item->background = 1;
+            item->source = strndup(p->input + start, end - start);
+            p->pos++;
+        } else if (tok->type == TOK_SEMI || tok->type == TOK_NEWLINE) {
+            p->pos++;
+        } else {
+            break;
         }
     }
-    pipeline->num_commands = 0;
+
+    // A single foreground command does not need a list wrapper
+    if (list->list.count == 1 && !list->list.items[0]->background) {
+        node_t* item = list->list.items[0];
+        list->list.count = 0;
+        free_node(list);
+        return item;
+    }
+
+    return list;
+}
+
+// Parse a non-empty list inside a compound command
+node_t* parse_compound_list(parser_t* p) {
+    node_t* list = parse_list(p);
+    if (list == NULL) return NULL;
+
+    if (list->type == NODE_LIST && list->list.count == 0) {
+        syntax_error(p, peek_token(p), NULL);
+        free_node(list);
+        return NULL;
+    }
+
+    return list;
+}
+
+// Parse a complete program into an AST. The tree is built once and can be
+// executed any number of times; words are expanded only at execution time.
+int parse_program(const char* input, node_t** tree) {
+    parser_t p;
+    *tree = NULL;
+
+    int result = lex_input(input, &p.tokens);
+    if (result != PARSE_OK) {
+        return result;
+    }
+
+    p.input = input;
+    p.pos = 0;
+    p.incomplete = 0;
+    p.error = 0;
+
+    node_t* list = parse_list(&p);
+    if (list != NULL && peek_token(&p)->type != TOK_EOF) {
+        syntax_error(&p, peek_token(&p), NULL);
+    }
+
+    free_tokens(&p.tokens);
+
+    if (p.incomplete || p.error || list == NULL) {
+        free_node(list);
+        return p.incomplete && !p.error ? PARSE_INCOMPLETE : PARSE_ERROR;
+    }
+
+    if (list->type == NODE_LIST && list->list.count == 0) {
+        free_node(list);
+        return PARSE_OK; // Empty input
+    }
+
+    *tree = list;
+    return PARSE_OK;
 }
@@ -0,0 +1,417 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#define DIR_CACHE_SIZE 64        // Hash buckets for directory listings
+#define GETDENTS_BUF 65536       // Bytes per getdents64 call
+#define WALK_THREADS_MAX 8       // Worker threads for ** recursion
+
+// Directory entry as returned by getdents64
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Names in one directory, read once per command
+typedef struct dir_listing {
+    char* path;                  // Directory prefix ("" or "dir/")
+    char** names;
+    unsigned char* types;        // d_type of each name
+    int count;
+    struct dir_listing* next;
+} dir_listing_t;
+
+// Listings shared by all globs of one command; safe to use from the
+// ** walker threads
+struct dir_cache {
+    dir_listing_t* buckets[DIR_CACHE_SIZE];
+    pthread_mutex_t lock;
+};
+
+// Growable list of paths
+typedef struct {
+    char** items;
+    int count;
+    int capacity;
+} path_list_t;
+
+// Append a path, taking ownership of the string
+static void add_path(path_list_t* list, char* path) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->items = realloc(list->items, list->capacity * sizeof(char*));
+        if (list->items == NULL) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    list->items[list->count++] = path;
+}
+
+// Free a path list and its strings
+static void free_paths(path_list_t* list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+// Join a directory prefix and a name, with a trailing slash if dir is set
+static char* join_path(const char* prefix, const char* name, int dir) {
+    size_t plen = strlen(prefix), nlen = strlen(name);
+    char* path = malloc(plen + nlen + 2);
+    if (path == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    memcpy(path, prefix, plen);
+    memcpy(path + plen, name, nlen);
+    if (dir) path[plen + nlen++] = '/';
+    path[plen + nlen] = '\0';
+    return path;
+}
+
+// Create an empty directory cache
+dir_cache_t* dir_cache_new() {
+    dir_cache_t* cache = calloc(1, sizeof(dir_cache_t));
+    if (cache == NULL) {
+        perror("calloc failed");
+        exit(1);
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+// Free a directory cache and all its listings
+void dir_cache_free(dir_cache_t* cache) {
+    if (cache == NULL) return;
+    for (int i = 0; i < DIR_CACHE_SIZE; i++) {
+        dir_listing_t* listing = cache->buckets[i];
+        while (listing != NULL) {
+            dir_listing_t* next = listing->next;
+            for (int j = 0; j < listing->count; j++) {
+                free(listing->names[j]);
+            }
+            free(listing->names);
+            free(listing->types);
+            free(listing->path);
+            free(listing);
+            listing = next;
+        }
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+// Read a directory with large getdents64 calls. A directory that cannot be
+// opened gives an empty listing.
+static dir_listing_t* read_listing(const char* path) {
+    dir_listing_t* listing = calloc(1, sizeof(dir_listing_t));
+    if (listing == NULL) {
+        perror("calloc failed");
+        exit(1);
+    }
+    listing->path = strdup(path);
+
+    int fd = open(path[0] ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return listing;
+    }
+
+    char* buf = malloc(GETDENTS_BUF);
+    int capacity = 0;
+    long n;
+    while (buf != NULL && (n = syscall(SYS_getdents64, fd, buf, GETDENTS_BUF)) > 0) {
+        for (long off = 0; off < n; ) {
+            struct linux_dirent64* d = (struct linux_dirent64*)(buf + off);
+            off += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+                continue;
+            }
+            if (listing->count == capacity) {
+                capacity = capacity ? capacity * 2 : 32;
+                listing->names = realloc(listing->names, capacity * sizeof(char*));
+                listing->types = realloc(listing->types, capacity);
+                if (listing->names == NULL || listing->types == NULL) {
+                    perror("realloc failed");
+                    exit(1);
+                }
+            }
+            listing->names[listing->count] = strdup(d->d_name);
+            listing->types[listing->count] = d->d_type;
+            listing->count++;
+        }
+    }
+
+    free(buf);
+    close(fd);
+    return listing;
+}
+
+// Get the listing of a directory, reading it on first use
+static dir_listing_t* get_listing(dir_cache_t* cache, const char* path) {
+    unsigned int bucket = hash_string(path) % DIR_CACHE_SIZE;
+
+    pthread_mutex_lock(&cache->lock);
+    for (dir_listing_t* l = cache->buckets[bucket]; l != NULL; l = l->next) {
+        if (strcmp(l->path, path) == 0) {
+            pthread_mutex_unlock(&cache->lock);
+            return l;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    dir_listing_t* listing = read_listing(path);
+
+    pthread_mutex_lock(&cache->lock);
+    listing->next = cache->buckets[bucket];
+    cache->buckets[bucket] = listing;
+    pthread_mutex_unlock(&cache->lock);
+    return listing;
+}
+
+// Check if a listed entry is a directory. Symlinks are followed unless
+// nofollow is set (the ** walk does not descend through them).
+static int is_directory(const char* prefix, const char* name, unsigned char type, int nofollow) {
+    if (type == DT_DIR) return 1;
+    if (type != DT_UNKNOWN && (type != DT_LNK || nofollow)) return 0;
+
+    char* path = join_path(prefix, name, 0);
+    struct stat st;
+    int result = (nofollow ? lstat(path, &st) : stat(path, &st)) == 0 && S_ISDIR(st.st_mode);
+    free(path);
+    return result;
+}
+
+// Check if a name can match a pattern component: a leading '.' must be
+// matched by a literal '.'
+static int name_matches(const glob_pattern_t* g, const char* name) {
+    if (name[0] == '.' && (g->count == 0 || g->elems[0].op != GLOB_CHAR || g->elems[0].ch != '.')) {
+        return 0;
+    }
+    return glob_match(g, name);
+}
+
+// Shared state of a parallel ** walk
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    path_list_t queue;           // Directories waiting to be read
+    path_list_t *found;          // Every directory reached (output)
+    int busy;                    // Workers reading a directory
+    dir_cache_t* cache;
+} walk_t;
+
+// Read one directory of a ** walk and queue its subdirectories
+static void walk_directory(walk_t* walk, const char* dir) {
+    dir_listing_t* listing = get_listing(walk->cache, dir);
+    path_list_t subdirs = { NULL, 0, 0 };
+
+    for (int i = 0; i < listing->count; i++) {
+        const char* name = listing->names[i];
+        if (name[0] != '.' && is_directory(dir, name, listing->types[i], 1)) {
+            add_path(&subdirs, join_path(dir, name, 1));
+        }
+    }
+
+    pthread_mutex_lock(&walk->lock);
+    for (int i = 0; i < subdirs.count; i++) {
+        add_path(&walk->queue, subdirs.items[i]);
+        add_path(walk->found, strdup(subdirs.items[i]));
+    }
+    pthread_mutex_unlock(&walk->lock);
+    free(subdirs.items);
+}
+
+// Worker: take directories from the queue until it is empty and idle
+static void* walk_worker(void* arg) {
+    walk_t* walk = arg;
+
+    pthread_mutex_lock(&walk->lock);
+    for (;;) {
+        while (walk->queue.count == 0 && walk->busy > 0) {
+            pthread_cond_wait(&walk->cond, &walk->lock);
+        }
+        if (walk->queue.count == 0) {
+            break; // Nothing queued and nobody can queue more
+        }
+        char* dir = walk->queue.items[--walk->queue.count];
+        walk->busy++;
+        pthread_mutex_unlock(&walk->lock);
+
+        walk_directory(walk, dir);
+        free(dir);
+
+        pthread_mutex_lock(&walk->lock);
+        walk->busy--;
+        pthread_cond_broadcast(&walk->cond);
+    }
+    pthread_mutex_unlock(&walk->lock);
+    return NULL;
+}
+
+// Collect base and every non-hidden directory below it. The first level is
+// read here; deeper levels are read by a pool of threads.
+static void walk_tree(dir_cache_t* cache, const char* base, path_list_t* found) {
+    walk_t walk;
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.cond, NULL);
+    walk.queue = (path_list_t){ NULL, 0, 0 };
+    walk.found = found;
+    walk.busy = 0;
+    walk.cache = cache;
+
+    add_path(found, strdup(base));
+    walk_directory(&walk, base);
+
+    if (walk.queue.count > 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int nthreads = cpus < 1 ? 1 : cpus > WALK_THREADS_MAX ? WALK_THREADS_MAX : (int)cpus;
+        if (nthreads > walk.queue.count) nthreads = walk.queue.count;
+
+        pthread_t threads[WALK_THREADS_MAX];
+        int started = 0;
+        for (int i = 0; i < nthreads; i++) {
+            if (pthread_create(&threads[started], NULL, walk_worker, &walk) == 0) {
+                started++;
+            }
+        }
+        if (started == 0) {
+            walk_worker(&walk); // No threads available: walk here
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    free_paths(&walk.queue);
+    pthread_cond_destroy(&walk.cond);
+    pthread_mutex_destroy(&walk.lock);
+}
+
+// Remove backslash escapes from a pattern component
+static char* unescape(const char* text, size_t len) {
+    char* out = malloc(len + 1);
+    if (out == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    size_t j = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == '\\' && i + 1 < len) i++;
+        out[j++] = text[i];
+    }
+    out[j] = '\0';
+    return out;
+}
+
+// Sort comparison for results
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Expand a pattern (quoted characters backslash-escaped) into the sorted
+// list of matching paths. Returns the number of matches; *matches is a
+// NULL-terminated array when there is at least one.
+int expand_pathname(const char* pattern, dir_cache_t* cache, char*** matches) {
+    path_list_t current = { NULL, 0, 0 };
+    int check_exists = 0;  // A literal component followed a wildcard one
+    int globbed = 0;
+
+    add_path(&current, strdup(*pattern == '/' ? "/" : ""));
+    const char* p = pattern;
+    while (*p == '/') p++;
+
+    while (current.count > 0) {
+        const char* slash = strchr(p, '/');
+        size_t len = slash ? (size_t)(slash - p) : strlen(p);
+        int last = slash == NULL;
+        path_list_t next = { NULL, 0, 0 };
+
+        char* component = strndup(p, len);
+        glob_pattern_t* g = compile_glob(component);
+
+        if (strcmp(component, "**") == 0) {
+            // Zero or more directories; as the last component, everything below
+            for (int i = 0; i < current.count; i++) {
+                path_list_t dirs = { NULL, 0, 0 };
+                walk_tree(cache, current.items[i], &dirs);
+                for (int j = 0; j < dirs.count; j++) {
+                    if (!last || (j == 0 && dirs.items[0][0] != '\0')) {
+                        add_path(&next, strdup(dirs.items[j])); // dir/** includes dir/
+                        if (!last) continue;
+                    }
+                    dir_listing_t* listing = get_listing(cache, dirs.items[j]);
+                    for (int k = 0; k < listing->count; k++) {
+                        if (listing->names[k][0] != '.') {
+                            add_path(&next, join_path(dirs.items[j], listing->names[k], 0));
+                        }
+                    }
+                }
+                free_paths(&dirs);
+            }
+            globbed = 1;
+            check_exists = 0;
+        } else if (g->has_wildcards) {
+            for (int i = 0; i < current.count; i++) {
+                const char* dir = current.items[i];
+                dir_listing_t* listing = get_listing(cache, dir);
+                for (int k = 0; k < listing->count; k++) {
+                    const char* name = listing->names[k];
+                    if (!name_matches(g, name)) continue;
+                    if (!last && !is_directory(dir, name, listing->types[k], 0)) continue;
+                    add_path(&next, join_path(dir, name, !last));
+                }
+            }
+            globbed = 1;
+            check_exists = 0;
+        } else {
+            // Literal component: append without reading the directory
+            char* name = unescape(p, len);
+            for (int i = 0; i < current.count; i++) {
+                add_path(&next, join_path(current.items[i], name, !last && len > 0));
+            }
+            free(name);
+            check_exists = globbed;
+        }
+
+        free_glob(g);
+        free(component);
+        free_paths(&current);
+        current = next;
+
+        if (last) break;
+        p = slash + 1;
+    }
+
+    // Paths ending in a literal name may not exist
+    int count = 0;
+    for (int i = 0; i < current.count; i++) {
+        struct stat st;
+        if (check_exists && lstat(current.items[i], &st) != 0) {
+            free(current.items[i]);
+        } else {
+            current.items[count++] = current.items[i];
+        }
+    }
+    current.count = count;
+
+    if (!globbed || count == 0) {
+        free_paths(&current);
+        *matches = NULL;
+        return 0;
+    }
+
+    qsort(current.items, count, sizeof(char*), compare_paths);
+    add_path(&current, NULL);
+    *matches = current.items;
+    return count;
+}
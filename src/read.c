@@ -0,0 +1,320 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#define READ_BLOCK 65536      // Bytes read ahead from seekable input
+#define READ_CACHE_FDS 10     // Descriptors 0-9 get a read-ahead buffer
+#define READ_PEEK 256         // Bytes first looked at in pipe input
+
+// Read-ahead buffer of a seekable descriptor. The block stays valid while
+// the descriptor still refers to the same unmodified file, so a loop of
+// reads costs an lseek per line instead of a read of the block.
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    off_t start;              // File offset of data[0]
+    char* data;
+    size_t len;
+} read_cache_t;
+
+static read_cache_t read_cache[READ_CACHE_FDS];
+
+// Scratch pipe used to peek at pipe input with tee(2)
+static int peek_pipe[2] = { -1, -1 };
+
+// Read from a seekable descriptor up to and including the delimiter, then
+// lseek back to just after it so the next reader starts at the right place.
+// Returns 1 if the delimiter was found, 0 at end of input, -1 if the
+// descriptor can't seek.
+static int read_seekable(int fd, char delim, strbuf_t* out) {
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    struct stat st;
+    if (pos < 0 || fstat(fd, &st) != 0) {
+        return -1;
+    }
+
+    read_cache_t local = { 0 };
+    read_cache_t* c = fd >= 0 && fd < READ_CACHE_FDS ? &read_cache[fd] : &local;
+    if (c->dev != st.st_dev || c->ino != st.st_ino || c->size != st.st_size ||
+        c->mtime.tv_sec != st.st_mtim.tv_sec || c->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+        c->len = 0; // Different or modified file
+    }
+    c->dev = st.st_dev;
+    c->ino = st.st_ino;
+    c->size = st.st_size;
+    c->mtime = st.st_mtim;
+
+    for (;;) {
+        if (pos < c->start || pos >= c->start + (off_t)c->len) {
+            if (c->data == NULL) {
+                c->data = malloc(READ_BLOCK);
+                if (c->data == NULL) {
+                    perror("malloc failed");
+                    exit(1);
+                }
+            }
+            ssize_t n = pread(fd, c->data, READ_BLOCK, pos);
+            if (n < 0 && errno == EINTR) continue;
+            c->start = pos;
+            c->len = n > 0 ? n : 0;
+            if (n <= 0) break;
+        }
+
+        const char* p = c->data + (pos - c->start);
+        size_t avail = c->len - (pos - c->start);
+        const char* end = memchr(p, delim, avail);
+        if (end != NULL) {
+            sb_appendn(out, p, end - p);
+            lseek(fd, pos + (end - p) + 1, SEEK_SET);
+            if (c == &local) free(local.data);
+            return 1;
+        }
+        sb_appendn(out, p, avail);
+        pos += avail;
+    }
+
+    lseek(fd, pos, SEEK_SET);
+    if (c == &local) free(local.data);
+    return 0;
+}
+
+// Read from a pipe up to and including the delimiter without taking any
+// more: tee(2) copies what is buffered into a scratch pipe to look for the
+// delimiter, then exactly that much is read from the input. Returns -1 if
+// the descriptor is not a pipe.
+static int read_pipe(int fd, char delim, strbuf_t* out) {
+    if (peek_pipe[0] < 0 && pipe2(peek_pipe, O_CLOEXEC) != 0) {
+        return -1;
+    }
+
+    // Peek at a little first since most records are short lines
+    char* buf = NULL;
+    size_t peek = READ_PEEK;
+    int result = 0;
+    for (;;) {
+        ssize_t n = tee(fd, peek_pipe[1], peek, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            result = out->len == 0 && buf == NULL ? -1 : 0;
+            break;
+        }
+        if (n == 0) break;
+
+        if (buf == NULL) {
+            buf = malloc(READ_BLOCK);
+            if (buf == NULL) {
+                perror("malloc failed");
+                exit(1);
+            }
+        }
+        // Drain the copy, find the delimiter, then consume that much
+        ssize_t got = 0;
+        while (got < n) {
+            ssize_t r = read(peek_pipe[0], buf + got, n - got);
+            if (r <= 0) break;
+            got += r;
+        }
+        const char* end = memchr(buf, delim, got);
+        ssize_t take = end != NULL ? end - buf + 1 : got;
+        for (ssize_t done = 0; done < take; ) {
+            ssize_t r = read(fd, buf + done, take - done);
+            if (r <= 0) break;
+            done += r;
+        }
+        if (end != NULL) {
+            sb_appendn(out, buf, take - 1);
+            result = 1;
+            break;
+        }
+        sb_appendn(out, buf, take);
+        if (peek < READ_BLOCK) peek *= 2;
+    }
+
+    free(buf);
+    return result;
+}
+
+// Read one delimited record from fd into out (without the delimiter).
+// Returns 1 if the delimiter was seen, 0 at end of input.
+static int read_record(int fd, char delim, strbuf_t* out) {
+    struct stat st;
+    int result = -1;
+    if (fstat(fd, &st) == 0) {
+        if (S_ISFIFO(st.st_mode)) {
+            result = read_pipe(fd, delim, out);
+        } else if (!S_ISCHR(st.st_mode)) {
+            result = read_seekable(fd, delim, out);
+        }
+    }
+    if (result >= 0) {
+        return result;
+    }
+
+    // Terminals, sockets and the like: a byte at a time
+    char c;
+    for (;;) {
+        ssize_t n = read(fd, &c, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        if (c == delim) return 1;
+        sb_putc(out, c);
+    }
+}
+
+// Check for the whitespace characters IFS splits on
+static int is_ifs_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// Built-in command: read [-r] [-d delim] [name...]
+// Splits the record on whitespace; the last name gets the rest of it.
+// Without names the whole record goes to REPLY.
+int builtin_read(char** arglist) {
+    int raw = 0;
+    char delim = '\n';
+    int i = 1;
+    for (; arglist[i] != NULL && arglist[i][0] == '-'; i++) {
+        if (strcmp(arglist[i], "-r") == 0) {
+            raw = 1;
+        } else if (strcmp(arglist[i], "-d") == 0 && arglist[i + 1] != NULL) {
+            delim = arglist[++i][0]; // -d '' reads up to a NUL byte
+        } else if (strcmp(arglist[i], "--") == 0) {
+            i++;
+            break;
+        } else {
+            fprintf(stderr, "read: usage: read [-r] [-d delim] [name...]\n");
+            return 2;
+        }
+    }
+    char** names = &arglist[i];
+    for (char** n = names; *n != NULL; n++) {
+        if (!is_valid_name(*n)) {
+            fprintf(stderr, "read: `%s': not a valid identifier\n", *n);
+            return 2;
+        }
+    }
+
+    // Unless -r, a backslash quotes the next character and
+    // backslash-delimiter continues the record
+    strbuf_t line, quoted;
+    sb_init(&line);
+    sb_init(&quoted);
+    int found;
+    for (;;) {
+        strbuf_t record;
+        sb_init(&record);
+        found = read_record(STDIN_FILENO, delim, &record);
+        int continued = 0;
+        for (size_t k = 0; k < record.len; k++) {
+            if (!raw && record.data[k] == '\\') {
+                if (k + 1 == record.len) {
+                    continued = found;
+                    break;
+                }
+                k++;
+                sb_putc(&quoted, 1);
+            } else {
+                sb_putc(&quoted, 0);
+            }
+            sb_putc(&line, record.data[k]);
+        }
+        sb_free(&record);
+        if (!continued) break;
+    }
+
+    const char* text = line.data != NULL ? line.data : "";
+    const char* q = quoted.data;
+    size_t len = line.len;
+
+    if (*names == NULL) {
+        set_variable("REPLY", text);
+    } else {
+        size_t pos = 0;
+        for (; *names != NULL; names++) {
+            while (pos < len && is_ifs_space(text[pos]) && !q[pos]) pos++;
+            size_t start = pos;
+            size_t end;
+            if (names[1] == NULL) {
+                // Last name: the rest, minus trailing whitespace
+                end = len;
+                while (end > start && is_ifs_space(text[end - 1]) && !q[end - 1]) end--;
+                pos = len;
+            } else {
+                while (pos < len && !(is_ifs_space(text[pos]) && !q[pos])) pos++;
+                end = pos;
+            }
+            char* value = strndup(text + start, end - start);
+            set_variable(*names, value);
+            free(value);
+        }
+    }
+
+    sb_free(&line);
+    sb_free(&quoted);
+    return found ? 0 : 1;
+}
+
+// Built-in commands: mapfile and readarray [-t] [-d delim] [array]
+// Reads all of stdin in bulk and splits it into array elements (default
+// MAPFILE); -t drops the delimiter from each element.
+int builtin_mapfile(char** arglist) {
+    int trim = 0;
+    char delim = '\n';
+    int i = 1;
+    for (; arglist[i] != NULL && arglist[i][0] == '-'; i++) {
+        if (strcmp(arglist[i], "-t") == 0) {
+            trim = 1;
+        } else if (strcmp(arglist[i], "-d") == 0 && arglist[i + 1] != NULL) {
+            delim = arglist[++i][0];
+        } else {
+            fprintf(stderr, "%s: usage: %s [-t] [-d delim] [array]\n", arglist[0], arglist[0]);
+            return 2;
+        }
+    }
+    const char* name = arglist[i] != NULL ? arglist[i] : "MAPFILE";
+    if (!is_valid_name(name)) {
+        fprintf(stderr, "%s: `%s': not a valid identifier\n", arglist[0], name);
+        return 2;
+    }
+
+    // One read of the whole remaining file when its size is known
+    strbuf_t data;
+    sb_init(&data);
+    struct stat st;
+    off_t pos = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && pos >= 0 && st.st_size > pos) {
+        sb_reserve(&data, st.st_size - pos);
+    }
+    for (;;) {
+        sb_reserve(&data, READ_BLOCK);
+        ssize_t n = read(STDIN_FILENO, data.data + data.len, data.cap - data.len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        data.len += n;
+    }
+
+    // memchr scans a word (or vector) at a time
+    int count = 0, cap = 0;
+    char** items = NULL;
+    const char* p = data.data;
+    const char* limit = data.data + data.len;
+    while (p < limit) {
+        const char* end = memchr(p, delim, limit - p);
+        const char* next = end != NULL ? end + 1 : limit;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            items = realloc(items, cap * sizeof(char*));
+            if (items == NULL) {
+                perror("realloc failed");
+                exit(1);
+            }
+        }
+        items[count++] = strndup(p, (trim && end != NULL ? end : next) - p);
+        p = next;
+    }
+
+    set_array(name, items, count);
+    sb_free(&data);
+    return 0;
+}
@@ -7,7 +7,8 @@ char* command_generator(const char* text, int state) {
     
     // List of built-in commands for completion
     static const char* builtin_commands[] = {
-        "cd", "exit", "help", "history", "jobs", NULL
+        "cd", "exit", "help", "history", "jobs", "set",
+        "true", "false", "break", "continue", NULL
     };
     
     // Common system commands for completion
@@ -1,134 +1,550 @@
+#define _GNU_SOURCE
 #include "shell.h"
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+#include <signal.h>
 
-// Execute a single command with redirection
-int execute_redirection(command_t* cmd) {
-    if (cmd == NULL || cmd->args[0] == NULL) {
+#define HERE_DOC_PIPE_MAX 65536  // Larger bodies go to a memfd instead of a pipe
+#define PIPE_SAMPLE_USEC 2000    // Interval between pipe fill samples (set -o pipestats)
+
+// Sample pipe fill levels while pipelines run (set -o pipestats)
+int pipe_stats = 0;
+
+__thread int stage_in = STDIN_FILENO;
+__thread int stage_out = STDOUT_FILENO;
+static __thread FILE* stage_file = NULL;  // Buffered stage_out of a thread
+
+// Stream the running builtin writes its output to
+FILE* stage_stream() {
+    return stage_file != NULL ? stage_file : stdout;
+}
+
+// Return a descriptor to read 'len' bytes of data from. Small bodies fit in
+// a pipe buffer; larger ones are written to an in-memory file.
+static int here_doc_fd(const char* data, size_t len) {
+    int fds[2];
+    if (len <= HERE_DOC_PIPE_MAX && pipe(fds) == 0) {
+        if (fcntl(fds[1], F_GETPIPE_SZ) >= (int)len) {
+            if (write(fds[1], data, len) == (ssize_t)len) {
+                close(fds[1]);
+                return fds[0];
+            }
+        }
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    int fd = memfd_create("here-document", MFD_CLOEXEC);
+    if (fd < 0) {
+        perror("memfd_create");
         return -1;
     }
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, data + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("write");
+            close(fd);
+            return -1;
+        }
+        done += n;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
 
-    // Handle built-in commands separately (they don't fork)
-    if (handle_builtin(cmd->args)) {
-        return 0;
+// Record the current state of fd so restore_redirections() can put it back
+static void save_fd(redir_undo_t* undo, int fd) {
+    if (undo == NULL) return;
+    for (int i = 0; i < undo->count; i++) {
+        if (undo->items[i].fd == fd) return; // Original already saved
     }
+    undo->items = realloc(undo->items, (undo->count + 1) * sizeof(saved_fd_t));
+    if (undo->items == NULL) {
+        perror("realloc failed");
+        exit(1);
+    }
+    // Keep the backup out of the way of the exec'd program
+    undo->items[undo->count].fd = fd;
+    undo->items[undo->count].backup = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    undo->count++;
+}
+
+// Open the source descriptor of one redirection. *owned is set if the
+// caller must close it after dup2(). Returns -2 for n>&- (close n).
+static int open_source(redirection_t* r, int* owned) {
+    static const int open_flags[] = {
+        [REDIR_INPUT] = O_RDONLY,
+        [REDIR_OUTPUT] = O_WRONLY | O_CREAT | O_TRUNC,
+        [REDIR_APPEND] = O_WRONLY | O_CREAT | O_APPEND,
+        [REDIR_RDWR] = O_RDWR | O_CREAT,
+    };
+    *owned = 1;
 
-    // Handle background execution
-    if (cmd->background) {
-        return execute_background(cmd);
+    if (r->type == REDIR_HERE_DOC) {
+        char* data = expand_here_doc(r->here_doc);
+        int fd = here_doc_fd(data, strlen(data));
+        free(data);
+        return fd;
+    }
+
+    expansion_error = 0;
+    char* target = expand_word_string(&r->target);
+    if (expansion_error) {
+        free(target);
+        expansion_failed();
+        return -1;
     }
+    int fd;
+
+    if (r->type == REDIR_DUP) {
+        *owned = 0;
+        char* end;
+        long n = strtol(target, &end, 10);
+        if (strcmp(target, "-") == 0) {
+            fd = -2;
+        } else if (*target == '\0' || *end != '\0' || n < 0 || n > 1023 ||
+                   fcntl((int)n, F_GETFD) < 0) {
+            fprintf(stderr, "%s: bad file descriptor\n", target);
+            fd = -1;
+        } else {
+            fd = (int)n;
+        }
+    } else {
+        fd = open(target, open_flags[r->type], 0644);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", target, strerror(errno));
+        }
+    }
+
+    free(target);
+    return fd;
+}
 
-    int stdin_backup = -1;
-    int stdout_backup = -1;
-    int input_fd = -1;
-    int output_fd = -1;
+// Apply a command's redirections in order in the current process. With an
+// undo list the original descriptors are saved for restore_redirections();
+// without one (exec, or a forked child) the changes are permanent.
+int apply_redirections(command_t* cmd, redir_undo_t* undo) {
+    if (undo != NULL) {
+        undo->items = NULL;
+        undo->count = 0;
+    }
 
-    // Handle input redirection
-    if (cmd->input_file != NULL) {
-        stdin_backup = dup(STDIN_FILENO); // Backup original stdin
-        input_fd = open(cmd->input_file, O_RDONLY);
-        if (input_fd < 0) {
-            perror("open input file");
-            if (stdin_backup >= 0) close(stdin_backup);
+    for (int i = 0; i < cmd->num_redirs; i++) {
+        redirection_t* r = &cmd->redirs[i];
+        int owned;
+        int src = open_source(r, &owned);
+        if (src == -1) {
+            restore_redirections(undo);
             return -1;
         }
-        if (dup2(input_fd, STDIN_FILENO) < 0) {
-            perror("dup2 input");
-            close(input_fd);
-            if (stdin_backup >= 0) close(stdin_backup);
+        if (src == r->fd) {
+            continue; // Already in place (n>&n, or open() reused n)
+        }
+
+        if (r->fd == STDOUT_FILENO) fflush(stdout);
+        if (r->fd == STDERR_FILENO) fflush(stderr);
+        save_fd(undo, r->fd);
+
+        if (src == -2) {
+            close(r->fd);
+        } else if (dup2(src, r->fd) < 0) {
+            perror("dup2");
+            if (owned) close(src);
+            restore_redirections(undo);
             return -1;
         }
-        close(input_fd);
+        if (owned && src >= 0) close(src);
+    }
+
+    return 0;
+}
+
+// Restore the descriptors saved by apply_redirections(), newest first
+void restore_redirections(redir_undo_t* undo) {
+    if (undo == NULL) return;
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = undo->count - 1; i >= 0; i--) {
+        saved_fd_t* saved = &undo->items[i];
+        if (saved->backup >= 0) {
+            dup2(saved->backup, saved->fd);
+            close(saved->backup);
+        } else {
+            close(saved->fd);
+        }
     }
+    free(undo->items);
+    undo->items = NULL;
+    undo->count = 0;
+}
+
+// Parse a size such as a pipe size: bytes with an optional k, m or g
+// suffix. Returns -1 if the text is not a size.
+long parse_size(const char* text) {
+    char* end;
+    long size = strtol(text, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+        end++;
+    } else if (*end == 'g' || *end == 'G') {
+        size *= 1024L * 1024 * 1024;
+        end++;
+    }
+    return end == text || *end != '\0' || size < 0 ? -1 : size;
+}
 
-    // Handle output redirection
-    if (cmd->output_file != NULL) {
-        stdout_backup = dup(STDOUT_FILENO); // Backup original stdout
-        output_fd = open(cmd->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (output_fd < 0) {
-            perror("open output file");
-            if (stdout_backup >= 0) close(stdout_backup);
-            if (stdin_backup >= 0) {
-                dup2(stdin_backup, STDIN_FILENO);
-                close(stdin_backup);
+// Largest pipe an unprivileged process may ask for
+static long pipe_max_size() {
+    static long max = 0;
+    if (max == 0) {
+        max = 1024 * 1024;
+        FILE* f = fopen("/proc/sys/fs/pipe-max-size", "r");
+        if (f != NULL) {
+            if (fscanf(f, "%ld", &max) != 1) max = 1024 * 1024;
+            fclose(f);
+        }
+    }
+    return max;
+}
+
+// Size for the pipes of a pipeline: PIPESIZE=n before the first command
+// sets it for this pipeline, otherwise the PIPESIZE shell variable.
+// Returns 0 to keep the kernel default.
+static long pipeline_pipe_size(pipeline_t* pipeline) {
+    char* text = NULL;
+    node_t* first = pipeline->commands[0];
+    if (first->type == NODE_COMMAND) {
+        command_t* cmd = &first->command;
+        for (int i = 0; i < cmd->num_assigns; i++) {
+            if (strncmp(cmd->assigns[i].text, "PIPESIZE=", 9) == 0) {
+                word_t value = { cmd->assigns[i].text + 9, cmd->assigns[i].flags };
+                free(text);
+                text = expand_word_string(&value);
             }
-            return -1;
         }
-        if (dup2(output_fd, STDOUT_FILENO) < 0) {
-            perror("dup2 output");
-            close(output_fd);
-            if (stdout_backup >= 0) close(stdout_backup);
-            if (stdin_backup >= 0) {
-                dup2(stdin_backup, STDIN_FILENO);
-                close(stdin_backup);
+    }
+    if (text == NULL) {
+        const char* value = get_variable("PIPESIZE");
+        if (value == NULL || *value == '\0') return 0;
+        text = strdup(value);
+    }
+
+    long size = parse_size(text);
+    if (size < 0) {
+        fprintf(stderr, "PIPESIZE: %s: invalid size\n", text);
+        size = 0;
+    }
+    free(text);
+    return size > pipe_max_size() ? pipe_max_size() : size;
+}
+
+// Fill level samples of one pipe between two stages
+typedef struct {
+    int fd;              // Read end kept by the shell for FIONREAD, or -1
+    int size;            // Pipe capacity in bytes
+    long samples;
+    long long total;     // Sum of sampled byte counts
+    int max;
+    long full;           // Samples at 90% of capacity or more
+    long empty;
+} pipe_sample_t;
+
+// Name of a pipeline stage for reports
+static const char* stage_name(node_t* stage) {
+    if (stage->type == NODE_COMMAND && stage->command.num_words > 0) {
+        return stage->command.words[0].text;
+    }
+    return "(compound)";
+}
+
+// Wait for the stages while sampling how full each pipe is. A pipe that
+// is mostly full has a slow reader; one that is mostly empty a slow writer.
+// The shell's read end of a pipe is closed as soon as its reader exits, so
+// the writer still gets EPIPE.
+static void sample_pipeline(pipeline_t* pipeline, pid_t* pids, int* statuses, pipe_sample_t* pipes) {
+    int n = pipeline->num_commands;
+    int running = 0;
+    for (int i = 0; i < n; i++) {
+        if (pids[i] > 0) running++;
+    }
+
+    while (running > 0) {
+        for (int i = 0; i < n; i++) {
+            int wstatus;
+            if (pids[i] > 0 && waitpid(pids[i], &wstatus, WNOHANG) == pids[i]) {
+                statuses[i] = decode_status(wstatus);
+                pids[i] = 0;
+                running--;
+                if (i > 0 && pipes[i - 1].fd >= 0) {
+                    close(pipes[i - 1].fd);
+                    pipes[i - 1].fd = -1;
+                }
             }
-            return -1;
         }
-        close(output_fd);
+        for (int i = 0; i < n - 1; i++) {
+            int avail;
+            if (pipes[i].fd < 0 || ioctl(pipes[i].fd, FIONREAD, &avail) != 0) continue;
+            pipes[i].samples++;
+            pipes[i].total += avail;
+            if (avail > pipes[i].max) pipes[i].max = avail;
+            if (avail * 10L >= pipes[i].size * 9L) pipes[i].full++;
+            if (avail == 0) pipes[i].empty++;
+        }
+        if (running > 0) usleep(PIPE_SAMPLE_USEC);
+    }
+
+    for (int i = 0; i < n - 1; i++) {
+        pipe_sample_t* s = &pipes[i];
+        if (s->fd >= 0) close(s->fd);
+        if (s->samples == 0) continue;
+        const char* verdict = "balanced";
+        if (s->full * 2 > s->samples) verdict = "reader is the bottleneck";
+        else if (s->empty * 2 > s->samples) verdict = "writer is the bottleneck";
+        fprintf(stderr, "pipe %d (%s | %s): size %d, avg %lld, max %d, full %ld%%, empty %ld%% - %s\n",
+                i + 1, stage_name(pipeline->commands[i]), stage_name(pipeline->commands[i + 1]),
+                s->size, s->total / s->samples, s->max, s->full * 100 / s->samples,
+                s->empty * 100 / s->samples, verdict);
     }
+}
 
-    // Execute the command
+// A builtin pipeline stage run on a thread of the shell instead of a child
+typedef struct {
+    builtin_func_t func;  // NULL for a stage run in a child
+    char** argv;          // Expanded by the shell before the thread starts
+    int in, out;          // Pipe ends (or copies of fds 0 and 1) it owns
+    pthread_t thread;
+    int started;
     int status;
-    pid_t pid = fork();
-    
-    if (pid == 0) {
-        // Child process
-        execvp(cmd->args[0], cmd->args);
-        perror("execvp");
-        exit(1);
-    } else if (pid > 0) {
-        // Parent process
-        waitpid(pid, &status, 0);
-        
-        // Restore original file descriptors
-        if (stdin_backup >= 0) {
-            dup2(stdin_backup, STDIN_FILENO);
-            close(stdin_backup);
-        }
-        if (stdout_backup >= 0) {
-            dup2(stdout_backup, STDOUT_FILENO);
-            close(stdout_backup);
-        }
-        
-        return WEXITSTATUS(status);
-    } else {
-        perror("fork");
-        return -1;
+} stage_thread_t;
+
+// Whether word expands without side effects on the shell: no command or
+// process substitutions, arithmetic, or ${V=...} / ${V?...}
+static int expands_quietly(const word_t* word) {
+    const char* text = word->text;
+    if (!(word->flags & WORD_NEEDS_EXPANSION)) {
+        return 1;
     }
+    if (strchr(text, '`') != NULL || strstr(text, "$(") != NULL ||
+        strstr(text, "<(") != NULL || strstr(text, ">(") != NULL) {
+        return 0;
+    }
+    return strstr(text, "${") == NULL || strpbrk(text, "=?") == NULL;
 }
 
-// Execute a pipeline of commands
-int execute_pipeline(pipeline_t* pipeline) {
-    if (pipeline == NULL || pipeline->num_commands == 0) {
-        return -1;
+// The builtin to run stage on a thread, or NULL if it needs a child: a
+// stream builtin not shadowed by a function, with no assignments or
+// redirections and words the shell can expand without side effects.
+// MYSHELL_THREADS=0 runs every stage in a child.
+static builtin_func_t thread_builtin(node_t* stage) {
+    static int enabled = -1;
+    if (enabled < 0) {
+        const char* setting = getenv("MYSHELL_THREADS");
+        enabled = setting == NULL || strcmp(setting, "0") != 0;
     }
+    if (!enabled || stage->type != NODE_COMMAND) {
+        return NULL;
+    }
+    command_t* cmd = &stage->command;
+    if (cmd->num_words == 0 || cmd->num_assigns > 0 || cmd->num_redirs > 0 ||
+        (cmd->words[0].flags & (WORD_NEEDS_EXPANSION | WORD_HAS_GLOB)) ||
+        find_function(cmd->words[0].text) != NULL) {
+        return NULL;
+    }
+    for (int i = 1; i < cmd->num_words; i++) {
+        if (!expands_quietly(&cmd->words[i])) {
+            return NULL;
+        }
+    }
+    return stream_builtin(cmd->words[0].text);
+}
+
+// Body of a stage thread. SIGPIPE is blocked, so a write to a pipe whose
+// reader has gone leaves it pending instead of killing the shell; the
+// stage then gets the status a child killed by it would have.
+static void* run_stage_thread(void* arg) {
+    stage_thread_t* t = arg;
+    stage_in = t->in;
+    stage_out = t->out;
+    stage_file = fdopen(t->out, "w");
+    if (stage_file == NULL) {
+        close(t->out);
+        t->status = 1;
+    } else {
+        stats_count(STAT_BUILTINS);
+        t->status = t->func(t->argv);
+        fclose(stage_file);
+    }
+    if (t->in >= 0) close(t->in);
 
-    // For now, handle sequential execution of chained commands
-    // (Pipes with background execution is complex, so we'll do sequential)
-    int result = 0;
-    for (int i = 0; i < pipeline->num_commands; i++) {
-        result = execute_single_command(&pipeline->commands[i]);
-        if (result != 0) {
-            break; // Stop on first error
+    sigset_t pipe_signal;
+    sigemptyset(&pipe_signal);
+    sigaddset(&pipe_signal, SIGPIPE);
+    struct timespec now = { 0, 0 };
+    if (sigtimedwait(&pipe_signal, NULL, &now) == SIGPIPE) {
+        t->status = 128 + SIGPIPE;
+    }
+    return NULL;
+}
+
+// Start the stage threads once every child has been forked, so no child
+// is forked while they run
+static void start_stage_threads(stage_thread_t* threads, int n) {
+    sigset_t pipe_signal, old;
+    sigemptyset(&pipe_signal);
+    sigaddset(&pipe_signal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_signal, &old); // Inherited by the threads
+    for (int i = 0; i < n; i++) {
+        stage_thread_t* t = &threads[i];
+        if (t->func == NULL) continue;
+        int error = pthread_create(&t->thread, NULL, run_stage_thread, t);
+        if (error != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(error));
+            if (t->in >= 0) close(t->in);
+            close(t->out);
+            t->status = 1;
+        } else {
+            t->started = 1;
         }
     }
-    return result;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
 }
 
-// Execute a single command (with or without redirection/background)
-int execute_single_command(command_t* cmd) {
-    if (cmd == NULL || cmd->args[0] == NULL) {
+// Execute a pipeline of commands, connecting each stage with a pipe.
+// Stream builtins run on threads of the shell, other stages in children.
+int execute_pipeline(pipeline_t* pipeline) {
+    if (pipeline == NULL || pipeline->num_commands == 0) {
         return -1;
     }
 
-    // Check if there's any redirection or background
-    if (cmd->input_file != NULL || cmd->output_file != NULL || cmd->background) {
-        return execute_redirection(cmd);
-    }
+    int status = 0;
 
-    // No redirection/background, use original execute function for built-in check
-    if (handle_builtin(cmd->args)) {
-        return 0;
+    if (pipeline->num_commands == 1) {
+        status = execute_node(pipeline->commands[0]);
+    } else {
+        int n = pipeline->num_commands;
+        pid_t* pids = malloc(n * sizeof(pid_t));
+        int prev_read = -1;
+        long size = pipeline_pipe_size(pipeline);
+        pipe_sample_t* pipes = pipe_stats ? calloc(n, sizeof(pipe_sample_t)) : NULL;
+        stage_thread_t* threads = calloc(n, sizeof(stage_thread_t));
+
+        for (int i = 0; i < n; i++) {
+            pids[i] = -1;
+            if (pipes != NULL) pipes[i].fd = -1;
+        }
+
+        fflush(stdout);
+        for (int i = 0; i < n; i++) {
+            int fds[2] = { -1, -1 };
+
+            if (i < n - 1 && pipe(fds) < 0) {
+                perror("pipe");
+                break;
+            }
+            if (fds[1] >= 0 && size > 0 && fcntl(fds[1], F_SETPIPE_SZ, (int)size) < 0) {
+                if (i == 0) fprintf(stderr, "PIPESIZE: %ld: %s\n", size, strerror(errno));
+            }
+            if (pipes != NULL && fds[0] >= 0) {
+                pipes[i].fd = fcntl(fds[0], F_DUPFD_CLOEXEC, 10);
+                pipes[i].size = fcntl(fds[0], F_GETPIPE_SZ);
+            }
+
+            // Stage threads are not sampled: pipestats measures processes
+            node_t* stage = pipeline->commands[i];
+            stage_thread_t* t = &threads[i];
+            t->func = pipes == NULL ? thread_builtin(stage) : NULL;
+            if (t->func != NULL) {
+                t->argv = expand_words(stage->command.words, stage->command.num_words);
+                t->in = prev_read >= 0 ? prev_read : fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+                t->out = fds[1] >= 0 ? fds[1] : fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+                if (t->in >= 0) fcntl(t->in, F_SETFD, FD_CLOEXEC);
+                if (t->out >= 0) fcntl(t->out, F_SETFD, FD_CLOEXEC);
+                if (t->out < 0) {
+                    perror("dup");
+                    if (t->in >= 0) close(t->in);
+                    free_argv(t->argv);
+                    t->func = NULL;
+                }
+                pids[i] = 0;
+                prev_read = fds[0];
+                continue;
+            }
+
+            pid_t pid = stats_fork();
+            if (pid == 0) {
+                // Child process - connect to neighbouring stages
+                for (int j = 0; pipes != NULL && j <= i; j++) {
+                    if (pipes[j].fd >= 0) close(pipes[j].fd);
+                }
+                for (int j = 0; j < i; j++) {
+                    if (threads[j].func == NULL) continue;
+                    if (threads[j].in >= 0) close(threads[j].in);
+                    close(threads[j].out);
+                }
+                if (prev_read >= 0) {
+                    dup2(prev_read, STDIN_FILENO);
+                    close(prev_read);
+                }
+                if (fds[1] >= 0) {
+                    dup2(fds[1], STDOUT_FILENO);
+                    close(fds[1]);
+                    close(fds[0]);
+                }
+
+                if (stage->type == NODE_COMMAND) {
+                    exit(execute_command(&stage->command, 1));
+                }
+                exit(execute_node(stage));
+            } else if (pid < 0) {
+                perror("fork");
+            }
+            pids[i] = pid;
+
+            // Parent process - close the pipe ends the children own
+            if (prev_read >= 0) close(prev_read);
+            if (fds[1] >= 0) close(fds[1]);
+            prev_read = fds[0];
+        }
+        if (prev_read >= 0) close(prev_read);
+        start_stage_threads(threads, n);
+
+        // Wait for every stage; the last one decides the exit status
+        if (pipes != NULL) {
+            int* statuses = malloc(n * sizeof(int));
+            for (int i = 0; i < n; i++) {
+                statuses[i] = 1;
+            }
+            sample_pipeline(pipeline, pids, statuses, pipes);
+            status = statuses[n - 1];
+            free(statuses);
+            free(pipes);
+        } else {
+            for (int i = 0; i < n; i++) {
+                if (threads[i].func != NULL) {
+                    if (threads[i].started) pthread_join(threads[i].thread, NULL);
+                    free_argv(threads[i].argv);
+                    status = threads[i].status;
+                } else if (pids[i] > 0) {
+                    int wstatus;
+                    stats_waitpid(pids[i], &wstatus, 0);
+                    status = decode_status(wstatus);
+                } else {
+                    status = 1;
+                }
+            }
+        }
+        free(threads);
+        free(pids);
     }
 
-    // Execute external command without redirection
-    return execute(cmd->args) == 0 ? 0 : -1;
+    if (pipeline->negate) {
+        status = !status;
+    }
+    return status;
 }
@@ -0,0 +1,128 @@
+#include "shell.h"
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+// Byte classes for scan_until(). The lexer and the expander use them to
+// jump over runs of plain text to the next byte they have to look at,
+// classifying 16 (SSE2) or 32 (AVX2) bytes at a time where the CPU can.
+// Reading whole aligned blocks may look past the terminating NUL but never
+// crosses into the next page.
+
+typedef struct {
+    const char* chars;            // Interesting bytes; NUL always is
+    unsigned char member[256];    // Scalar lookup, filled in by build_classes()
+    unsigned char lo[16], hi[16]; // Nibble tables: b is a member iff
+                                  // lo[b & 15] & hi[b >> 4] is non-zero
+} scan_class_t;
+
+static scan_class_t classes[] = {
+    [SCAN_WORD] = { " \t\n;&|<>()\\'\"$" },
+    [SCAN_DQUOTE] = { "\"\\$" },
+    [SCAN_EXPAND] = { "'\"\\$<>*?[" },
+    [SCAN_HEREDOC] = { "\\$" },
+};
+
+#define NUM_CLASSES ((int)(sizeof(classes) / sizeof(classes[0])))
+
+// Portable version: one table lookup per byte
+static const char* scan_scalar(const char* p, const scan_class_t* c) {
+    while (!c->member[(unsigned char)*p]) p++;
+    return p;
+}
+
+#ifdef SCAN_X86
+// SSE2: compare each 16-byte block against every byte of the class
+__attribute__((no_sanitize_address))
+static const char* scan_sse2(const char* p, const scan_class_t* c) {
+    size_t misalign = (uintptr_t)p & 15;
+    const __m128i* block = (const __m128i*)(p - misalign);
+    unsigned int mask = ~0U << misalign; // Ignore the bytes before p
+    for (;; block++, mask = ~0U) {
+        __m128i v = _mm_load_si128(block);
+        __m128i hit = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+        for (const char* ch = c->chars; *ch != '\0'; ch++) {
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(*ch)));
+        }
+        mask &= _mm_movemask_epi8(hit);
+        if (mask != 0) {
+            return (const char*)block + __builtin_ctz(mask);
+        }
+    }
+}
+
+// AVX2: classify 32 bytes at once with two nibble table lookups
+__attribute__((target("avx2"), no_sanitize_address))
+static const char* scan_avx2(const char* p, const scan_class_t* c) {
+    __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)c->lo));
+    __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)c->hi));
+    __m256i nibble = _mm256_set1_epi8(0x0f);
+    size_t misalign = (uintptr_t)p & 31;
+    const __m256i* block = (const __m256i*)(p - misalign);
+    unsigned int mask = ~0U << misalign;
+    for (;; block++, mask = ~0U) {
+        __m256i v = _mm256_load_si256(block);
+        __m256i class = _mm256_and_si256(
+            _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble)),
+            _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+        __m256i plain = _mm256_cmpeq_epi8(class, _mm256_setzero_si256());
+        mask &= ~(unsigned int)_mm256_movemask_epi8(plain);
+        if (mask != 0) {
+            return (const char*)block + __builtin_ctz(mask);
+        }
+    }
+}
+#endif
+
+static const char* scan_init(const char* p, const scan_class_t* c);
+
+// Scanner in use, picked on the first call
+static const char* (*scan_impl)(const char*, const scan_class_t*) = scan_init;
+
+// Build the lookup tables and pick the widest scanner the CPU supports;
+// MYSHELL_SCAN=scalar, sse2 or avx2 forces one (for benchmarks)
+static void build_classes() {
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        scan_class_t* cls = &classes[i];
+        cls->member[0] = 1;
+        cls->lo[0] |= 1;
+        cls->hi[0] |= 1;
+        for (const char* ch = cls->chars; *ch != '\0'; ch++) {
+            unsigned char b = *ch;
+            // One bit per high nibble: bytes 0x00-0x0f use bit 0, and so on
+            // (the classes only use high nibbles 0-7)
+            cls->member[b] = 1;
+            cls->lo[b & 15] |= 1 << (b >> 4);
+            cls->hi[b >> 4] |= 1 << (b >> 4);
+        }
+    }
+
+    const char* choice = getenv("MYSHELL_SCAN");
+    const char* (*impl)(const char*, const scan_class_t*) = scan_scalar;
+#ifdef SCAN_X86
+    if (choice == NULL || strcmp(choice, "scalar") != 0) {
+        impl = scan_sse2;
+    }
+    if ((choice == NULL || strcmp(choice, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        impl = scan_avx2;
+    }
+#else
+    (void)choice;
+#endif
+    scan_impl = impl;
+}
+
+// First call from any thread: set up, then scan with the chosen version
+static const char* scan_init(const char* p, const scan_class_t* c) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, build_classes);
+    return scan_impl(p, c);
+}
+
+// First byte at or after p in the class (SCAN_*), or the terminating NUL
+const char* scan_until(const char* p, int class) {
+    return scan_impl(p, &classes[class]);
+}
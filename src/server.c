@@ -0,0 +1,362 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#define SERVER_BACKLOG 64
+#define SERVER_POLL_MS 10     // Wakeup interval when pidfds are unavailable
+#define SERVER_MAX_REQUEST (64 << 20)
+
+// A request is a 4-byte length followed by NUL-terminated strings: the
+// client's directory, the script, then $0 and the positional parameters.
+// The client's stdin, stdout and stderr come with the first byte as
+// SCM_RIGHTS; the reply is the 4-byte exit status once the script is done.
+// The session sends it itself on exit; the server only does for a session
+// killed by a signal.
+
+// A script running in a child of the server
+typedef struct {
+    pid_t pid;
+    int pidfd;              // Readable when the child exits; -1 if unsupported
+    int conn;               // Connection to send the status on
+} session_t;
+
+// Fill a sockaddr_un; returns -1 if the path is too long
+static int socket_address(const char* path, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+// Read exactly len bytes
+static int read_full(int fd, void* buf, size_t len) {
+    for (size_t done = 0; done < len; ) {
+        ssize_t n = read(fd, (char*)buf + done, len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+// Write exactly len bytes
+static int write_full(int fd, const void* buf, size_t len) {
+    for (size_t done = 0; done < len; ) {
+        ssize_t n = write(fd, (const char*)buf + done, len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+// Process serving the request, for send_status()
+static pid_t session_pid;
+
+// Set while serving a request: the status goes back over the connection
+// from an exit handler, so the session must never exec in place
+int server_session = 0;
+
+// on_exit() handler of a session: reply with the exit status. Children
+// forked for pipelines inherit the handler, so only the session replies.
+static void send_status(int status, void* conn) {
+    if (getpid() != session_pid) return;
+    int32_t reply = status & 0xff;
+    fflush(stdout);
+    write_full((int)(intptr_t)conn, &reply, sizeof(reply));
+}
+
+// In a forked child: receive the request on conn and run it with the
+// client's descriptors and directory. Does not return.
+static void serve_request(int conn) {
+    uint32_t len;
+    int fds[3];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { &len, sizeof(len) };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    while ((n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (n != sizeof(len) || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) || len == 0 || len > SERVER_MAX_REQUEST) {
+        exit(2);
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    char* request = malloc(len + 1);
+    if (request == NULL || read_full(conn, request, len) != 0) {
+        exit(2);
+    }
+    request[len] = '\0';
+
+    // Send the status as soon as the script exits, before the process is
+    // torn down; the server only reports deaths by signal
+    session_pid = getpid();
+    server_session = 1;
+    on_exit(send_status, (void*)(intptr_t)conn);
+
+    // Split the strings
+    int count = 0;
+    char** strings = malloc((len + 1) * sizeof(char*));
+    if (strings == NULL) {
+        exit(2);
+    }
+    for (char* p = request; p < request + len; p += strlen(p) + 1) {
+        strings[count++] = p;
+    }
+    if (count < 2) {
+        exit(2);
+    }
+
+    for (int fd = 0; fd < 3; fd++) {
+        dup2(fds[fd], fd);
+        close(fds[fd]);
+    }
+    if (chdir(strings[0]) != 0) {
+        fprintf(stderr, "%s: %s\n", strings[0], strerror(errno));
+    }
+    if (count > 2) {
+        shell_name = strings[2];
+        positional_args = strings + 3;
+        positional_count = count - 3;
+    }
+    exit(run_script(strings[1]));
+}
+
+// Fork a child that waits on a socketpair for the connection it is to
+// serve, so that the fork is already done when a client connects. The
+// child drops the descriptors of the other sessions.
+static pid_t fork_spare(int listener, session_t* sessions, int num_sessions, int* channel) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+        return -1;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = stats_fork();
+    if (pid == 0) {
+        close(listener);
+        close(pair[0]);
+        for (int i = 0; i < num_sessions; i++) {
+            close(sessions[i].conn);
+            if (sessions[i].pidfd >= 0) close(sessions[i].pidfd);
+        }
+        signal(SIGPIPE, SIG_DFL);
+
+        char byte;
+        int conn;
+        char control[CMSG_SPACE(sizeof(conn))];
+        struct iovec iov = { &byte, 1 };
+        struct msghdr msg = { 0 };
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n;
+        while ((n = recvmsg(pair[1], &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+        }
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (n != 1 || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS) {
+            exit(0); // The server went away
+        }
+        memcpy(&conn, CMSG_DATA(cmsg), sizeof(conn));
+        close(pair[1]);
+        serve_request(conn);
+    }
+    close(pair[1]);
+    if (pid < 0) {
+        close(pair[0]);
+        return -1;
+    }
+    *channel = pair[0];
+    return pid;
+}
+
+// Hand a connection to the spare child over its channel
+static int send_connection(int channel, int conn) {
+    char byte = 0;
+    char control[CMSG_SPACE(sizeof(conn))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { &byte, 1 };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(conn));
+    memcpy(CMSG_DATA(cmsg), &conn, sizeof(conn));
+    return sendmsg(channel, &msg, 0) == 1 ? 0 : -1;
+}
+
+// Run a server on the socket at path. Each connection is served by a fork
+// of this process, so scripts start with everything the server has
+// already loaded (init, if given, runs once at startup). A spare child is
+// forked ahead of time to keep the fork off the request's path.
+int run_server(const char* path, const char* init) {
+    struct sockaddr_un addr;
+    if (socket_address(path, &addr) != 0) {
+        return 2;
+    }
+    if (init != NULL) {
+        run_script(init);
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listener, SERVER_BACKLOG) != 0) {
+        perror(path);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    session_t* sessions = NULL;
+    struct pollfd* fds = NULL;
+    int num_sessions = 0, cap = 0;
+    int channel = -1;
+    pid_t spare = -1;
+    for (;;) {
+        if (num_sessions + 1 > cap) {
+            cap = cap ? cap * 2 : 16;
+            sessions = realloc(sessions, cap * sizeof(session_t));
+            fds = realloc(fds, (cap + 1) * sizeof(struct pollfd));
+            if (sessions == NULL || fds == NULL) {
+                perror("realloc failed");
+                exit(1);
+            }
+        }
+        if (spare < 0) {
+            spare = fork_spare(listener, sessions, num_sessions, &channel);
+        }
+
+        // Wait for a connection or for a session to finish
+        int nfds = 0;
+        int all_pidfds = 1;
+        fds[nfds++] = (struct pollfd){ listener, POLLIN, 0 };
+        for (int i = 0; i < num_sessions; i++) {
+            if (sessions[i].pidfd >= 0) {
+                fds[nfds++] = (struct pollfd){ sessions[i].pidfd, POLLIN, 0 };
+            } else {
+                all_pidfds = 0;
+            }
+        }
+        if (poll(fds, nfds, all_pidfds ? -1 : SERVER_POLL_MS) < 0 && errno != EINTR) {
+            perror("poll failed");
+            return 1;
+        }
+
+        // Reply to finished sessions
+        int kept = 0;
+        for (int i = 0; i < num_sessions; i++) {
+            int wstatus;
+            if (waitpid(sessions[i].pid, &wstatus, WNOHANG) != sessions[i].pid) {
+                sessions[kept++] = sessions[i];
+                continue;
+            }
+            if (WIFSIGNALED(wstatus)) {
+                int32_t status = decode_status(wstatus);
+                write_full(sessions[i].conn, &status, sizeof(status));
+            }
+            close(sessions[i].conn);
+            if (sessions[i].pidfd >= 0) close(sessions[i].pidfd);
+        }
+        num_sessions = kept;
+
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+        int conn = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0) {
+            continue;
+        }
+        if (spare < 0 || send_connection(channel, conn) != 0) {
+            fprintf(stderr, "%s: cannot start a session\n", path);
+            close(conn);
+            if (spare > 0) {
+                close(channel);
+                waitpid(spare, NULL, 0);
+            }
+            spare = -1;
+            continue;
+        }
+        close(channel);
+        sessions[num_sessions].pid = spare;
+        sessions[num_sessions].pidfd = syscall(SYS_pidfd_open, spare, 0);
+        sessions[num_sessions].conn = conn;
+        num_sessions++;
+        spare = -1;
+    }
+}
+
+// Send a script with our stdin, stdout and stderr to the server at path
+// and wait for its exit status. args are $0 and the positional parameters.
+int run_client(const char* path, const char* source, char** args, int num_args) {
+    struct sockaddr_un addr;
+    if (socket_address(path, &addr) != 0) {
+        return 2;
+    }
+    int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0 || connect(conn, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror(path);
+        return 127;
+    }
+
+    strbuf_t request;
+    sb_init(&request);
+    char cwd[PATH_MAX];
+    sb_append(&request, getcwd(cwd, sizeof(cwd)) != NULL ? cwd : "/");
+    sb_putc(&request, '\0');
+    sb_append(&request, source);
+    sb_putc(&request, '\0');
+    for (int i = 0; i < num_args; i++) {
+        sb_append(&request, args[i]);
+        sb_putc(&request, '\0');
+    }
+
+    uint32_t len = request.len;
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { &len, sizeof(len) };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    int32_t status = 2;
+    signal(SIGPIPE, SIG_IGN);
+    if (sendmsg(conn, &msg, 0) != sizeof(len) ||
+        write_full(conn, request.data, request.len) != 0 ||
+        read_full(conn, &status, sizeof(status)) != 0) {
+        fprintf(stderr, "%s: server closed the connection\n", path);
+        status = 2;
+    }
+    sb_free(&request);
+    close(conn);
+    return status;
+}
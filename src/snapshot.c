@@ -0,0 +1,142 @@
+#include "shell.h"
+#include <limits.h>
+
+#define SNAPSHOT_MAGIC 0x4352534dU  // "MSRC" as a little-endian word
+#define SNAPSHOT_VERSION 3
+
+// Startup image of what the rc file defined: the header, the function
+// bodies as tree records (see compile.c), then a table of NUL-terminated
+// strings written by dump_variables() and dump_functions()
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t rc_size;           // The rc file the image was made from
+    int64_t rc_mtime_sec;
+    int64_t rc_mtime_nsec;
+    uint64_t table;             // Offset of the string table
+    uint64_t payload_size;      // Bytes after the header
+    uint64_t payload_hash;      // 64-bit FNV-1a of them
+} snapshot_header_t;
+
+// Next NUL-terminated string of an image at *p, advancing past it; NULL
+// if the data ends first
+const char* image_string(const char** p, const char* end) {
+    const char* str = *p;
+    const char* nul = str < end ? memchr(str, '\0', end - str) : NULL;
+    if (nul == NULL) {
+        return NULL;
+    }
+    *p = nul + 1;
+    return str;
+}
+
+// Image file for the rc file at path: keyed by its real path under
+// myshell/rc in the user's cache directory. NULL if snapshots are off
+// (MYSHELL_SNAPSHOT=0) or there is no cache directory.
+char* snapshot_file(const char* path) {
+    const char* setting = getenv("MYSHELL_SNAPSHOT");
+    if (setting != NULL && strcmp(setting, "0") == 0) {
+        return NULL;
+    }
+    char* real = realpath(path, NULL);
+    const char* dir = real != NULL ? cache_directory("rc", NULL) : NULL;
+    if (dir == NULL) {
+        free(real);
+        return NULL;
+    }
+    char* file = malloc(strlen(dir) + 32);
+    if (file == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    sprintf(file, "%s/%016llx.img", dir, hash_bytes(real, strlen(real)));
+    free(real);
+    return file;
+}
+
+// Write the named variables and every function to file as the image of
+// an rc file in state rc. Returns 0 on success.
+int save_snapshot(const char* file, const struct stat* rc, char** names, int count) {
+    strbuf_t blob, table;
+    sb_init(&blob);
+    sb_init(&table);
+    snapshot_header_t header = { 0 };
+    sb_appendn(&blob, (const char*)&header, sizeof(header));
+    dump_functions(&blob, &table);
+    dump_variables(names, count, &table);
+
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.rc_size = rc->st_size;
+    header.rc_mtime_sec = rc->st_mtim.tv_sec;
+    header.rc_mtime_nsec = rc->st_mtim.tv_nsec;
+    header.table = blob.len;
+    sb_appendn(&blob, table.data, table.len);
+    header.payload_size = blob.len - sizeof(header);
+    header.payload_hash = hash_bytes(blob.data + sizeof(header), header.payload_size);
+    memcpy(blob.data, &header, sizeof(header));
+    sb_free(&table);
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file);
+    int fd = mkstemp(tmp);
+    int result = -1;
+    if (fd >= 0) {
+        size_t done = 0;
+        while (done < blob.len) {
+            ssize_t n = write(fd, blob.data + done, blob.len - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        close(fd);
+        if (done == blob.len && rename(tmp, file) == 0) {
+            result = 0;
+        } else {
+            unlink(tmp);
+        }
+    }
+    sb_free(&blob);
+    return result;
+}
+
+// Define the variables and functions of the image in file, read in one
+// go, if it was made from the rc file as it is now (rc). Returns 0 on
+// success, -1 if there is no usable image.
+int load_snapshot(const char* file, const struct stat* rc) {
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_header_t)) {
+        close(fd);
+        return -1;
+    }
+    char* data = malloc(st.st_size);
+    if (data == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    ssize_t n = read(fd, data, st.st_size);
+    close(fd);
+
+    snapshot_header_t header;
+    memcpy(&header, data, sizeof(header));
+    int result = -1;
+    if (n == st.st_size && header.magic == SNAPSHOT_MAGIC && header.version == SNAPSHOT_VERSION &&
+        header.payload_size == st.st_size - sizeof(header) &&
+        header.table >= sizeof(header) && header.table <= (uint64_t)st.st_size &&
+        header.rc_size == (uint64_t)rc->st_size && header.rc_mtime_sec == rc->st_mtim.tv_sec &&
+        header.rc_mtime_nsec == rc->st_mtim.tv_nsec &&
+        hash_bytes(data + sizeof(header), header.payload_size) == header.payload_hash) {
+        const char* p = data + header.table;
+        const char* end = data + st.st_size;
+        if (load_functions(&p, end, data, header.table, sizeof(header)) == 0 &&
+            load_variables(&p, end) == 0) {
+            result = 0;
+        }
+    }
+    free(data);
+    return result;
+}
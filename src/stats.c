@@ -0,0 +1,235 @@
+#include "shell.h"
+#include <sys/mman.h>
+#include <time.h>
+
+// Latency histograms in the style of HdrHistogram: values below 2^SUB_BITS
+// nanoseconds get a bucket each, and every power of two above that is
+// split into 2^SUB_BITS linear sub-buckets, so any value is known to
+// within 1/16 (about 6%) with a fixed 976 buckets per phase
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)
+#define NUM_BUCKETS ((64 - SUB_BITS + 1) * SUB_COUNT)
+
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[NUM_BUCKETS];
+} histogram_t;
+
+static const char* const phase_names[] = {
+    [STAT_READ] = "read",
+    [STAT_HISTORY] = "history",
+    [STAT_PARSE] = "parse",
+    [STAT_EXPAND] = "expand",
+    [STAT_FORK] = "fork",
+    [STAT_RUN] = "exec-to-exit",
+    [STAT_WAIT] = "waitpid",
+    [STAT_COMMAND] = "command",
+};
+
+static const char* const counter_names[] = {
+    [STAT_FORKS] = "forks",
+    [STAT_EXECS] = "execs",
+    [STAT_BUILTINS] = "builtins",
+    [STAT_ALLOCS] = "allocations",
+};
+
+// Set by stats on; everything here is a single test of it while off
+int stats_enabled = 0;
+
+static histogram_t histograms[STAT_PHASES];
+
+// Counters live in a shared page so forked children add their execs,
+// builtins and allocations to the shell's totals
+static uint64_t* counters = NULL;
+
+// Bucket of a value in nanoseconds
+static int bucket_of(uint64_t value) {
+    if (value < SUB_COUNT) {
+        return (int)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    int sub = (int)(value >> (exponent - SUB_BITS)) & (SUB_COUNT - 1);
+    return (exponent - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+// Largest value that falls into bucket
+static uint64_t bucket_limit(int bucket) {
+    if (bucket < SUB_COUNT) {
+        return bucket;
+    }
+    int shift = bucket / SUB_COUNT - 1;
+    uint64_t low = (uint64_t)(SUB_COUNT + bucket % SUB_COUNT) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+// Monotonic time in nanoseconds
+uint64_t stats_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Add the time since start (from stats_clock()) to a phase, unless stats
+// were turned off meanwhile. Stage threads record too, hence the atomics.
+void stats_add_time(stat_phase_t phase, uint64_t start) {
+    if (!stats_enabled) {
+        return;
+    }
+    uint64_t elapsed = stats_now() - start;
+    histogram_t* h = &histograms[phase];
+    __atomic_fetch_add(&h->buckets[bucket_of(elapsed)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (elapsed > max &&
+           !__atomic_compare_exchange_n(&h->max, &max, elapsed, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void stats_add_count(stat_counter_t counter) {
+    __atomic_fetch_add(&counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+// fork(), counted and timed
+pid_t stats_fork() {
+    uint64_t start = stats_clock();
+    pid_t pid = fork();
+    if (pid != 0) {
+        stats_count(STAT_FORKS);
+        stats_record(STAT_FORK, start);
+    }
+    return pid;
+}
+
+// Blocking waitpid(), timed
+pid_t stats_waitpid(pid_t pid, int* status, int options) {
+    uint64_t start = stats_clock();
+    pid_t result = waitpid(pid, status, options);
+    stats_record(STAT_WAIT, start);
+    return result;
+}
+
+// Allocations made by the shell's own code: the link wraps these calls
+// (WRAP_LDFLAGS in the Makefile), so the count costs one test while stats
+// are off
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+char* __real_strdup(const char* s);
+char* __real_strndup(const char* s, size_t n);
+
+void* __wrap_malloc(size_t size) {
+    stats_count(STAT_ALLOCS);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    stats_count(STAT_ALLOCS);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    stats_count(STAT_ALLOCS);
+    return __real_realloc(ptr, size);
+}
+
+char* __wrap_strdup(const char* s) {
+    stats_count(STAT_ALLOCS);
+    return __real_strdup(s);
+}
+
+char* __wrap_strndup(const char* s, size_t n) {
+    stats_count(STAT_ALLOCS);
+    return __real_strndup(s, n);
+}
+
+// Value at percentile (0-100) of a histogram: the top of its bucket, but
+// never more than the largest value seen
+static uint64_t percentile(const histogram_t* h, double pct) {
+    uint64_t rank = (uint64_t)(h->count * pct / 100.0 + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t limit = bucket_limit(i);
+            return limit < h->max ? limit : h->max;
+        }
+    }
+    return h->max;
+}
+
+// Format nanoseconds with a unit that keeps 3-4 significant digits
+static const char* format_time(char* buf, size_t size, uint64_t ns) {
+    if (ns < 1000) {
+        snprintf(buf, size, "%lluns", (unsigned long long)ns);
+    } else if (ns < 1000000) {
+        snprintf(buf, size, "%.1fus", ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(buf, size, "%.1fms", ns / 1e6);
+    } else {
+        snprintf(buf, size, "%.2fs", ns / 1e9);
+    }
+    return buf;
+}
+
+static void reset_stats() {
+    memset(histograms, 0, sizeof(histograms));
+    if (counters != NULL) {
+        memset(counters, 0, STAT_COUNTERS * sizeof(uint64_t));
+    }
+}
+
+// Built-in command: stats [on | off | reset]
+// Without an argument prints p50/p99/max of each phase and the counters.
+int builtin_stats(char** arglist) {
+    const char* action = arglist[1];
+    if (action != NULL && strcmp(action, "on") == 0) {
+        if (counters == NULL) {
+            counters = mmap(NULL, STAT_COUNTERS * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (counters == MAP_FAILED) {
+                counters = NULL;
+                perror("stats: mmap");
+                return 1;
+            }
+        }
+        stats_enabled = 1;
+        return 0;
+    }
+    if (action != NULL && strcmp(action, "off") == 0) {
+        stats_enabled = 0;
+        return 0;
+    }
+    if (action != NULL && strcmp(action, "reset") == 0) {
+        reset_stats();
+        return 0;
+    }
+    if (action != NULL) {
+        fprintf(stderr, "stats: usage: stats [on | off | reset]\n");
+        return 2;
+    }
+
+    FILE* out = stage_stream();
+    if (counters == NULL) {
+        fprintf(out, "stats are off (stats on starts collecting)\n");
+        return 0;
+    }
+    fprintf(out, "%-14s %10s %10s %10s %10s\n", "phase", "count", "p50", "p99", "max");
+    for (int i = 0; i < STAT_PHASES; i++) {
+        const histogram_t* h = &histograms[i];
+        if (h->count == 0) {
+            continue;
+        }
+        char p50[32], p99[32], max[32];
+        fprintf(out, "%-14s %10llu %10s %10s %10s\n", phase_names[i], (unsigned long long)h->count,
+                format_time(p50, sizeof(p50), percentile(h, 50)),
+                format_time(p99, sizeof(p99), percentile(h, 99)),
+                format_time(max, sizeof(max), h->max));
+    }
+    for (int i = 0; i < STAT_COUNTERS; i++) {
+        fprintf(out, "%s%s %llu", i > 0 ? ", " : "", counter_names[i], (unsigned long long)counters[i]);
+    }
+    fprintf(out, "%s\n", stats_enabled ? "" : " (off)");
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "shell.h"
+
+// Initialize an empty string buffer
+void sb_init(strbuf_t* sb) {
+    sb->data = NULL;
+    sb->len = 0;
+    sb->cap = 0;
+}
+
+// Make room for at least 'extra' more bytes plus the terminator
+void sb_reserve(strbuf_t* sb, size_t extra) {
+    if (sb->len + extra + 1 <= sb->cap) {
+        return;
+    }
+    size_t new_cap = sb->cap ? sb->cap : 64;
+    while (new_cap < sb->len + extra + 1) {
+        new_cap *= 2;
+    }
+    char* data = realloc(sb->data, new_cap);
+    if (data == NULL) {
+        perror("realloc failed");
+        exit(1);
+    }
+    sb->data = data;
+    sb->cap = new_cap;
+}
+
+// Append a single character
+void sb_putc(strbuf_t* sb, char c) {
+    sb_reserve(sb, 1);
+    sb->data[sb->len++] = c;
+    sb->data[sb->len] = '\0';
+}
+
+// Append 'n' bytes of a string
+void sb_appendn(strbuf_t* sb, const char* str, size_t n) {
+    sb_reserve(sb, n);
+    memcpy(sb->data + sb->len, str, n);
+    sb->len += n;
+    sb->data[sb->len] = '\0';
+}
+
+// Append a NUL-terminated string
+void sb_append(strbuf_t* sb, const char* str) {
+    if (str != NULL) {
+        sb_appendn(sb, str, strlen(str));
+    }
+}
+
+// Hand the buffer contents to the caller (never returns NULL)
+char* sb_release(strbuf_t* sb) {
+    sb_reserve(sb, 0);
+    sb->data[sb->len] = '\0';
+    char* data = sb->data;
+    sb_init(sb);
+    return data;
+}
+
+// Free the buffer contents
+void sb_free(strbuf_t* sb) {
+    free(sb->data);
+    sb_init(sb);
+}
+
+// FNV-1a hash of a string
+unsigned int hash_string(const char* str) {
+    unsigned int hash = 2166136261u;
+    while (*str != '\0') {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// 64-bit FNV-1a hash of a byte range
+unsigned long long hash_bytes(const void* data, size_t len) {
+    const unsigned char* p = data;
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
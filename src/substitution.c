@@ -0,0 +1,267 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <sys/mman.h>
+
+#define CAPTURE_CHUNK 65536   // Bytes requested per read of captured output
+#define MAX_PROCESS_SUBSTITUTIONS 64
+
+jmp_buf* substitution_exit = NULL;
+int substitution_status = 0;
+
+// Read everything from fd into out with large reads
+static void read_all(int fd, strbuf_t* out) {
+    for (;;) {
+        sb_reserve(out, CAPTURE_CHUNK);
+        ssize_t n = read(fd, out->data + out->len, out->cap - out->len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        out->len += n;
+    }
+    if (out->data != NULL) out->data[out->len] = '\0';
+}
+
+// Check if a substitution can run without forking: a single simple command
+// whose name is a shell function or a builtin
+static int runs_in_process(node_t* tree) {
+    if (tree->type != NODE_COMMAND || tree->background) {
+        return 0;
+    }
+    command_t* cmd = &tree->command;
+    if (cmd->num_words == 0 || (cmd->words[0].flags & WORD_NEEDS_EXPANSION)) {
+        return 0;
+    }
+    return find_function(cmd->words[0].text) != NULL || is_builtin(cmd->words[0].text);
+}
+
+// Run the command in this process with stdout sent to a memory file.
+// Shell state (variables, functions, options, positional parameters,
+// directory) is saved and restored so it behaves like a subshell.
+// Returns the exit status, or -1 if capturing could not be set up.
+static int capture_in_process(node_t* tree, strbuf_t* out) {
+    int fd = memfd_create("substitution", MFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    fflush(stdout);
+    int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(fd, STDOUT_FILENO);
+
+    variable_snapshot_t* snap = save_variables();
+    function_snapshot_t* functions = save_functions();
+    int saved_pipe_stats = pipe_stats;
+    int saved_stats_enabled = stats_enabled;
+    char** saved_args = positional_args;
+    int saved_count = positional_count;
+    int saved_loop_depth = loop_depth;
+    int saved_function_depth = function_depth;
+    jmp_buf* outer = substitution_exit;
+    jmp_buf env;
+
+    int status;
+    int code = setjmp(env);
+    if (code == 0) {
+        substitution_exit = &env;
+        status = execute_node(tree);
+    } else {
+        // 'exit' inside the substitution; the argv of the frames it
+        // unwound through is not freed
+        status = code - 1;
+    }
+    fflush(stdout);
+
+    substitution_exit = outer;
+    restore_variables(snap);
+    restore_functions(functions);
+    pipe_stats = saved_pipe_stats;
+    stats_enabled = saved_stats_enabled;
+    positional_args = saved_args;
+    positional_count = saved_count;
+    loop_depth = saved_loop_depth;
+    function_depth = saved_function_depth;
+    break_levels = 0;
+    continue_levels = 0;
+    return_pending = 0;
+    if (cwd >= 0) {
+        if (fchdir(cwd) != 0) perror("cd");
+        close(cwd);
+    }
+
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    lseek(fd, 0, SEEK_SET);
+    read_all(fd, out);
+    close(fd);
+    return status;
+}
+
+// Run the command in a child process and read its output through a pipe
+static int capture_in_child(node_t* tree, strbuf_t* out) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    fflush(stdout);
+    pid_t pid = stats_fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        interactive = 0;
+        substitution_exit = NULL;
+        exit(execute_node(tree));
+    }
+
+    close(fds[1]);
+    read_all(fds[0], out);
+    close(fds[0]);
+
+    int wstatus;
+    stats_waitpid(pid, &wstatus, 0);
+    return decode_status(wstatus);
+}
+
+// Expand $(command): append the command's output, minus trailing newlines,
+// to out and return its exit status (also stored in $?)
+int command_substitution(const char* command, strbuf_t* out) {
+    node_t* tree;
+    int result = parse_program(command, &tree);
+    if (result == PARSE_INCOMPLETE) {
+        fprintf(stderr, "Syntax error: unexpected end of file in $(...)\n");
+    }
+    if (result != PARSE_OK) {
+        return last_status = 2;
+    }
+    if (tree == NULL) {
+        return last_status = 0; // Empty command
+    }
+
+    strbuf_t output;
+    sb_init(&output);
+
+    int status = -1;
+    if (runs_in_process(tree)) {
+        status = capture_in_process(tree, &output);
+    }
+    if (status < 0) {
+        status = capture_in_child(tree, &output);
+    }
+    free_node(tree);
+
+    while (output.len > 0 && output.data[output.len - 1] == '\n') {
+        output.len--;
+    }
+    sb_appendn(out, output.data ? output.data : "", output.len);
+    sb_free(&output);
+
+    return substitution_status = last_status = status;
+}
+
+// Process substitutions started for the current command: the child and
+// the pipe end the shell keeps open for the command to use via /dev/fd
+typedef struct {
+    pid_t pid;
+    int fd;
+} process_substitution_t;
+
+static process_substitution_t process_subs[MAX_PROCESS_SUBSTITUTIONS];
+static int num_process_subs = 0;
+
+// Remember how many process substitutions are running, so a command can
+// finish only the ones started while expanding its own words
+int process_substitution_mark() {
+    return num_process_subs;
+}
+
+// Expand <(command) or >(command): run command with its stdout (or stdin,
+// for >(...)) connected to a pipe and append /dev/fd/N naming the other end
+void process_substitution(const char* command, int writing, strbuf_t* out) {
+    node_t* tree;
+    int result = parse_program(command, &tree);
+    if (result == PARSE_INCOMPLETE) {
+        fprintf(stderr, "Syntax error: unexpected end of file in %c(...)\n", writing ? '>' : '<');
+    }
+    if (result != PARSE_OK) {
+        last_status = 2;
+        return;
+    }
+    if (num_process_subs == MAX_PROCESS_SUBSTITUTIONS) {
+        fprintf(stderr, "Too many process substitutions\n");
+        free_node(tree);
+        return;
+    }
+
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        free_node(tree);
+        return;
+    }
+
+    fflush(stdout);
+    pid_t pid = stats_fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        free_node(tree);
+        return;
+    }
+
+    if (pid == 0) {
+        // Don't hold other substitutions' pipes open, or they never see EOF
+        for (int i = 0; i < num_process_subs; i++) {
+            close(process_subs[i].fd);
+        }
+        dup2(fds[writing ? 0 : 1], writing ? STDIN_FILENO : STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        interactive = 0;
+        substitution_exit = NULL;
+        exit(tree != NULL ? execute_node(tree) : 0);
+    }
+
+    free_node(tree);
+    close(fds[writing ? 0 : 1]);
+
+    // Keep the shell's end above the descriptors scripts redirect by number
+    int fd = fcntl(fds[writing ? 1 : 0], F_DUPFD, 10);
+    if (fd < 0) {
+        fd = fds[writing ? 1 : 0];
+    } else {
+        close(fds[writing ? 1 : 0]);
+    }
+
+    process_subs[num_process_subs].pid = pid;
+    process_subs[num_process_subs].fd = fd;
+    num_process_subs++;
+
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+    sb_append(out, path);
+}
+
+// Finish the process substitutions started since mark once their command
+// is done: close the shell's pipe ends so readers see EOF and writers get
+// EPIPE, then wait for them. With wait unset (exec keeping an fd open) the
+// children are left to be reaped with the other zombies.
+void finish_process_substitutions(int mark, int wait) {
+    for (int i = mark; i < num_process_subs; i++) {
+        close(process_subs[i].fd);
+    }
+    for (int i = mark; wait && i < num_process_subs; i++) {
+        waitpid(process_subs[i].pid, NULL, 0);
+    }
+    num_process_subs = mark;
+}
@@ -1,12 +1,57 @@
 #include "shell.h"
 
-// Global variables array
-static variable_t variables[MAX_VARIABLES];
+#define VAR_BUCKETS 256   // Initial size of the variable hash table
+
+// Shell variable: a scalar or an array, chained in a hash bucket
+typedef struct variable {
+    char* name;
+    char* value;                  // Scalar value; NULL for arrays
+    array_t* array;               // Indexed or associative array, or NULL
+    struct variable* next;
+} variable_t;
+
+// Global variable hash table
+static variable_t** buckets = NULL;
+static int num_buckets = 0;
 static int variable_count = 0;
 
+// Positional parameters ($0, $1..$N)
+char* shell_name = "myshell";
+char** positional_args = NULL;
+int positional_count = 0;
+
+// Saved copy of a variable, put back when a function scope ends or an
+// in-process subshell finishes
+typedef struct saved_variable {
+    char* name;
+    variable_t* value;            // Detached copy; NULL if it was unset
+    int scope;                    // Scope that declared the local
+    struct saved_variable* next;
+} saved_variable_t;
+
+static saved_variable_t* saved_variables = NULL;
+static int scope_depth = 0;
+
+// Changes made while a command runs in-process as a subshell: the first
+// change to each variable saves its old value so the snapshot can be
+// restored without copying the whole store up front
+struct variable_snapshot {
+    saved_variable_t* journal;
+    int scope;
+    struct variable_snapshot* outer;
+};
+
+static variable_snapshot_t* snapshot = NULL;
+
 // Initialize variables system
 void init_variables() {
     variable_count = 0;
+    num_buckets = VAR_BUCKETS;
+    buckets = calloc(num_buckets, sizeof(variable_t*));
+    if (buckets == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
     
     // Set some default environment variables
     char* home = getenv("HOME");
@@ -32,41 +77,308 @@ void init_variables() {
     }
 }
 
-// Set a variable (create or update)
+// Find a variable by name, or NULL
+static variable_t* find_variable(const char* name) {
+    if (buckets == NULL) return NULL;
+    for (variable_t* v = buckets[hash_string(name) & (num_buckets - 1)]; v != NULL; v = v->next) {
+        if (strcmp(v->name, name) == 0) {
+            return v;
+        }
+    }
+    return NULL;
+}
+
+// Free a variable's value (scalar or array)
+static void clear_value(variable_t* v) {
+    free(v->value);
+    array_free(v->array);
+    v->value = NULL;
+    v->array = NULL;
+}
+
+// Detached deep copy of a variable, or NULL
+static variable_t* copy_variable(const variable_t* v) {
+    if (v == NULL) return NULL;
+    variable_t* copy = calloc(1, sizeof(variable_t));
+    if (copy == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    copy->name = strdup(v->name);
+    copy->value = v->value != NULL ? strdup(v->value) : NULL;
+    copy->array = v->array != NULL ? array_copy(v->array) : NULL;
+    return copy;
+}
+
+// Free a detached variable
+static void free_variable(variable_t* v) {
+    if (v == NULL) return;
+    clear_value(v);
+    free(v->name);
+    free(v);
+}
+
+// Remember a variable's value before the first change to it inside an
+// in-process subshell
+static void journal_variable(const char* name) {
+    if (snapshot == NULL) return;
+    for (saved_variable_t* s = snapshot->journal; s != NULL; s = s->next) {
+        if (strcmp(s->name, name) == 0) {
+            return;
+        }
+    }
+    saved_variable_t* saved = malloc(sizeof(saved_variable_t));
+    if (saved == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    saved->name = strdup(name);
+    saved->value = copy_variable(find_variable(name));
+    saved->scope = scope_depth;
+    saved->next = snapshot->journal;
+    snapshot->journal = saved;
+}
+
+// Double the hash table when chains get long
+static void grow_buckets() {
+    int n = num_buckets * 2;
+    variable_t** table = calloc(n, sizeof(variable_t*));
+    if (table == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    for (int i = 0; i < num_buckets; i++) {
+        while (buckets[i] != NULL) {
+            variable_t* v = buckets[i];
+            buckets[i] = v->next;
+            unsigned int b = hash_string(v->name) & (n - 1);
+            v->next = table[b];
+            table[b] = v;
+        }
+    }
+    free(buckets);
+    buckets = table;
+    num_buckets = n;
+}
+
+// Find a variable for changing it, creating an unset one if needed
+static variable_t* modify_variable(const char* name) {
+    journal_variable(name);
+    variable_t* v = find_variable(name);
+    if (v != NULL) return v;
+
+    if (buckets == NULL) init_variables();
+    if (variable_count >= num_buckets * 2) grow_buckets();
+    v = calloc(1, sizeof(variable_t));
+    if (v == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    v->name = strdup(name);
+    unsigned int b = hash_string(name) & (num_buckets - 1);
+    v->next = buckets[b];
+    buckets[b] = v;
+    variable_count++;
+    return v;
+}
+
+// Set a variable (create or update). On an array this sets element 0
+// (key "0" of an associative array).
 void set_variable(const char* name, const char* value) {
     if (name == NULL || value == NULL) return;
-    
-    // Check if variable already exists
-    for (int i = 0; i < variable_count; i++) {
-        if (strcmp(variables[i].name, name) == 0) {
-            strncpy(variables[i].value, value, VAR_VALUE_LEN - 1);
-            variables[i].value[VAR_VALUE_LEN - 1] = '\0';
-            return;
+
+    variable_t* v = modify_variable(name);
+    if (v->array != NULL) {
+        if (array_is_assoc(v->array)) {
+            array_set_key(v->array, "0", value);
+        } else {
+            array_set_index(v->array, 0, value);
         }
+        return;
     }
-    
-    // Create new variable if space available
-    if (variable_count < MAX_VARIABLES) {
-        strncpy(variables[variable_count].name, name, VAR_NAME_LEN - 1);
-        variables[variable_count].name[VAR_NAME_LEN - 1] = '\0';
-        
-        strncpy(variables[variable_count].value, value, VAR_VALUE_LEN - 1);
-        variables[variable_count].value[VAR_VALUE_LEN - 1] = '\0';
-        
-        variable_count++;
-    } else {
-        fprintf(stderr, "Error: too many variables (max %d)\n", MAX_VARIABLES);
+    char* copy = strdup(value); // value may point into the old one
+    free(v->value);
+    v->value = copy;
+}
+
+// Remove a shell variable
+void unset_variable(const char* name) {
+    if (find_variable(name) == NULL) return;
+    journal_variable(name);
+
+    variable_t** link = &buckets[hash_string(name) & (num_buckets - 1)];
+    while (strcmp((*link)->name, name) != 0) {
+        link = &(*link)->next;
+    }
+    variable_t* v = *link;
+    *link = v->next;
+    free_variable(v);
+    variable_count--;
+}
+
+// Put a saved copy back in place of a variable (NULL: unset it); the
+// copy is consumed
+static void restore_variable(const char* name, variable_t* saved) {
+    if (saved == NULL) {
+        unset_variable(name);
+        return;
+    }
+    variable_t* v = modify_variable(name);
+    clear_value(v);
+    v->value = saved->value;
+    v->array = saved->array;
+    saved->value = NULL;
+    saved->array = NULL;
+    free_variable(saved);
+}
+
+// The array stored in a variable, or NULL if it is unset or a scalar
+array_t* get_array(const char* name) {
+    variable_t* v = find_variable(name);
+    return v != NULL ? v->array : NULL;
+}
+
+// Get an array for changing it, turning the variable into one if needed.
+// A scalar becomes element 0 of an indexed array. Returns NULL if the
+// variable is an array of the other kind.
+array_t* make_array(const char* name, int assoc) {
+    variable_t* v = modify_variable(name);
+    if (v->array != NULL) {
+        return array_is_assoc(v->array) == assoc ? v->array : NULL;
     }
+    v->array = array_new(assoc);
+    if (v->value != NULL) {
+        if (assoc) {
+            array_set_key(v->array, "0", v->value);
+        } else {
+            array_set_index(v->array, 0, v->value);
+        }
+        free(v->value);
+        v->value = NULL;
+    }
+    return v->array;
 }
 
-// Get a variable's value
+// Replace a variable with an indexed array of count items; takes ownership
+// of items and the strings in it (mapfile)
+void set_array(const char* name, char** items, int count) {
+    variable_t* v = modify_variable(name);
+    clear_value(v);
+    v->array = array_new(0);
+    for (int i = 0; i < count; i++) {
+        array_set_index(v->array, i, items[i]);
+        free(items[i]);
+    }
+    free(items);
+}
+
+// Enter a function scope
+void push_scope() {
+    scope_depth++;
+}
+
+// Leave a function scope, restoring variables its locals shadowed
+void pop_scope() {
+    while (saved_variables != NULL && saved_variables->scope == scope_depth) {
+        saved_variable_t* saved = saved_variables;
+        saved_variables = saved->next;
+        restore_variable(saved->name, saved->value);
+        free(saved->name);
+        free(saved);
+    }
+    scope_depth--;
+}
+
+// Make a variable local to the current scope by saving its current value
+void make_local(const char* name) {
+    for (saved_variable_t* s = saved_variables; s != NULL && s->scope == scope_depth; s = s->next) {
+        if (strcmp(s->name, name) == 0) {
+            return; // Already local in this scope
+        }
+    }
+
+    saved_variable_t* saved = malloc(sizeof(saved_variable_t));
+    if (saved == NULL) {
+        perror("malloc failed");
+        return;
+    }
+    saved->name = strdup(name);
+    saved->value = copy_variable(find_variable(name));
+    saved->scope = scope_depth;
+    saved->next = saved_variables;
+    saved_variables = saved;
+}
+
+// Start recording changes so restore_variables() can undo them
+variable_snapshot_t* save_variables() {
+    variable_snapshot_t* snap = malloc(sizeof(variable_snapshot_t));
+    if (snap == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    snap->journal = NULL;
+    snap->scope = scope_depth;
+    snap->outer = snapshot;
+    snapshot = snap;
+    return snap;
+}
+
+// Undo the changes made since save_variables() and free the snapshot
+void restore_variables(variable_snapshot_t* snap) {
+    while (scope_depth > snap->scope) {
+        pop_scope(); // Scopes left open by an early exit
+    }
+    // Not journaled again: the outer snapshot already has whatever it
+    // needs from before this one started
+    snapshot = NULL;
+    while (snap->journal != NULL) {
+        saved_variable_t* saved = snap->journal;
+        snap->journal = saved->next;
+        restore_variable(saved->name, saved->value);
+        free(saved->name);
+        free(saved);
+    }
+    snapshot = snap->outer;
+    free(snap);
+}
+
+// Stop recording changes but keep them (the outermost snapshot only).
+// Returns the names of the variables changed since save_variables(),
+// *count of them; the caller frees the array and the names.
+char** keep_variables(variable_snapshot_t* snap, int* count) {
+    int n = 0;
+    for (saved_variable_t* s = snap->journal; s != NULL; s = s->next) n++;
+    char** names = malloc((n + 1) * sizeof(char*));
+    if (names == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    n = 0;
+    while (snap->journal != NULL) {
+        saved_variable_t* saved = snap->journal;
+        snap->journal = saved->next;
+        names[n++] = saved->name;
+        free_variable(saved->value);
+        free(saved);
+    }
+    names[n] = NULL;
+    *count = n;
+    snapshot = snap->outer;
+    free(snap);
+    return names;
+}
+
+// Get a variable's value; for an array, element 0
 char* get_variable(const char* name) {
     if (name == NULL) return NULL;
-    
-    for (int i = 0; i < variable_count; i++) {
-        if (strcmp(variables[i].name, name) == 0) {
-            return variables[i].value;
-        }
+
+    variable_t* v = find_variable(name);
+    if (v != NULL && v->array != NULL) {
+        return (char*)(array_is_assoc(v->array) ? array_get_key(v->array, "0")
+                                                 : array_get_index(v->array, 0));
+    }
+    if (v != NULL) {
+        return v->value;
     }
     
     // Also check environment variables
@@ -78,7 +390,34 @@ char* get_variable(const char* name) {
     return NULL;
 }
 
-// Check if a command line is a variable assignment
+// Check if a string is a valid variable name
+int is_valid_name(const char* name) {
+    if (name == NULL || !((*name >= 'a' && *name <= 'z') ||
+                          (*name >= 'A' && *name <= 'Z') ||
+                          *name == '_')) {
+        return 0;
+    }
+    for (const char* p = name + 1; *p != '\0'; p++) {
+        if (!((*p >= 'a' && *p <= 'z') ||
+              (*p >= 'A' && *p <= 'Z') ||
+              (*p >= '0' && *p <= '9') ||
+              *p == '_')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Check if a character can appear in a variable name
+static int is_name_char(char c) {
+    return (c >= 'a' && c <= 'z') ||
+           (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') ||
+           c == '_';
+}
+
+// Check if a word is a variable assignment: NAME=value, NAME+=value or
+// NAME[subscript]=value
 int is_variable_assignment(const char* cmdline) {
     if (cmdline == NULL) return 0;
     
@@ -86,157 +425,495 @@ int is_variable_assignment(const char* cmdline) {
     const char* ptr = cmdline;
     while (*ptr == ' ' || *ptr == '\t') ptr++;
     
-    // Check for valid variable name characters
-    const char* equal_sign = strchr(ptr, '=');
-    if (equal_sign == NULL || equal_sign == ptr) {
-        return 0; // No equal sign or equal sign at start
-    }
-    
-    // Check that there are no spaces around the equal sign
-    // Actually, let's be more permissive - allow spaces after equal sign for values with spaces
-    if (equal_sign > ptr && (*(equal_sign - 1) == ' ' || *(equal_sign - 1) == '\t')) {
-        return 0; // Space before equal sign is not allowed
-    }
-    
-    // Check variable name validity (alphanumeric and underscore)
-    for (const char* p = ptr; p < equal_sign; p++) {
-        if (!((*p >= 'a' && *p <= 'z') || 
-              (*p >= 'A' && *p <= 'Z') || 
-              (*p >= '0' && *p <= '9') || 
-              *p == '_')) {
-            return 0;
-        }
-    }
-    
     // First character must be alphabetic or underscore
     if (!((*ptr >= 'a' && *ptr <= 'z') || 
           (*ptr >= 'A' && *ptr <= 'Z') || 
           *ptr == '_')) {
         return 0;
     }
-    
-    return 1;
+    while (is_name_char(*ptr)) ptr++;
+
+    if (*ptr == '[') {
+        ptr = skip_balanced(ptr, '[', ']');
+        if (ptr == NULL) return 0;
+    }
+    if (*ptr == '+') ptr++;
+    return *ptr == '=';
+}
+
+// Check if an assignment's value is a (...) list
+int is_compound_assignment(const char* text) {
+    const char* equal_sign = strchr(text, '=');
+    if (equal_sign == NULL || equal_sign[1] != '(') return 0;
+    const char* end = skip_balanced(equal_sign + 1, '(', ')');
+    return end != NULL && *end == '\0';
 }
 
-// Handle variable assignment
-int handle_variable_assignment(const char* cmdline) {
-    if (!is_variable_assignment(cmdline)) {
+// Expand source text into a single string
+static char* expand_source(const char* text) {
+    word_t word = { (char*)text, WORD_NEEDS_EXPANSION };
+    return expand_word_string(&word);
+}
+
+// Store value at a subscript of an array: a key, or an arithmetic index.
+// With raw set the subscript is source text still to be expanded.
+static int assign_element(const char* name, array_t* a, const char* sub, int raw,
+                          const char* value, int append) {
+    if (array_is_assoc(a)) {
+        char* key = raw ? expand_source(sub) : strdup(sub);
+        const char* old = array_get_key(a, key);
+        if (append && old != NULL) {
+            strbuf_t sb;
+            sb_init(&sb);
+            sb_append(&sb, old);
+            sb_append(&sb, value);
+            array_set_key(a, key, sb.data);
+            sb_free(&sb);
+        } else {
+            array_set_key(a, key, value);
+        }
+        free(key);
         return 0;
     }
-    
-    // Parse name and value
-    char* copy = strdup(cmdline);
-    if (copy == NULL) return 0;
-    
-    char* equal_sign = strchr(copy, '=');
-    
-    if (equal_sign == NULL) {
-        free(copy);
-        return 0;
+
+    long long index;
+    if (arith_evaluate(sub, &index) != 0) {
+        return 1;
     }
-    
-    // Split into name and value
-    *equal_sign = '\0';
-    char* name = copy;
-    char* value = equal_sign + 1;
-    
-    // Trim whitespace from name
-    char* name_end = name + strlen(name) - 1;
-    while (name_end > name && (*name_end == ' ' || *name_end == '\t')) {
-        *name_end = '\0';
-        name_end--;
+    const char* old = array_get_index(a, index);
+    int result;
+    if (append && old != NULL) {
+        strbuf_t sb;
+        sb_init(&sb);
+        sb_append(&sb, old);
+        sb_append(&sb, value);
+        result = array_set_index(a, index, sb.data);
+        sb_free(&sb);
+    } else {
+        result = array_set_index(a, index, value);
     }
-    
-    // Trim leading whitespace from name
-    while (*name == ' ' || *name == '\t') {
-        name++;
+    if (result != 0) {
+        fprintf(stderr, "%s[%s]: bad array subscript\n", name, sub);
+        return 1;
     }
-    
-    // Set the variable
-    set_variable(name, value);
-    
-    printf("Variable set: %s=%s\n", name, value); // Debug output
-    
-    free(copy);
-    return 1;
+    return 0;
+}
+
+// Assign a (...) list: words become elements in order, [sub]=value sets
+// one element. The list is always source text.
+static int assign_list(const char* name, array_t* a, const char* list) {
+    token_list_t tokens;
+    if (lex_input(list, &tokens) != PARSE_OK) {
+        fprintf(stderr, "%s: bad array assignment\n", name);
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = 0; i < tokens.count && status == 0; i++) {
+        token_t* tok = &tokens.tokens[i];
+        if (tok->type == TOK_NEWLINE || tok->type == TOK_EOF) continue;
+        if (tok->type != TOK_WORD) {
+            fprintf(stderr, "%s: bad array assignment\n", name);
+            status = 1;
+            break;
+        }
+
+        // [sub]=value; the subscript may hold blanks that split the tokens
+        const char* open = list + tok->start;
+        const char* close = *open == '[' ? skip_balanced(open, '[', ']') : NULL;
+        if (close != NULL && *close == '=') {
+            int off = close + 1 - list;
+            const char* end = close + 1;
+            while (i + 1 < tokens.count && tokens.tokens[i + 1].type == TOK_WORD &&
+                   tokens.tokens[i + 1].start <= off) {
+                i++;
+            }
+            if (tokens.tokens[i].start <= off && tokens.tokens[i].end > off) {
+                end = list + tokens.tokens[i].end;
+            }
+            char* text = strndup(close + 1, end - close - 1);
+            char* sub = strndup(open + 1, close - open - 2);
+            char* value = expand_source(text);
+            free(text);
+            status = assign_element(name, a, sub, 1, value, 0);
+            free(sub);
+            free(value);
+        } else if (array_is_assoc(a)) {
+            fprintf(stderr, "%s: %s: must use subscript when assigning associative array\n",
+                    name, tok->text);
+            status = 1;
+        } else {
+            // Plain words are split and globbed into consecutive elements
+            word_t word;
+            word.text = tok->text;
+            word.flags = WORD_NEEDS_EXPANSION | WORD_HAS_GLOB;
+            char** fields = expand_words(&word, 1);
+            for (int j = 0; fields[j] != NULL; j++) {
+                array_set_index(a, array_end(a), fields[j]);
+            }
+            free_argv(fields);
+        }
+    }
+
+    free_tokens(&tokens);
+    return status;
+}
+
+// Perform an assignment: NAME=value, NAME+=value, NAME[sub]=value or
+// NAME=(list). With raw set (assignment words of a command) the subscript
+// and value are source text still to be expanded; arguments of declare
+// and local arrive expanded, except for (list) values. Returns non-zero
+// on error.
+int assign_word(const char* text, int raw) {
+    char name[VAR_NAME_LEN];
+    int len = 0;
+    const char* p = text;
+    while (is_name_char(*p)) {
+        if (len < VAR_NAME_LEN - 1) name[len++] = *p;
+        p++;
+    }
+    name[len] = '\0';
+
+    char* sub = NULL;
+    if (*p == '[') {
+        const char* close = skip_balanced(p, '[', ']');
+        if (close != NULL) {
+            sub = strndup(p + 1, close - p - 2);
+            p = close;
+        }
+    }
+    int append = *p == '+';
+    if (append) p++;
+    if (!is_valid_name(name) || *p != '=') {
+        fprintf(stderr, "%s: not a valid identifier\n", text);
+        free(sub);
+        return 1;
+    }
+    const char* value = p + 1;
+
+    int status = 0;
+    if (sub == NULL && is_compound_assignment(text)) {
+        array_t* existing = get_array(name);
+        int assoc = existing != NULL && array_is_assoc(existing);
+        if (!append) {
+            unset_variable(name);
+        }
+        array_t* a = make_array(name, assoc);
+        char* list = strndup(value + 1, strlen(value) - 2);
+        status = assign_list(name, a, list);
+        free(list);
+        return status;
+    }
+
+    char* expanded = raw ? expand_source(value) : strdup(value);
+    if (sub != NULL) {
+        array_t* a = get_array(name);
+        if (a == NULL) a = make_array(name, 0);
+        status = assign_element(name, a, sub, raw, expanded, append);
+    } else if (append) {
+        const char* old = get_variable(name);
+        strbuf_t sb;
+        sb_init(&sb);
+        sb_append(&sb, old);
+        sb_append(&sb, expanded);
+        set_variable(name, sb.data != NULL ? sb.data : "");
+        sb_free(&sb);
+    } else {
+        set_variable(name, expanded);
+    }
+    free(expanded);
+    free(sub);
+    return status;
+}
+
+// Append the value of a parameter: a variable, a positional parameter
+// or one of the special parameters ? $ # @ *
+void append_parameter(const char* name, strbuf_t* out) {
+    char num[16];
+
+    if (strcmp(name, "?") == 0) {
+        snprintf(num, sizeof(num), "%d", last_status);
+        sb_append(out, num);
+    } else if (strcmp(name, "$") == 0) {
+        snprintf(num, sizeof(num), "%d", (int)getpid());
+        sb_append(out, num);
+    } else if (strcmp(name, "#") == 0) {
+        snprintf(num, sizeof(num), "%d", positional_count);
+        sb_append(out, num);
+    } else if (strcmp(name, "@") == 0 || strcmp(name, "*") == 0) {
+        for (int i = 0; i < positional_count; i++) {
+            if (i > 0) sb_putc(out, ' ');
+            sb_append(out, positional_args[i]);
+        }
+    } else if (name[0] >= '0' && name[0] <= '9') {
+        int n = atoi(name);
+        if (n == 0) {
+            sb_append(out, shell_name);
+        } else if (n <= positional_count) {
+            sb_append(out, positional_args[n - 1]);
+        }
+    } else {
+        // Unset variables expand to nothing
+        sb_append(out, get_variable(name));
+    }
+}
+
+// Check if a parameter is set (special parameters always are)
+int parameter_is_set(const char* name) {
+    if (name[0] >= '0' && name[0] <= '9') {
+        int n = atoi(name);
+        return n == 0 || n <= positional_count;
+    }
+    if (!is_valid_name(name)) {
+        return 1;
+    }
+    return get_variable(name) != NULL;
+}
+
+// Expand one $ reference at p (which points at the '$') into out.
+// Returns a pointer just past the reference.
+const char* expand_dollar(const char* p, strbuf_t* out) {
+    const char* ptr = p + 1; // Skip the '$'
+
+    if (ptr[0] == '(' && ptr[1] == '(') {
+        // $(( expression )): evaluated in-process
+        const char* end = ptr + 2;
+        int depth = 0;
+        while (*end != '\0' && !(depth == 0 && end[0] == ')' && end[1] == ')')) {
+            if (*end == '(') depth++;
+            else if (*end == ')') depth--;
+            end++;
+        }
+        if (*end != '\0') {
+            char* expr = strndup(ptr + 2, end - ptr - 2);
+            long long value = 0;
+            if (arith_evaluate(expr, &value) == 0) {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%lld", value);
+                sb_append(out, buf);
+            } else {
+                expansion_error = 1;
+            }
+            free(expr);
+            return end + 2;
+        }
+    }
+
+    if (*ptr == '(') {
+        // $( command ): output of the command, trailing newlines removed
+        const char* end = skip_balanced(ptr, '(', ')');
+        if (end != NULL) {
+            char* command = strndup(ptr + 1, end - ptr - 2);
+            command_substitution(command, out);
+            free(command);
+            return end;
+        }
+    }
+
+    // Extract variable name
+    char var_name[VAR_NAME_LEN] = "";
+    int name_len = 0;
+
+    if (*ptr == '{') {
+        // ${...}: the name and any operator are handled by expand_braced()
+        const char* end = skip_balanced(ptr, '{', '}');
+        if (end == NULL) {
+            sb_putc(out, '$');
+            return ptr;
+        }
+        char* inner = strndup(ptr + 1, end - ptr - 2);
+        expand_braced(inner, out);
+        free(inner);
+        return end;
+    } else if (*ptr != '\0' && (strchr("?$#@*", *ptr) != NULL || (*ptr >= '0' && *ptr <= '9'))) {
+        // Special and single-digit positional parameters
+        var_name[name_len++] = *ptr++;
+    } else if (is_name_char(*ptr)) {
+        // $VAR syntax
+        while (is_name_char(*ptr)) {
+            if (name_len < VAR_NAME_LEN - 1) {
+                var_name[name_len++] = *ptr;
+            }
+            ptr++;
+        }
+    } else {
+        // Not a reference: keep the '$' literally
+        sb_putc(out, '$');
+        return ptr;
+    }
+
+    var_name[name_len] = '\0';
+    append_parameter(var_name, out);
+    return ptr;
 }
 
 // Expand variables in a string (replace $VAR with value)
 char* expand_variables(const char* str) {
     if (str == NULL) return NULL;
-    
-    char* result = malloc(MAX_LEN);
-    if (result == NULL) return NULL;
-    result[0] = '\0';
-    
+
+    strbuf_t result;
+    sb_init(&result);
+
     const char* ptr = str;
-    
     while (*ptr != '\0') {
-        if (*ptr == '$') {
-            // Found a variable reference
-            ptr++; // Skip the '$'
-            
-            if (*ptr == '\0') {
-                // $ at end of string
-                strcat(result, "$");
-                break;
+        const char* dollar = strchr(ptr, '$');
+        if (dollar == NULL) {
+            sb_append(&result, ptr);
+            break;
+        }
+        // Copy the plain run in one go, then expand the reference
+        sb_appendn(&result, ptr, dollar - ptr);
+        ptr = expand_dollar(dollar, &result);
+    }
+
+    return sb_release(&result);
+}
+
+// Append the named variables to a startup image as NUL-terminated
+// strings: the count, then per variable its kind ('s' scalar, 'a'
+// indexed, 'A' associative, '-' unset) and name, then the value or the
+// element count and subscript/value pairs
+void dump_variables(char** names, int count, strbuf_t* out) {
+    char num[32];
+    snprintf(num, sizeof(num), "%d", count);
+    sb_appendn(out, num, strlen(num) + 1);
+    for (int i = 0; i < count; i++) {
+        variable_t* v = find_variable(names[i]);
+        if (v != NULL && v->array == NULL && v->value == NULL) {
+            v = NULL; // Declared without a value
+        }
+        sb_putc(out, v == NULL ? '-' : v->array == NULL ? 's' : array_is_assoc(v->array) ? 'A' : 'a');
+        sb_appendn(out, names[i], strlen(names[i]) + 1);
+        if (v == NULL) {
+            continue;
+        }
+        if (v->array == NULL) {
+            sb_appendn(out, v->value, strlen(v->value) + 1);
+            continue;
+        }
+        snprintf(num, sizeof(num), "%lld", array_count(v->array));
+        sb_appendn(out, num, strlen(num) + 1);
+        long long pos = 0, index;
+        const char *key, *value;
+        while (array_next(v->array, &pos, &index, &key, &value)) {
+            if (key == NULL) {
+                snprintf(num, sizeof(num), "%lld", index);
+                key = num;
             }
-            
-            // Extract variable name
-            char var_name[VAR_NAME_LEN] = "";
-            int name_len = 0;
-            
-            if (*ptr == '{') {
-                // ${VAR} syntax
-                ptr++; // Skip '{'
-                while (*ptr != '\0' && *ptr != '}' && name_len < VAR_NAME_LEN - 1) {
-                    var_name[name_len++] = *ptr++;
-                }
-                if (*ptr == '}') ptr++; // Skip '}'
+            sb_appendn(out, key, strlen(key) + 1);
+            sb_appendn(out, value, strlen(value) + 1);
+        }
+    }
+}
+
+// Set the variables of a startup image written by dump_variables(),
+// advancing *p past them. Returns -1 if the data is damaged.
+int load_variables(const char** p, const char* end) {
+    const char* num = image_string(p, end);
+    if (num == NULL) return -1;
+    for (long n = atol(num); n > 0; n--) {
+        const char* name = image_string(p, end);
+        if (name == NULL || !is_valid_name(name + 1)) return -1;
+        if (name[0] == '-') {
+            unset_variable(name + 1);
+            continue;
+        }
+        if (name[0] == 's') {
+            const char* value = image_string(p, end);
+            if (value == NULL) return -1;
+            set_variable(name + 1, value);
+            continue;
+        }
+        if ((num = image_string(p, end)) == NULL) return -1;
+        unset_variable(name + 1);
+        array_t* a = make_array(name + 1, name[0] == 'A');
+        for (long long k = atoll(num); k > 0; k--) {
+            const char* sub = image_string(p, end);
+            const char* value = image_string(p, end);
+            if (value == NULL) return -1;
+            if (name[0] == 'A') {
+                array_set_key(a, sub, value);
             } else {
-                // $VAR syntax
-                while ((*ptr >= 'a' && *ptr <= 'z') || 
-                       (*ptr >= 'A' && *ptr <= 'Z') || 
-                       (*ptr >= '0' && *ptr <= '9') || 
-                       *ptr == '_') {
-                    if (name_len < VAR_NAME_LEN - 1) {
-                        var_name[name_len++] = *ptr;
-                    }
-                    ptr++;
-                }
+                array_set_index(a, atoll(sub), value);
             }
-            
-            var_name[name_len] = '\0';
-            
-            // Get variable value
-            char* var_value = get_variable(var_name);
-            if (var_value != NULL) {
-                strcat(result, var_value);
+        }
+    }
+    return 0;
+}
+
+// Compare variables by name for qsort()
+static int compare_variables(const void* a, const void* b) {
+    return strcmp((*(variable_t* const*)a)->name, (*(variable_t* const*)b)->name);
+}
+
+// Print one variable, with arrays as ([sub]=value ...)
+static void print_variable(variable_t* v, int as_declare) {
+    if (as_declare) {
+        const char* flag = v->array == NULL ? "--" : array_is_assoc(v->array) ? "-A" : "-a";
+        printf("declare %s %s", flag, v->name);
+    } else {
+        printf("  %s", v->name);
+    }
+    if (v->array != NULL) {
+        printf("=(");
+        long long pos = 0, index;
+        const char *key, *value;
+        for (int n = 0; array_next(v->array, &pos, &index, &key, &value); n++) {
+            if (key != NULL && !is_valid_name(key)) {
+                printf("%s[\"%s\"]=\"%s\"", n > 0 ? " " : "", key, value);
+            } else if (key != NULL) {
+                printf("%s[%s]=\"%s\"", n > 0 ? " " : "", key, value);
             } else {
-                // If variable not found, keep the original reference
-                strcat(result, "$");
-                strcat(result, var_name);
+                printf("%s[%lld]=\"%s\"", n > 0 ? " " : "", index, value);
             }
-        } else {
-            // Regular character
-            int len = strlen(result);
-            if (len < MAX_LEN - 2) {
-                result[len] = *ptr;
-                result[len + 1] = '\0';
+        }
+        printf(")");
+    } else if (v->value != NULL) {
+        printf(as_declare ? "=\"%s\"" : "=%s", v->value);
+    }
+    printf("\n");
+}
+
+// Print the named variables (all of them, sorted, if names is NULL).
+// as_declare prints them as declare commands. Returns 1 if one was not found.
+int print_declarations(char** names, int as_declare) {
+    if (names != NULL) {
+        int status = 0;
+        for (; *names != NULL; names++) {
+            variable_t* v = find_variable(*names);
+            if (v == NULL) {
+                fprintf(stderr, "declare: %s: not found\n", *names);
+                status = 1;
+            } else {
+                print_variable(v, as_declare);
             }
-            ptr++;
         }
+        return status;
     }
-    
-    return result;
+
+    variable_t** all = malloc((variable_count + 1) * sizeof(variable_t*));
+    if (all == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    int n = 0;
+    for (int i = 0; i < num_buckets; i++) {
+        for (variable_t* v = buckets[i]; v != NULL; v = v->next) {
+            all[n++] = v;
+        }
+    }
+    qsort(all, n, sizeof(variable_t*), compare_variables);
+    for (int i = 0; i < n; i++) {
+        print_variable(all[i], as_declare);
+    }
+    free(all);
+    return 0;
 }
 
 // Print all variables
 void print_variables() {
     printf("Shell variables:\n");
-    for (int i = 0; i < variable_count; i++) {
-        printf("  %s=%s\n", variables[i].name, variables[i].value);
-    }
+    print_declarations(NULL, 0);
     
     // Also print some important environment variables
     printf("\nEnvironment variables:\n");
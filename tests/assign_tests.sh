@@ -0,0 +1,30 @@
+#!/bin/sh
+# Prefix assignments on builtins that run commands
+#
+# Usage: sh tests/assign_tests.sh
+
+. tests/lib.sh
+
+MYSHELL_CACHE=$dir/cache
+export MYSHELL_CACHE
+
+check "cached keys -e on the assignment" \
+    'X=1 cached -e X sh -c "echo \$X"; X=2 cached -e X sh -c "echo \$X"; X=1 cached -e X sh -c "echo \$X"' \
+    "1
+2
+1"
+
+check "cached function sees the assignment" \
+    'f() { echo "f: $X"; }; X=3 cached f' \
+    "f: 3"
+
+check "parallel passes assignments" \
+    'X=4 parallel -k sh -c "echo \$X \$0" ::: a b 2>/dev/null' \
+    "4 a
+4 b"
+
+check "batch passes assignments" \
+    'X=5 batch -k 2 sh -c "echo \$X" a b' \
+    "5"
+
+exit $failed
@@ -0,0 +1,34 @@
+#!/bin/sh
+# batch tests: the argument lists are larger than ARG_MAX, so every case
+# runs at least two batches
+#
+# Usage: sh tests/batch_tests.sh
+
+. tests/lib.sh
+
+printf 'line1\nline2\n' > "$dir/s.txt"
+count=$(( $(getconf ARG_MAX) / 8 ))
+files="\$(yes s.txt | head -$count)"
+
+check "option argument before --" \
+    "batch grep -c -e line1 -- $files > out; echo \"status \$?\"; sort -u out; wc -l < out" \
+    "status 0
+s.txt:1
+$count"
+
+check "option argument with -k" \
+    "batch -k 3 grep -c -e line1 $files > out; echo \"status \$?\"; sort -u out; wc -l < out" \
+    "status 0
+s.txt:1
+$count"
+
+check "options without -k or --" \
+    'batch grep -c -e line1 s.txt; echo "status $?"' \
+    "batch: grep: cannot tell where the options end; use -k N or end them with --
+status 2"
+
+check "more than one batch" \
+    "n=\$(batch -k 2 sh -c 'echo batch' $files | wc -l); [ \$n -ge 2 ] && echo split" \
+    "split"
+
+exit $failed
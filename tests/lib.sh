@@ -0,0 +1,21 @@
+# Shared by the test scripts: runs each case in the shell inside a scratch
+# directory and compares its output with the expected text.
+
+SHELL_BIN=${SHELL_BIN:-./bin/myshell}
+case $SHELL_BIN in /*) ;; *) SHELL_BIN=$PWD/$SHELL_BIN ;; esac
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+# check NAME SCRIPT EXPECTED
+check() {
+    actual=$(cd "$dir" && "$SHELL_BIN" -c "$2" 2>&1)
+    if [ "$actual" = "$3" ]; then
+        echo "ok: $1"
+    else
+        echo "FAIL: $1"
+        echo "  expected: $(printf '%s' "$3" | tr '\n' '|')"
+        echo "  actual:   $(printf '%s' "$actual" | tr '\n' '|')"
+        failed=1
+    fi
+}
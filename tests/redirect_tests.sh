@@ -0,0 +1,61 @@
+#!/bin/sh
+# Redirection tests
+#
+# Usage: sh tests/redirect_tests.sh
+
+. tests/lib.sh
+
+printf 'one\ntwo\n' > "$dir/input"
+
+check "done < file" \
+    'while read line; do echo "got $line"; done < input; echo after' \
+    "got one
+got two
+after"
+
+check "} > file" \
+    '{ echo a; echo b; } > out; echo after; /bin/cat out' \
+    "after
+a
+b"
+
+check "} 2> file" \
+    '{ echo err >&2; } 2> errors; /bin/cat errors' \
+    "err"
+
+check "done >> file" \
+    'echo 0 > out; for i in 1 2; do echo $i; done >> out; /bin/cat out' \
+    "0
+1
+2"
+
+check "fi > file" \
+    'if true; then echo yes; fi > out; /bin/cat out' \
+    "yes"
+
+check "esac > file" \
+    'case x in x) echo matched;; esac > out; /bin/cat out' \
+    "matched"
+
+check ") > file" \
+    '(echo sub) > out; /bin/cat out' \
+    "sub"
+
+check "done <<EOF" \
+    'while read line; do echo "[$line]"; done <<EOF
+h1
+h2
+EOF' \
+    "[h1]
+[h2]"
+
+check "function body > file" \
+    'f() { echo called; } > out; f; /bin/cat out' \
+    "called"
+
+check "failed redirection" \
+    '{ echo never; } < missing; echo "status $?"' \
+    "missing: No such file or directory
+status 1"
+
+exit $failed
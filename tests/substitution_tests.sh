@@ -0,0 +1,21 @@
+#!/bin/sh
+# Command substitutions run in-process must not change the shell
+#
+# Usage: sh tests/substitution_tests.sh
+
+. tests/lib.sh
+
+check "function defined inside" \
+    'g() { h() { :; }; }; x=$(g); h 2>/dev/null; echo "status $?"' \
+    "status 127"
+
+check "function redefined inside" \
+    'f() { echo old; }; x=$(f() { echo new; }; f); echo "$x"; f' \
+    "new
+old"
+
+check "option set inside" \
+    'x=$(set -o pipestats); set -o' \
+    "pipestats       off"
+
+exit $failed